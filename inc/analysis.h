@@ -0,0 +1,32 @@
+#ifndef ANALYSIS_INCLUDE
+#define ANALYSIS_INCLUDE
+
+#include "jdp.h"
+#include "trace.h"
+#include "io.h"
+#include "trace_filter.h"
+
+/*
+Analyses over a (custom format) trace, written so that several of them can share a single read of the trace.
+- Each analysis has its own state and is passed every entry in the trace, in order, a batch at a time.
+- The same batch is passed to every analysis, so analyses must not modify the entries.
+- Once the trace has been read, each analysis finishes: printing its results, writing and closing its outputs.
+- A filter can be applied to each batch first, so the analyses only see the entries it keeps.
+*/
+
+#define TRACE_BATCH_NUM_ENTRIES     4096
+
+typedef struct analysis_t analysis_t;
+struct analysis_t
+{
+    char * name;
+    void * state;
+    void (*process)(void * state, custom_trace_entry_t * entries, u64 num_entries);
+    void (*finish)(void * state);
+};
+
+void analyses_run(arena_t * arena, trace_reader_t * input_trace, analysis_t * analyses, u32 num_analyses);
+void analyses_run_filtered(arena_t * arena, trace_reader_t * input_trace, trace_filter_t * filter,
+    analysis_t * analyses, u32 num_analyses); // NOTE no filter if NULL
+
+#endif /* ANALYSIS_INCLUDE */
@@ -0,0 +1,68 @@
+#ifndef EXTERNAL_SET_INCLUDE
+#define EXTERNAL_SET_INCLUDE
+
+#include "jdp.h"
+#include "hashmap.h"
+
+/*
+Exact distinct counting for key sets that may not fit in memory.
+- Keys are stored as their hash_u64 values (a bijection, so distinct hashes are exactly the distinct keys).
+- Hashes are buffered in memory until the buffer is full, at which point the buffer is sorted and deduplicated.
+  If it is still more than half full, it is written out to a spill file as a sorted run.
+- Hashes are radix partitioned on their top EXTERNAL_SET_PARTITION_BITS bits, and each run records where each
+  partition starts. Counting loads each partition from every run in turn, then sorts and counts it in memory, so
+  only 1 / EXTERNAL_SET_NUM_PARTITIONS of the spilled hashes need to fit in the buffer at once.
+- The spill file is unlinked as soon as it is created, so it never outlives the process.
+*/
+
+#define EXTERNAL_SET_PARTITION_BITS     12
+#define EXTERNAL_SET_NUM_PARTITIONS     (1 << EXTERNAL_SET_PARTITION_BITS)
+#define EXTERNAL_SET_MIN_MEMORY         MEGABYTES(1)
+
+typedef struct external_set_run_t external_set_run_t;
+struct external_set_run_t
+{
+    external_set_run_t * next;
+    u64 file_offset;
+    u64 partition_starts[EXTERNAL_SET_NUM_PARTITIONS + 1]; // NOTE in keys, relative to the start of the run
+};
+
+typedef struct external_set_t external_set_t;
+struct external_set_t
+{
+    arena_t arena; // NOTE holds the buffers and the run records
+    char * spill_dir;
+    int spill_fd;
+
+    u64 * keys;
+    u64 * scratch;
+    u64 capacity;
+    u64 count;
+
+    bool has_last_key;
+    u64 last_key;
+
+    external_set_run_t * runs;
+    u64 num_runs;
+    u64 spill_file_size;
+};
+
+external_set_t external_set_create(u64 memory_budget, char * spill_dir);
+void external_set_cleanup(external_set_t * set);
+void external_set_flush(external_set_t * set);
+u64 external_set_count(external_set_t * set);
+
+static inline void external_set_insert(external_set_t * set, u64 key)
+{
+    // NOTE cheap filter for repeated keys, which are very common in address streams
+    if (set->has_last_key && key == set->last_key) return;
+    set->has_last_key = true;
+    set->last_key = key;
+
+    if (set->count == set->capacity) external_set_flush(set);
+    assert(set->count < set->capacity);
+
+    set->keys[set->count++] = hash_u64(key);
+}
+
+#endif /* EXTERNAL_SET_INCLUDE */
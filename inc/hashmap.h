@@ -3,29 +3,797 @@
 
 #include "jdp.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <string.h>
+
+/*
+Open addressing (Robin Hood, linear probing) hash tables with u64 keys.
+- Slot arrays live in their own arena, which is swapped for a larger one when the table grows.
+- Each slot has a probe length byte: 0 for an empty slot, otherwise 1 + the distance from its ideal slot.
+- Lookups stop as soon as they reach a slot whose entry is closer to its ideal slot than the key would be.
+- The memory committed by all live tables is tracked in hash_table_stats (defined where HASHMAP_IMPLEMENTATION is).
+*/
+
+#define HASH_TABLE_INITIAL_CAPACITY     1024
+#define HASH_TABLE_MAX_PROBE_LENGTH     UINT8_MAX
+
+typedef struct hash_table_u64_t hash_table_u64_t;
+struct hash_table_u64_t
+{
+	arena_t arena; // NOTE holds this structure
+	arena_t slots_arena;
+	u64 * keys;
+	u64 * values; // NULL for sets
+	u8 * probe_lengths;
+	u64 capacity;
+	u64 count;
+	bool has_values;
+};
+
+typedef struct hash_table_stats_t hash_table_stats_t;
+struct hash_table_stats_t
+{
+	u64 num_tables;
+	u64 bytes;
+	u64 peak_num_tables;
+	u64 peak_bytes;
+};
+
+extern hash_table_stats_t hash_table_stats;
 
 typedef struct map_u64 map_u64;
 struct map_u64
 {
-	void * ptr;
+	hash_table_u64_t * ptr;
 };
 
 typedef struct set_u64 set_u64;
 struct set_u64
 {
-	void * ptr;
+	hash_table_u64_t * ptr;
+};
+
+
+static inline u64 hash_u64(u64 key)
+{
+	// NOTE murmur3 finalizer, keys are often page or line aligned so all bits need mixing
+	key ^= key >> 33;
+	key *= 0xFF51AFD7ED558CCDULL;
+	key ^= key >> 33;
+	key *= 0xC4CEB9FE1A85EC53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+static inline void hash_table_u64_alloc_slots(hash_table_u64_t * table, u64 capacity)
+{
+	assert(capacity >= 8 && (capacity & (capacity - 1)) == 0);
+
+	u64 slots_size = capacity * sizeof(u64) + capacity * sizeof(u8) + 64;
+	if (table->has_values) slots_size += capacity * sizeof(u64);
+
+	table->slots_arena = arena_alloc(slots_size);
+	table->keys = arena_push_array(&table->slots_arena, u64, capacity);
+	table->values = table->has_values ? arena_push_array(&table->slots_arena, u64, capacity) : NULL;
+	table->probe_lengths = arena_push_array(&table->slots_arena, u8, capacity);
+	table->capacity = capacity;
+	table->count = 0;
+
+	jdp_atomic_add_with_peak(&hash_table_stats.bytes, &hash_table_stats.peak_bytes, table->slots_arena.committed);
+}
+
+static inline hash_table_u64_t * hash_table_u64_create(bool has_values)
+{
+	arena_t arena = arena_alloc(sizeof(hash_table_u64_t));
+	hash_table_u64_t * table = (hash_table_u64_t *) arena_push(&arena, sizeof(hash_table_u64_t));
+	table->arena = arena;
+	table->has_values = has_values;
+
+	jdp_atomic_add_with_peak(&hash_table_stats.num_tables, &hash_table_stats.peak_num_tables, 1);
+	jdp_atomic_add_with_peak(&hash_table_stats.bytes, &hash_table_stats.peak_bytes, table->arena.committed);
+
+	hash_table_u64_alloc_slots(table, HASH_TABLE_INITIAL_CAPACITY);
+
+	return table;
+}
+
+static inline void hash_table_u64_cleanup(hash_table_u64_t * table)
+{
+	jdp_atomic_add_with_peak(&hash_table_stats.num_tables, &hash_table_stats.peak_num_tables, -1);
+	jdp_atomic_add_with_peak(&hash_table_stats.bytes, &hash_table_stats.peak_bytes,
+		-(i64) (table->arena.committed + table->slots_arena.committed));
+
+	arena_free(&table->slots_arena);
+
+	arena_t arena = table->arena;
+	arena_free(&arena);
+}
+
+static inline i64 hash_table_u64_find(hash_table_u64_t * table, u64 key)
+{
+	u64 mask = table->capacity - 1;
+	u64 idx = hash_u64(key) & mask;
+
+	for (u32 probe_length = 1; ; probe_length++)
+	{
+		u32 slot_probe_length = table->probe_lengths[idx];
+
+		// NOTE an empty slot (0) or an entry closer to its ideal slot means the key is not present
+		if (slot_probe_length < probe_length) return -1;
+		if (slot_probe_length == probe_length && table->keys[idx] == key) return (i64) idx;
+
+		idx = (idx + 1) & mask;
+	}
+}
+
+static inline void hash_table_u64_grow(hash_table_u64_t * table);
+
+static inline void hash_table_u64_put(hash_table_u64_t * table, u64 key, u64 value)
+{
+	// NOTE keep the load factor at most 7/8
+	if ((table->count + 1) * 8 > table->capacity * 7) hash_table_u64_grow(table);
+
+	u64 mask = table->capacity - 1;
+	u64 idx = hash_u64(key) & mask;
+
+	bool displacing = false;
+	for (u32 probe_length = 1; ; probe_length++)
+	{
+		if (probe_length >= HASH_TABLE_MAX_PROBE_LENGTH)
+		{
+			// NOTE the table holds every entry except the one being carried (which may be a displaced entry rather
+			// than the new key), so growing and then inserting the carried entry leaves it consistent
+			hash_table_u64_grow(table);
+			hash_table_u64_put(table, key, value);
+			return;
+		}
+
+		u32 slot_probe_length = table->probe_lengths[idx];
+		if (slot_probe_length == 0)
+		{
+			table->keys[idx] = key;
+			if (table->has_values) table->values[idx] = value;
+			table->probe_lengths[idx] = probe_length;
+			table->count++;
+			return;
+		}
+
+		if (!displacing && slot_probe_length == probe_length && table->keys[idx] == key)
+		{
+			if (table->has_values) table->values[idx] = value;
+			return;
+		}
+
+		if (slot_probe_length < probe_length)
+		{
+			// take the slot from the richer entry, and carry on inserting that entry instead
+			u64 displaced_key = table->keys[idx];
+			table->keys[idx] = key;
+			key = displaced_key;
+
+			if (table->has_values)
+			{
+				u64 displaced_value = table->values[idx];
+				table->values[idx] = value;
+				value = displaced_value;
+			}
+
+			table->probe_lengths[idx] = probe_length;
+			probe_length = slot_probe_length;
+			displacing = true;
+		}
+
+		idx = (idx + 1) & mask;
+	}
+}
+
+static inline void hash_table_u64_grow(hash_table_u64_t * table)
+{
+	hash_table_u64_t old_table = *table;
+
+	hash_table_u64_alloc_slots(table, old_table.capacity * 2);
+
+	for (u64 i = 0; i < old_table.capacity; i++)
+	{
+		if (old_table.probe_lengths[i] != 0)
+		{
+			hash_table_u64_put(table, old_table.keys[i], old_table.has_values ? old_table.values[i] : 0);
+		}
+	}
+	assert(table->count == old_table.count);
+
+	jdp_atomic_add_with_peak(&hash_table_stats.bytes, &hash_table_stats.peak_bytes, -(i64) old_table.slots_arena.committed);
+	arena_free(&old_table.slots_arena);
+}
+
+static inline void hash_table_u64_remove(hash_table_u64_t * table, u64 key)
+{
+	i64 found_idx = hash_table_u64_find(table, key);
+	if (found_idx < 0) return;
+
+	u64 mask = table->capacity - 1;
+	u64 idx = (u64) found_idx;
+
+	// backward shift deletion: pull the following displaced entries one slot closer to their ideal slots
+	u64 next_idx = (idx + 1) & mask;
+	while (table->probe_lengths[next_idx] > 1)
+	{
+		table->keys[idx] = table->keys[next_idx];
+		if (table->has_values) table->values[idx] = table->values[next_idx];
+		table->probe_lengths[idx] = table->probe_lengths[next_idx] - 1;
+
+		idx = next_idx;
+		next_idx = (next_idx + 1) & mask;
+	}
+
+	table->probe_lengths[idx] = 0;
+
+	assert(table->count > 0);
+	table->count--;
+}
+
+// NOTE iterates over occupied slots: for (i64 idx = hash_table_u64_next(table, -1); idx >= 0; idx = hash_table_u64_next(table, idx))
+static inline i64 hash_table_u64_next(hash_table_u64_t * table, i64 idx)
+{
+	for (u64 i = (u64) (idx + 1); i < table->capacity; i++)
+	{
+		if (table->probe_lengths[i]) return (i64) i;
+	}
+
+	return -1;
+}
+
+static inline void hash_table_u64_add(hash_table_u64_t * table, u64 key, u64 delta)
+{
+	assert(table->has_values);
+	i64 idx = hash_table_u64_find(table, key);
+	if (idx >= 0) table->values[idx] += delta;
+	else hash_table_u64_put(table, key, delta);
+}
+
+
+static inline map_u64 map_u64_create(void)
+{
+	map_u64 map = {0};
+	map.ptr = hash_table_u64_create(true);
+	return map;
+}
+
+static inline void map_u64_cleanup(map_u64 * map)
+{
+	assert(map->ptr);
+	hash_table_u64_cleanup(map->ptr);
+	map->ptr = NULL;
+}
+
+static inline bool map_u64_get(map_u64 map, u64 key, u64 * value)
+{
+	assert(map.ptr);
+	i64 idx = hash_table_u64_find(map.ptr, key);
+	if (idx >= 0)
+	{
+		*value = map.ptr->values[idx];
+		return true;
+	}
+
+	return false;
+}
+
+static inline void map_u64_set(map_u64 map, u64 key, u64 value)
+{
+	assert(map.ptr);
+	hash_table_u64_put(map.ptr, key, value);
+}
+
+static inline void map_u64_remove(map_u64 map, u64 key)
+{
+	assert(map.ptr);
+	hash_table_u64_remove(map.ptr, key);
+}
+
+
+static inline set_u64 set_u64_create(void)
+{
+	set_u64 set = {0};
+	set.ptr = hash_table_u64_create(false);
+	return set;
+}
+
+static inline void set_u64_cleanup(set_u64 * set)
+{
+	assert(set->ptr);
+	hash_table_u64_cleanup(set->ptr);
+	set->ptr = NULL;
+}
+
+static inline void set_u64_insert(set_u64 set, u64 key)
+{
+	assert(set.ptr);
+	hash_table_u64_put(set.ptr, key, 0);
+}
+
+static inline void set_u64_remove(set_u64 set, u64 key)
+{
+	assert(set.ptr);
+	hash_table_u64_remove(set.ptr, key);
+}
+
+static inline bool set_u64_contains(set_u64 set, u64 key)
+{
+	assert(set.ptr);
+	return hash_table_u64_find(set.ptr, key) >= 0;
+}
+
+static inline u64 set_u64_size(set_u64 set)
+{
+	assert(set.ptr);
+	return set.ptr->count;
+}
+
+
+/*
+Concurrent (lock-striped) versions of the maps and sets above, for use from multiple threads.
+- Keys are spread over CONCURRENT_HASH_TABLE_NUM_SHARDS independent tables by the top bits of their hash (the
+  tables themselves index by the bottom bits), each with its own lock and on its own cache lines.
+- Bulk operations group keys by shard first, so each shard lock is taken once per group rather than once per key.
+- Threads can insert directly (in bulk, e.g. get-info's accessed pages), or fill a local map_u64/set_u64 and merge it
+  in once they are done, which avoids the locks entirely while inserting (see tests/concurrent_hashmap_test.c).
+- Sizes are only exact once all writers have finished.
+*/
+
+#define CONCURRENT_HASH_TABLE_SHARD_BITS    7
+#define CONCURRENT_HASH_TABLE_NUM_SHARDS    (1 << CONCURRENT_HASH_TABLE_SHARD_BITS)
+#define CONCURRENT_HASH_TABLE_BULK_SIZE     256
+
+typedef struct concurrent_hash_table_shard_t concurrent_hash_table_shard_t;
+struct concurrent_hash_table_shard_t
+{
+	pthread_mutex_t lock;
+	hash_table_u64_t * table;
+} __attribute__((aligned(64)));
+
+typedef struct concurrent_hash_table_u64_t concurrent_hash_table_u64_t;
+struct concurrent_hash_table_u64_t
+{
+	concurrent_hash_table_shard_t shards[CONCURRENT_HASH_TABLE_NUM_SHARDS];
+	arena_t arena; // NOTE holds this structure
+	bool has_values;
+};
+
+typedef struct concurrent_map_u64 concurrent_map_u64;
+struct concurrent_map_u64
+{
+	concurrent_hash_table_u64_t * ptr;
+};
+
+typedef struct concurrent_set_u64 concurrent_set_u64;
+struct concurrent_set_u64
+{
+	concurrent_hash_table_u64_t * ptr;
+};
+
+typedef enum concurrent_put_mode_t concurrent_put_mode_t;
+enum concurrent_put_mode_t
+{
+	CONCURRENT_PUT_SET,
+	CONCURRENT_PUT_ADD
+};
+
+
+static inline u64 concurrent_hash_table_get_shard(u64 key)
+{
+	return hash_u64(key) >> (64 - CONCURRENT_HASH_TABLE_SHARD_BITS);
+}
+
+static inline concurrent_hash_table_u64_t * concurrent_hash_table_u64_create(bool has_values)
+{
+	arena_t arena = arena_alloc(sizeof(concurrent_hash_table_u64_t));
+	concurrent_hash_table_u64_t * table =
+		(concurrent_hash_table_u64_t *) arena_push(&arena, sizeof(concurrent_hash_table_u64_t));
+	assert((u64) table % 64 == 0);
+
+	table->arena = arena;
+	table->has_values = has_values;
+
+	for (i64 i = 0; i < CONCURRENT_HASH_TABLE_NUM_SHARDS; i++)
+	{
+		int result = pthread_mutex_init(&table->shards[i].lock, NULL);
+		assert(result == 0);
+		table->shards[i].table = hash_table_u64_create(has_values);
+	}
+
+	return table;
+}
+
+static inline void concurrent_hash_table_u64_cleanup(concurrent_hash_table_u64_t * table)
+{
+	for (i64 i = 0; i < CONCURRENT_HASH_TABLE_NUM_SHARDS; i++)
+	{
+		pthread_mutex_destroy(&table->shards[i].lock);
+		hash_table_u64_cleanup(table->shards[i].table);
+	}
+
+	arena_t arena = table->arena;
+	arena_free(&arena);
+}
+
+static inline void concurrent_hash_table_u64_put(concurrent_hash_table_u64_t * table,
+	u64 key, u64 value, concurrent_put_mode_t mode)
+{
+	concurrent_hash_table_shard_t * shard = &table->shards[concurrent_hash_table_get_shard(key)];
+
+	pthread_mutex_lock(&shard->lock);
+	if (mode == CONCURRENT_PUT_ADD) hash_table_u64_add(shard->table, key, value);
+	else hash_table_u64_put(shard->table, key, value);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+// NOTE values may be NULL for sets
+static inline void concurrent_hash_table_u64_put_bulk(concurrent_hash_table_u64_t * table,
+	u64 * keys, u64 * values, u64 count, concurrent_put_mode_t mode)
+{
+	static_assert(CONCURRENT_HASH_TABLE_NUM_SHARDS <= 256, "Shard indices are stored in bytes.");
+	assert(values || !table->has_values);
+
+	u64 sorted_keys[CONCURRENT_HASH_TABLE_BULK_SIZE];
+	u64 sorted_values[CONCURRENT_HASH_TABLE_BULK_SIZE];
+	u8 key_shards[CONCURRENT_HASH_TABLE_BULK_SIZE];
+	u32 shard_offsets[CONCURRENT_HASH_TABLE_NUM_SHARDS + 1];
+
+	for (u64 start = 0; start < count; start += CONCURRENT_HASH_TABLE_BULK_SIZE)
+	{
+		u64 num_keys = count - start;
+		if (num_keys > CONCURRENT_HASH_TABLE_BULK_SIZE) num_keys = CONCURRENT_HASH_TABLE_BULK_SIZE;
+
+		// counting sort of this group of keys by shard
+		for (i64 i = 0; i <= CONCURRENT_HASH_TABLE_NUM_SHARDS; i++) shard_offsets[i] = 0;
+		for (u64 i = 0; i < num_keys; i++)
+		{
+			key_shards[i] = concurrent_hash_table_get_shard(keys[start + i]);
+			shard_offsets[key_shards[i] + 1]++;
+		}
+		for (i64 i = 0; i < CONCURRENT_HASH_TABLE_NUM_SHARDS; i++) shard_offsets[i + 1] += shard_offsets[i];
+		for (u64 i = 0; i < num_keys; i++)
+		{
+			u32 sorted_idx = shard_offsets[key_shards[i]]++;
+			sorted_keys[sorted_idx] = keys[start + i];
+			sorted_values[sorted_idx] = values ? values[start + i] : 0;
+		}
+
+		// NOTE each offset now points at the end of its shard's keys (i.e. the start of the next shard's)
+		u32 shard_start = 0;
+		for (i64 shard_idx = 0; shard_idx < CONCURRENT_HASH_TABLE_NUM_SHARDS; shard_idx++)
+		{
+			u32 shard_end = shard_offsets[shard_idx];
+			if (shard_end == shard_start) continue;
+
+			concurrent_hash_table_shard_t * shard = &table->shards[shard_idx];
+			pthread_mutex_lock(&shard->lock);
+			for (u32 i = shard_start; i < shard_end; i++)
+			{
+				if (mode == CONCURRENT_PUT_ADD) hash_table_u64_add(shard->table, sorted_keys[i], sorted_values[i]);
+				else hash_table_u64_put(shard->table, sorted_keys[i], sorted_values[i]);
+			}
+			pthread_mutex_unlock(&shard->lock);
+
+			shard_start = shard_end;
+		}
+	}
+}
+
+static inline void concurrent_hash_table_u64_merge(concurrent_hash_table_u64_t * table,
+	hash_table_u64_t * local, concurrent_put_mode_t mode)
+{
+	u64 keys[CONCURRENT_HASH_TABLE_BULK_SIZE];
+	u64 values[CONCURRENT_HASH_TABLE_BULK_SIZE];
+	u64 num_keys = 0;
+
+	for (u64 i = 0; i < local->capacity; i++)
+	{
+		if (local->probe_lengths[i] == 0) continue;
+
+		keys[num_keys] = local->keys[i];
+		values[num_keys] = local->has_values ? local->values[i] : 0;
+		num_keys++;
+
+		if (num_keys == CONCURRENT_HASH_TABLE_BULK_SIZE)
+		{
+			concurrent_hash_table_u64_put_bulk(table, keys, values, num_keys, mode);
+			num_keys = 0;
+		}
+	}
+
+	concurrent_hash_table_u64_put_bulk(table, keys, values, num_keys, mode);
+}
+
+static inline bool concurrent_hash_table_u64_find(concurrent_hash_table_u64_t * table, u64 key, u64 * value)
+{
+	concurrent_hash_table_shard_t * shard = &table->shards[concurrent_hash_table_get_shard(key)];
+
+	pthread_mutex_lock(&shard->lock);
+	i64 idx = hash_table_u64_find(shard->table, key);
+	if (idx >= 0 && value) *value = shard->table->values[idx];
+	pthread_mutex_unlock(&shard->lock);
+
+	return idx >= 0;
+}
+
+static inline u64 concurrent_hash_table_u64_size(concurrent_hash_table_u64_t * table)
+{
+	u64 count = 0;
+	for (i64 i = 0; i < CONCURRENT_HASH_TABLE_NUM_SHARDS; i++)
+	{
+		pthread_mutex_lock(&table->shards[i].lock);
+		count += table->shards[i].table->count;
+		pthread_mutex_unlock(&table->shards[i].lock);
+	}
+
+	return count;
+}
+
+
+static inline concurrent_map_u64 concurrent_map_u64_create(void)
+{
+	concurrent_map_u64 map = {0};
+	map.ptr = concurrent_hash_table_u64_create(true);
+	return map;
+}
+
+static inline void concurrent_map_u64_cleanup(concurrent_map_u64 * map)
+{
+	assert(map->ptr);
+	concurrent_hash_table_u64_cleanup(map->ptr);
+	map->ptr = NULL;
+}
+
+static inline bool concurrent_map_u64_get(concurrent_map_u64 map, u64 key, u64 * value)
+{
+	assert(map.ptr);
+	return concurrent_hash_table_u64_find(map.ptr, key, value);
+}
+
+static inline void concurrent_map_u64_set(concurrent_map_u64 map, u64 key, u64 value)
+{
+	assert(map.ptr);
+	concurrent_hash_table_u64_put(map.ptr, key, value, CONCURRENT_PUT_SET);
+}
+
+// NOTE missing keys start at zero
+static inline void concurrent_map_u64_add(concurrent_map_u64 map, u64 key, u64 delta)
+{
+	assert(map.ptr);
+	concurrent_hash_table_u64_put(map.ptr, key, delta, CONCURRENT_PUT_ADD);
+}
+
+static inline void concurrent_map_u64_add_bulk(concurrent_map_u64 map, u64 * keys, u64 * deltas, u64 count)
+{
+	assert(map.ptr);
+	concurrent_hash_table_u64_put_bulk(map.ptr, keys, deltas, count, CONCURRENT_PUT_ADD);
+}
+
+// NOTE values of keys present in both maps are summed (e.g. for merging per-thread counts)
+static inline void concurrent_map_u64_merge(concurrent_map_u64 map, map_u64 local)
+{
+	assert(map.ptr && local.ptr);
+	concurrent_hash_table_u64_merge(map.ptr, local.ptr, CONCURRENT_PUT_ADD);
+}
+
+static inline u64 concurrent_map_u64_size(concurrent_map_u64 map)
+{
+	assert(map.ptr);
+	return concurrent_hash_table_u64_size(map.ptr);
+}
+
+
+static inline concurrent_set_u64 concurrent_set_u64_create(void)
+{
+	concurrent_set_u64 set = {0};
+	set.ptr = concurrent_hash_table_u64_create(false);
+	return set;
+}
+
+static inline void concurrent_set_u64_cleanup(concurrent_set_u64 * set)
+{
+	assert(set->ptr);
+	concurrent_hash_table_u64_cleanup(set->ptr);
+	set->ptr = NULL;
+}
+
+static inline void concurrent_set_u64_insert(concurrent_set_u64 set, u64 key)
+{
+	assert(set.ptr);
+	concurrent_hash_table_u64_put(set.ptr, key, 0, CONCURRENT_PUT_SET);
+}
+
+static inline void concurrent_set_u64_insert_bulk(concurrent_set_u64 set, u64 * keys, u64 count)
+{
+	assert(set.ptr);
+	concurrent_hash_table_u64_put_bulk(set.ptr, keys, NULL, count, CONCURRENT_PUT_SET);
+}
+
+static inline void concurrent_set_u64_merge(concurrent_set_u64 set, set_u64 local)
+{
+	assert(set.ptr && local.ptr);
+	concurrent_hash_table_u64_merge(set.ptr, local.ptr, CONCURRENT_PUT_SET);
+}
+
+static inline bool concurrent_set_u64_contains(concurrent_set_u64 set, u64 key)
+{
+	assert(set.ptr);
+	return concurrent_hash_table_u64_find(set.ptr, key, NULL);
+}
+
+static inline u64 concurrent_set_u64_size(concurrent_set_u64 set)
+{
+	assert(set.ptr);
+	return concurrent_hash_table_u64_size(set.ptr);
+}
+
+/*
+Dense bitset over a bounded range of indices (e.g. capability-aligned physical addresses).
+- Backed by arena memory, so it starts zeroed and only the touched pages are ever faulted in.
+- Range operations work a word at a time.
+*/
+
+typedef struct bitset_t bitset_t;
+struct bitset_t
+{
+	u64 * words;
+	u64 num_bits;
 };
 
-map_u64 map_u64_create(void);
-void map_u64_cleanup(map_u64 * map);
-bool map_u64_get(map_u64 map, u64 key, u64 * value);
-void map_u64_set(map_u64 map, u64 key, u64 value);
+#define BITSET_WORD_BITS 64
+
+static inline bitset_t bitset_create(arena_t * arena, u64 num_bits)
+{
+	bitset_t set = {0};
+	set.num_bits = num_bits;
+	set.words = arena_push_array(arena, u64, align_ceil_pow_2(num_bits, BITSET_WORD_BITS) / BITSET_WORD_BITS);
+	return set;
+}
+
+static inline bool bitset_test(bitset_t set, u64 idx)
+{
+	assert(idx < set.num_bits);
+	return (set.words[idx / BITSET_WORD_BITS] >> (idx % BITSET_WORD_BITS)) & 1;
+}
+
+static inline void bitset_set(bitset_t set, u64 idx)
+{
+	assert(idx < set.num_bits);
+	set.words[idx / BITSET_WORD_BITS] |= (u64) 1 << (idx % BITSET_WORD_BITS);
+}
+
+static inline void bitset_clear(bitset_t set, u64 idx)
+{
+	assert(idx < set.num_bits);
+	set.words[idx / BITSET_WORD_BITS] &= ~((u64) 1 << (idx % BITSET_WORD_BITS));
+}
+
+static inline void bitset_assign(bitset_t set, u64 idx, bool value)
+{
+	if (value) bitset_set(set, idx);
+	else bitset_clear(set, idx);
+}
+
+// NOTE mask of the bits in [start, end) that fall within the word containing start (end is clamped to that word)
+static inline u64 bitset_word_mask(u64 start, u64 end)
+{
+	assert(start < end);
+	u64 first_bit = start % BITSET_WORD_BITS;
+	u64 num_bits = end - start;
+	if (num_bits > BITSET_WORD_BITS - first_bit) num_bits = BITSET_WORD_BITS - first_bit;
+
+	u64 mask = num_bits == BITSET_WORD_BITS ? ~(u64) 0 : (((u64) 1 << num_bits) - 1);
+	return mask << first_bit;
+}
+
+// NOTE number of set bits in [start, end)
+static inline u64 bitset_count_range(bitset_t set, u64 start, u64 end)
+{
+	assert(start <= end && end <= set.num_bits);
+
+	u64 count = 0;
+	while (start < end)
+	{
+		u64 mask = bitset_word_mask(start, end);
+		count += __builtin_popcountll(set.words[start / BITSET_WORD_BITS] & mask);
+		start = align_floor_pow_2(start, BITSET_WORD_BITS) + BITSET_WORD_BITS;
+	}
 
-set_u64 set_u64_create(void);
-void set_u64_cleanup(set_u64 * set);
-void set_u64_insert(set_u64 set, u64 key);
-void set_u64_remove(set_u64 set, u64 key);
-bool set_u64_contains(set_u64 set, u64 key);
-u64 set_u64_size(set_u64 set);
+	return count;
+}
+
+static inline u64 bitset_count(bitset_t set)
+{
+	return bitset_count_range(set, 0, set.num_bits);
+}
+
+static inline bool bitset_any_range(bitset_t set, u64 start, u64 end)
+{
+	assert(start <= end && end <= set.num_bits);
+
+	while (start < end)
+	{
+		if (set.words[start / BITSET_WORD_BITS] & bitset_word_mask(start, end)) return true;
+		start = align_floor_pow_2(start, BITSET_WORD_BITS) + BITSET_WORD_BITS;
+	}
+
+	return false;
+}
+
+static inline void bitset_assign_range(bitset_t set, u64 start, u64 end, bool value)
+{
+	assert(start <= end && end <= set.num_bits);
+
+	while (start < end)
+	{
+		u64 mask = bitset_word_mask(start, end);
+		if (value) set.words[start / BITSET_WORD_BITS] |= mask;
+		else set.words[start / BITSET_WORD_BITS] &= ~mask;
+		start = align_floor_pow_2(start, BITSET_WORD_BITS) + BITSET_WORD_BITS;
+	}
+}
+
+/*
+Dense set over a bounded range of indices that is emptied in O(1), by stamping members with the current epoch.
+- Emptying moves on to the next epoch, so a set that is reset every interval is never cleared or reallocated
+  (except when the 32-bit epoch wraps around).
+- Backed by arena memory, so it starts zeroed (epoch 0 is never current) and only the touched pages are faulted in.
+*/
+
+typedef struct epoch_set_t epoch_set_t;
+struct epoch_set_t
+{
+	u32 * stamps;
+	u64 num_indices;
+	u32 epoch;
+	u64 count; // NOTE members in the current epoch
+};
+
+static inline epoch_set_t epoch_set_create(arena_t * arena, u64 num_indices)
+{
+	epoch_set_t set = {0};
+	set.stamps = arena_push_array(arena, u32, num_indices);
+	set.num_indices = num_indices;
+	set.epoch = 1;
+	return set;
+}
+
+// NOTE returns true if the index was not already a member
+static inline bool epoch_set_insert(epoch_set_t * set, u64 idx)
+{
+	assert(idx < set->num_indices);
+	if (set->stamps[idx] == set->epoch) return false;
+
+	set->stamps[idx] = set->epoch;
+	set->count++;
+	return true;
+}
+
+static inline bool epoch_set_contains(epoch_set_t * set, u64 idx)
+{
+	assert(idx < set->num_indices);
+	return set->stamps[idx] == set->epoch;
+}
+
+static inline void epoch_set_reset(epoch_set_t * set)
+{
+	set->count = 0;
+	set->epoch++;
+
+	if (set->epoch == 0)
+	{
+		memset(set->stamps, 0, set->num_indices * sizeof(u32));
+		set->epoch = 1;
+	}
+}
 
 #endif /* HASHMAP_INCLUDE */
+
+#ifdef HASHMAP_IMPLEMENTATION
+
+hash_table_stats_t hash_table_stats;
+
+#endif /* HASHMAP_IMPLEMENTATION */
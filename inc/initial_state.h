@@ -0,0 +1,85 @@
+#ifndef INITIAL_STATE_INCLUDE
+#define INITIAL_STATE_INCLUDE
+
+#include "jdp.h"
+#include "trace.h"
+#include "common.h"
+#include "hashmap.h"
+
+/*
+Sparse initial state file format:
+- A header describing the memory layout (base paddr, memory size, granularity of records).
+- One record per page containing at least one accessed capability-aligned address: the page index
+  (relative to the base paddr), followed by the initial_access_t entries for every capability in the page.
+- Pages without any accesses are omitted, and are read back as untouched (all zero).
+
+Version 1 files and the old dense format (one initial_access_t per capability in memory, no header) stored the
+type without the offset (so untouched entries were type -1), and are converted when they are read.
+*/
+
+#define INITIAL_STATE_MAGIC             "CHERIIS"
+#define INITIAL_STATE_MAGIC_SIZE        8
+#define INITIAL_STATE_VERSION           2
+
+#define INITIAL_STATE_TABLE_SIZE        (MEMORY_SIZE / CAP_SIZE_BYTES)
+#define INITIAL_STATE_PAGE_ENTRIES      (PAGE_SIZE / CAP_SIZE_BYTES)
+
+typedef struct initial_state_header_t initial_state_header_t;
+struct initial_state_header_t
+{
+    char magic[INITIAL_STATE_MAGIC_SIZE];
+    u32 version;
+    u32 cap_size_bytes;
+    u64 base_paddr;
+    u64 memory_size;
+    u64 page_size;
+    u64 num_pages;
+};
+
+static inline initial_access_t initial_access_create(u8 type, u8 tag)
+{
+    assert(type < 127 && tag <= 1);
+
+    initial_access_t initial_access = {0};
+    initial_access.type_plus_one = type + 1;
+    initial_access.tag = tag;
+    return initial_access;
+}
+
+static inline bool initial_access_untouched(initial_access_t initial_access)
+{
+    return initial_access.type_plus_one == 0;
+}
+
+// NOTE -1 for untouched addresses
+static inline i8 initial_access_get_type(initial_access_t initial_access)
+{
+    return (i8) initial_access.type_plus_one - 1;
+}
+
+static inline i64 initial_state_get_index(u64 paddr)
+{
+    assert(check_paddr_valid(paddr));
+    u64 mem_offset = paddr - BASE_PADDR;
+    assert(mem_offset % CAP_SIZE_BYTES == 0);
+
+    i64 table_idx = mem_offset / CAP_SIZE_BYTES;
+    assert(table_idx >= 0 && table_idx < INITIAL_STATE_TABLE_SIZE);
+
+    return table_idx;
+}
+
+// NOTE memory accessed first by LOADs, STOREs or INSTRs is assumed to not have had its tag set before the trace
+static inline bool initial_access_guess_tag(initial_access_t initial_access)
+{
+    i8 type = initial_access_get_type(initial_access);
+    return (type == CUSTOM_TRACE_TYPE_CLOAD || type == CUSTOM_TRACE_TYPE_CSTORE) && initial_access.tag;
+}
+
+void initial_state_write(arena_t * arena, char * filename, initial_access_t * table);
+// NOTE if loaded_pages is not NULL, it is set to a bitset of the pages (as table page indices) that may have accesses
+initial_access_t * initial_state_load(arena_t * arena, char * filename, bitset_t * loaded_pages);
+// NOTE the guessed tags of the 64 entries starting at table_idx (bit i for entry table_idx + i)
+u64 initial_state_guess_tags_word(initial_access_t * table, u64 table_idx);
+
+#endif /* INITIAL_STATE_INCLUDE */
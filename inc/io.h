@@ -72,6 +72,8 @@ struct trace_writer_t
 
 trace_reader_t trace_reader_open(arena_t * arena, char * filename, u8 type);
 bool trace_reader_get(trace_reader_t * reader, void * entry, size_t entry_size);
+size_t trace_reader_read(trace_reader_t * reader, void * buffer, size_t size);
+size_t trace_reader_get_batch(trace_reader_t * reader, void * entries, size_t entry_size, size_t max_entries);
 void trace_reader_close(trace_reader_t * reader);
 
 trace_writer_t trace_writer_open(arena_t * arena, char * filename, u8 type);
@@ -4,6 +4,7 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <string.h>
 
 #if defined(__gnu_linux__)
  #define JDP_OS_LINUX 1
@@ -39,10 +40,16 @@ typedef double      f64;
 #define TERABYTES(x)    (GIGABYTES(x)*1024LL)
 
 #define array_count(a)              (sizeof(a) / sizeof((a)[0]))
+#define JDP_STRINGIFY_(x)           #x
+#define JDP_STRINGIFY(x)            JDP_STRINGIFY_(x)
 #define align_floor_pow_2(x, b)     ((x) & (~((b) - 1)))
 #define align_ceil_pow_2(x, b)      (((x) + ((b) - 1)) & (~((b) - 1)))
 
 #define ARENA_COMMIT_SIZE       KILOBYTES(64)
+#define ARENA_HUGE_PAGE_SIZE    MEGABYTES(2)
+#define ARENA_SCRATCH_SIZE      MEGABYTES(64)
+#define ARENA_SCRATCH_COUNT     2
+#define ARENA_MAX_ALLOCATION_SITES  512
 #define COMMON_TEMP_BUF_LEN    	KILOBYTES(8)
 
 #if !defined(__cplusplus) && !defined(static_assert)
@@ -53,6 +60,12 @@ typedef double      f64;
  #endif
 #endif
 
+#if defined(_MSC_VER)
+ #define jdp_thread_local __declspec(thread)
+#else
+ #define jdp_thread_local __thread
+#endif
+
 #if JDP_OS_WINDOWS
  #include <windows.h>
  #include "stb_sprintf.h"
@@ -91,19 +104,99 @@ bool string_match(string_t a, string_t b);
 bool string_match_prefix(string_t s, string_t prefix);
 
 
+/*
+Arenas reserve address space up front and commit it as it is pushed (in one call per push).
+- If a push does not fit in the reservation, a new (larger) block is reserved and chained onto the arena, so the
+  initial size is only a hint. Each allocation is still contiguous.
+- Memory returned by pushes is always zeroed. Memory given back by arena_temp_end is only zeroed again when it is
+  reused, using the high water mark of each block.
+- Each thread has ARENA_SCRATCH_COUNT scratch arenas for temporary allocations (reserved on first use), which
+  should always be used within a temporary scope.
+- Reserved, committed and used (high water) bytes are tracked over all arenas in the process, along with the
+  bytes pushed from each named allocation site (arena_push_array names them after the file, line and type).
+*/
+
+enum arena_flags_t
+{
+    ARENA_FLAG_HUGE_PAGES   = 1 << 0, // transparent huge pages (madvise), committed in huge page steps
+    ARENA_FLAG_HUGETLB      = 1 << 1, // explicit huge pages, taken from the pool for the whole reservation (falls back to ARENA_FLAG_HUGE_PAGES)
+    ARENA_FLAG_POPULATE     = 1 << 2  // fault in memory when it is committed, rather than on first access
+};
+
+typedef struct arena_block_t arena_block_t;
+struct arena_block_t // NOTE stored at the start of each chained block, describes the block before it
+{
+    arena_block_t * prev;
+    void * start;
+    u64 pos;
+    u64 high_water;
+    u64 committed;
+    u64 reserved;
+};
+
 typedef struct arena_t arena_t;
 struct arena_t
 {
     void * start;
     u64 pos;
+    u64 high_water; // NOTE memory between pos and the high water mark has been used before
+    u64 committed;
+    u64 reserved;
+    u32 flags;
+    arena_block_t * prev_block;
+};
+
+typedef struct arena_temp_t arena_temp_t;
+struct arena_temp_t
+{
+    arena_t * arena;
+    void * start;
+    u64 pos;
+};
+
+typedef struct memory_stats_t memory_stats_t;
+struct memory_stats_t // NOTE totals over all live arena blocks
+{
+    u64 used; // sum of the high water marks
     u64 committed;
     u64 reserved;
+    u64 peak_used;
+    u64 peak_committed;
+    u64 peak_reserved;
 };
 
+typedef struct allocation_site_t allocation_site_t;
+struct allocation_site_t
+{
+    const char * name;
+    u64 num_allocations;
+    u64 num_bytes; // NOTE cumulative, so this includes memory since given back by temporary scopes
+};
+
+static inline void jdp_atomic_add_with_peak(u64 * value, u64 * peak, i64 delta)
+{
+    u64 new_value = __atomic_add_fetch(value, (u64) delta, __ATOMIC_RELAXED);
+    u64 old_peak = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (new_value > old_peak &&
+        !__atomic_compare_exchange_n(peak, &old_peak, new_value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
 arena_t arena_alloc(u64 size);
+arena_t arena_alloc_ex(u64 size, u32 flags);
 void arena_free(arena_t * arena);
 void * arena_push(arena_t * arena, u64 amount);
-#define arena_push_array(arena, type, count) ((type *) arena_push(arena, sizeof(type) * (count)))
+void * arena_push_named(arena_t * arena, u64 amount, const char * name); // NOTE name must outlive the process (e.g. a literal)
+#define arena_push_array(arena, type, count) \
+    ((type *) arena_push_named(arena, sizeof(type) * (count), __FILE__ ":" JDP_STRINGIFY(__LINE__) " " #type))
+
+arena_temp_t arena_temp_begin(arena_t * arena);
+void arena_temp_end(arena_temp_t temp);
+
+arena_t * arena_get_scratch(arena_t * conflict); // NOTE returns a scratch arena other than conflict (which may be NULL)
+void arena_release_scratch(void); // NOTE for threads to call before exiting
+
+memory_stats_t memory_get_stats(void);
+u64 memory_get_allocation_sites(allocation_site_t * sites, u64 max_sites); // NOTE returns the number of sites copied
 
 #endif /* JDP_INCLUDE */
 
@@ -174,13 +267,15 @@ bool string_match_prefix(string_t s, string_t prefix)
 
 
 #if JDP_OS_WINDOWS
-static void * jdp_mem_reserve(u64 size)
+static void * jdp_mem_reserve(u64 size, u32 * flags)
 {
+    *flags &= ~(ARENA_FLAG_HUGE_PAGES | ARENA_FLAG_HUGETLB);
     return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_READWRITE);
 }
 
-static bool jdp_mem_commit(void * ptr, u64 size)
+static bool jdp_mem_commit(void * ptr, u64 size, u32 flags)
 {
+    (void) flags;
     return (VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != 0);
 }
 
@@ -191,16 +286,56 @@ static void jdp_mem_release(void * ptr, u64 size)
 
 }
 #elif JDP_OS_LINUX
-static void * jdp_mem_reserve(u64 size)
+static void * jdp_mem_reserve(u64 size, u32 * flags)
 {
-    void * result = mmap(0, size, PROT_NONE, MAP_PRIVATE |  MAP_ANONYMOUS, -1, 0);
+    if (*flags & ARENA_FLAG_HUGETLB)
+    {
+        assert(size % ARENA_HUGE_PAGE_SIZE == 0);
+
+        void * result = mmap(0, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (result != (void *) -1) return result;
+
+        // NOTE not enough huge pages in the pool (or none configured)
+        *flags = (*flags & ~ARENA_FLAG_HUGETLB) | ARENA_FLAG_HUGE_PAGES;
+    }
+
+    if (*flags & ARENA_FLAG_HUGE_PAGES)
+    {
+        // over-reserve so the start can be huge page aligned, then trim the ends
+        u64 padded_size = size + ARENA_HUGE_PAGE_SIZE;
+        u8 * padded = (u8 *) mmap(0, padded_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (padded == (void *) -1) return 0;
+
+        u8 * result = (u8 *) align_ceil_pow_2((u64) padded, ARENA_HUGE_PAGE_SIZE);
+        if (result > padded) munmap(padded, result - padded);
+        if (padded + padded_size > result + size) munmap(result + size, (padded + padded_size) - (result + size));
+
+        madvise(result, size, MADV_HUGEPAGE);
+        return result;
+    }
+
+    void * result = mmap(0, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (result == (void *) -1) result = 0;
     return result;
 }
 
-static bool jdp_mem_commit(void * ptr, u64 size)
+static bool jdp_mem_commit(void * ptr, u64 size, u32 flags)
 {
-    return (mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0);
+    if (mprotect(ptr, size, PROT_READ | PROT_WRITE) != 0) return false;
+
+    if (flags & ARENA_FLAG_POPULATE)
+    {
+#ifdef MADV_POPULATE_WRITE
+        if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0) return true;
+#endif
+        // NOTE the memory is already zero, this just takes the page faults now
+        for (u64 offset = 0; offset < size; offset += KILOBYTES(4))
+        {
+            ((volatile u8 *) ptr)[offset] = 0;
+        }
+    }
+
+    return true;
 }
 
 static void jdp_mem_release(void * ptr, u64 size)
@@ -209,26 +344,150 @@ static void jdp_mem_release(void * ptr, u64 size)
 }
 #endif
 
-arena_t arena_alloc(u64 size)
+static memory_stats_t jdp_memory_stats;
+static allocation_site_t jdp_allocation_sites[ARENA_MAX_ALLOCATION_SITES];
+
+static void jdp_memory_stats_update(i64 used_delta, i64 committed_delta, i64 reserved_delta)
+{
+    memory_stats_t * stats = &jdp_memory_stats;
+    if (used_delta) jdp_atomic_add_with_peak(&stats->used, &stats->peak_used, used_delta);
+    if (committed_delta) jdp_atomic_add_with_peak(&stats->committed, &stats->peak_committed, committed_delta);
+    if (reserved_delta) jdp_atomic_add_with_peak(&stats->reserved, &stats->peak_reserved, reserved_delta);
+}
+
+static void jdp_record_allocation(const char * name, u64 amount)
+{
+    // NOTE hashed by contents, as headers can give the same site a different literal in each translation unit
+    u64 hash = 0xCBF29CE484222325ULL;
+    for (const char * c = name; *c; c++) hash = (hash ^ (u8) *c) * 0x100000001B3ULL;
+
+    for (u64 i = 0; i < ARENA_MAX_ALLOCATION_SITES; i++)
+    {
+        allocation_site_t * site = &jdp_allocation_sites[(hash + i) % ARENA_MAX_ALLOCATION_SITES];
+
+        const char * site_name = NULL;
+        if (__atomic_compare_exchange_n(&site->name, &site_name, name, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+            strcmp(site_name, name) == 0)
+        {
+            __atomic_add_fetch(&site->num_allocations, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&site->num_bytes, amount, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    // NOTE sites beyond ARENA_MAX_ALLOCATION_SITES are not tracked
+}
+
+memory_stats_t memory_get_stats(void)
+{
+    memory_stats_t result = {0};
+    result.used = __atomic_load_n(&jdp_memory_stats.used, __ATOMIC_RELAXED);
+    result.committed = __atomic_load_n(&jdp_memory_stats.committed, __ATOMIC_RELAXED);
+    result.reserved = __atomic_load_n(&jdp_memory_stats.reserved, __ATOMIC_RELAXED);
+    result.peak_used = __atomic_load_n(&jdp_memory_stats.peak_used, __ATOMIC_RELAXED);
+    result.peak_committed = __atomic_load_n(&jdp_memory_stats.peak_committed, __ATOMIC_RELAXED);
+    result.peak_reserved = __atomic_load_n(&jdp_memory_stats.peak_reserved, __ATOMIC_RELAXED);
+
+    return result;
+}
+
+u64 memory_get_allocation_sites(allocation_site_t * sites, u64 max_sites)
+{
+    u64 num_sites = 0;
+    for (u64 i = 0; i < ARENA_MAX_ALLOCATION_SITES && num_sites < max_sites; i++)
+    {
+        allocation_site_t * site = &jdp_allocation_sites[i];
+
+        const char * name = __atomic_load_n(&site->name, __ATOMIC_ACQUIRE);
+        if (!name) continue;
+
+        sites[num_sites].name = name;
+        sites[num_sites].num_allocations = __atomic_load_n(&site->num_allocations, __ATOMIC_RELAXED);
+        sites[num_sites].num_bytes = __atomic_load_n(&site->num_bytes, __ATOMIC_RELAXED);
+        num_sites++;
+    }
+
+    return num_sites;
+}
+
+static u64 arena_get_commit_size(u32 flags)
+{
+    return (flags & (ARENA_FLAG_HUGE_PAGES | ARENA_FLAG_HUGETLB)) ? ARENA_HUGE_PAGE_SIZE : ARENA_COMMIT_SIZE;
+}
+
+arena_t arena_alloc_ex(u64 size, u32 flags)
 {
-    void * start = jdp_mem_reserve(size);
+    // NOTE memory is committed in fixed size steps, so the reservation must be a whole number of them
+    size = align_ceil_pow_2(size, arena_get_commit_size(flags));
+
+    void * start = jdp_mem_reserve(size, &flags);
+    assert(start);
+    jdp_memory_stats_update(0, 0, size);
 
     arena_t arena = {0};
     arena.start = start;
     arena.pos = 0;
     arena.committed = 0;
     arena.reserved = size;
+    arena.flags = flags;
+    arena.prev_block = NULL;
 
     return arena;
 }
 
+arena_t arena_alloc(u64 size)
+{
+    return arena_alloc_ex(size, 0);
+}
+
+// NOTE releases the current block, making the previous one current again
+static void arena_pop_block(arena_t * arena)
+{
+    arena_block_t * prev_block = arena->prev_block;
+    assert(prev_block);
+
+    arena_block_t block = *prev_block; // NOTE stored in the block being released
+    jdp_mem_release(arena->start, arena->reserved);
+    jdp_memory_stats_update(-(i64) arena->high_water, -(i64) arena->committed, -(i64) arena->reserved);
+
+    arena->start = block.start;
+    arena->pos = block.pos;
+    arena->high_water = block.high_water;
+    arena->committed = block.committed;
+    arena->reserved = block.reserved;
+    arena->prev_block = block.prev;
+}
+
 void arena_free(arena_t * arena)
 {
+    while (arena->prev_block) arena_pop_block(arena);
     jdp_mem_release(arena->start, arena->reserved);
+    jdp_memory_stats_update(-(i64) arena->high_water, -(i64) arena->committed, -(i64) arena->reserved);
 
     arena->start = NULL;
 }
 
+static void arena_grow(arena_t * arena, u64 amount)
+{
+    u64 header_size = align_ceil_pow_2(sizeof(arena_block_t), 8);
+    u64 block_size = 2 * arena->reserved;
+    if (block_size < header_size + amount) block_size = header_size + amount;
+
+    arena_block_t prev_block = {0};
+    prev_block.prev = arena->prev_block;
+    prev_block.start = arena->start;
+    prev_block.pos = arena->pos;
+    prev_block.high_water = arena->high_water;
+    prev_block.committed = arena->committed;
+    prev_block.reserved = arena->reserved;
+
+    *arena = arena_alloc_ex(block_size, arena->flags);
+
+    arena_block_t * header = (arena_block_t *) arena_push(arena, header_size);
+    *header = prev_block;
+    arena->prev_block = header;
+}
+
 void * arena_push(arena_t * arena, u64 amount)
 {
     u64 old_pos = arena->pos;
@@ -238,19 +497,90 @@ void * arena_push(arena_t * arena, u64 amount)
 
     if (new_pos > arena->reserved)
     {
-        assert(!"arena ran out of reserved memory");
+        arena_grow(arena, amount);
+
+        old_pos = arena->pos;
+        new_pos = align_ceil_pow_2(old_pos + amount, 8);
+        assert(new_pos <= arena->reserved);
     }
 
-    while (new_pos > arena->committed)
+    if (new_pos > arena->committed)
     {
-        bool success = jdp_mem_commit((u8 *) arena->start + arena->committed, ARENA_COMMIT_SIZE);
+        u64 new_committed = align_ceil_pow_2(new_pos, arena_get_commit_size(arena->flags));
+        assert(new_committed <= arena->reserved);
+
+        bool success = jdp_mem_commit((u8 *) arena->start + arena->committed, new_committed - arena->committed, arena->flags);
         assert(success);
-        arena->committed += ARENA_COMMIT_SIZE;
+        jdp_memory_stats_update(0, new_committed - arena->committed, 0);
+        arena->committed = new_committed;
+    }
+
+    if (old_pos < arena->high_water)
+    {
+        u64 dirty_end = new_pos < arena->high_water ? new_pos : arena->high_water;
+        memset((u8 *) arena->start + old_pos, 0, dirty_end - old_pos);
     }
 
     arena->pos = new_pos;
+    if (new_pos > arena->high_water)
+    {
+        jdp_memory_stats_update(new_pos - arena->high_water, 0, 0);
+        arena->high_water = new_pos;
+    }
 
     return (u8 *) arena->start + old_pos;
 }
 
+void * arena_push_named(arena_t * arena, u64 amount, const char * name)
+{
+    jdp_record_allocation(name, amount);
+    return arena_push(arena, amount);
+}
+
+arena_temp_t arena_temp_begin(arena_t * arena)
+{
+    arena_temp_t temp = {0};
+    temp.arena = arena;
+    temp.start = arena->start;
+    temp.pos = arena->pos;
+
+    return temp;
+}
+
+void arena_temp_end(arena_temp_t temp)
+{
+    arena_t * arena = temp.arena;
+
+    // blocks chained on since the start of the scope are released entirely
+    while (arena->start != temp.start) arena_pop_block(arena);
+
+    assert(temp.pos <= arena->pos);
+    arena->pos = temp.pos;
+}
+
+static jdp_thread_local arena_t jdp_scratch_arenas[ARENA_SCRATCH_COUNT];
+
+arena_t * arena_get_scratch(arena_t * conflict)
+{
+    for (i64 i = 0; i < ARENA_SCRATCH_COUNT; i++)
+    {
+        arena_t * scratch = &jdp_scratch_arenas[i];
+        if (scratch == conflict) continue;
+
+        if (!scratch->start) *scratch = arena_alloc(ARENA_SCRATCH_SIZE);
+        return scratch;
+    }
+
+    assert(!"No scratch arena available.");
+    return NULL;
+}
+
+void arena_release_scratch(void)
+{
+    for (i64 i = 0; i < ARENA_SCRATCH_COUNT; i++)
+    {
+        if (jdp_scratch_arenas[i].start) arena_free(&jdp_scratch_arenas[i]);
+    }
+}
+
 #endif /* JDP_IMPLEMENTATION */
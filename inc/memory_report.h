@@ -0,0 +1,19 @@
+#ifndef MEMORY_REPORT_INCLUDE
+#define MEMORY_REPORT_INCLUDE
+
+#include "jdp.h"
+
+/*
+Reports of the memory used by a command, for sizing jobs: the process peak RSS, arena memory (used, committed and
+reserved), the footprint of the hash containers, and the largest named allocation sites.
+- Reports go to stderr, so they can be enabled for commands writing their results to stdout.
+- The interval report is a single line per interval, printed from its own thread.
+*/
+
+#define MEMORY_REPORT_NUM_SITES     12
+
+void memory_report_print(char * cmd_name);
+void memory_report_start_interval(f64 seconds);
+void memory_report_stop_interval(void);
+
+#endif /* MEMORY_REPORT_INCLUDE */
@@ -0,0 +1,82 @@
+#ifndef PAGE_TABLE_INCLUDE
+#define PAGE_TABLE_INCLUDE
+
+#include "jdp.h"
+#include "common.h"
+#include <stddef.h>
+
+/*
+Virtual to physical page mappings, stored in a radix tree keyed on the virtual page number.
+- Each level of the tree resolves PAGE_TABLE_LEVEL_BITS of the virtual page number; nodes are allocated on demand.
+- Leaf entries hold the physical page start, with the bottom bit set when a mapping is present.
+- Recent translations are kept in a small direct-mapped cache in front of the tree, which (since accesses tend to
+  stay within a few pages) usually avoids walking the tree at all.
+*/
+
+#define PAGE_TABLE_LEVEL_BITS       13
+#define PAGE_TABLE_NODE_ENTRIES     (1 << PAGE_TABLE_LEVEL_BITS)
+#define PAGE_TABLE_NUM_LEVELS       4
+#define PAGE_TABLE_CACHE_SIZE       16
+#define PAGE_TABLE_ENTRY_VALID      1
+
+static_assert(PAGE_TABLE_LEVEL_BITS * PAGE_TABLE_NUM_LEVELS >= 64 - PAGE_SIZE_BITS,
+    "Page table levels must cover the whole virtual page number.");
+static_assert((PAGE_TABLE_CACHE_SIZE & (PAGE_TABLE_CACHE_SIZE - 1)) == 0, "Cache size must be a power of 2.");
+
+typedef struct page_table_cache_entry_t page_table_cache_entry_t;
+struct page_table_cache_entry_t
+{
+    u64 key; // NOTE virtual page number + 1, so zero is an empty cache entry
+    u64 * leaf_entry;
+};
+
+typedef struct page_table_t page_table_t;
+struct page_table_t
+{
+    arena_t * arena;
+    u64 * root;
+    page_table_cache_entry_t cache[PAGE_TABLE_CACHE_SIZE];
+};
+
+page_table_t page_table_create(arena_t * arena);
+u64 * page_table_walk(page_table_t * page_table, u64 vaddr, bool create);
+
+// NOTE returns a pointer to the leaf entry for the page, or NULL if the page has no entry and create is false
+static inline u64 * page_table_lookup(page_table_t * page_table, u64 vaddr, bool create)
+{
+    u64 key = (vaddr >> PAGE_SIZE_BITS) + 1;
+    page_table_cache_entry_t * cache_entry = &page_table->cache[key & (PAGE_TABLE_CACHE_SIZE - 1)];
+    if (cache_entry->key == key) return cache_entry->leaf_entry;
+
+    u64 * leaf_entry = page_table_walk(page_table, vaddr, create);
+    if (leaf_entry)
+    {
+        cache_entry->key = key;
+        cache_entry->leaf_entry = leaf_entry;
+    }
+
+    return leaf_entry;
+}
+
+static inline bool page_table_get(page_table_t * page_table, u64 vaddr, u64 * paddr_page)
+{
+    u64 * leaf_entry = page_table_lookup(page_table, vaddr, false);
+    if (leaf_entry && (*leaf_entry & PAGE_TABLE_ENTRY_VALID))
+    {
+        *paddr_page = *leaf_entry & ~(u64) PAGE_TABLE_ENTRY_VALID;
+        return true;
+    }
+
+    return false;
+}
+
+static inline void page_table_set(page_table_t * page_table, u64 vaddr, u64 paddr_page)
+{
+    assert(paddr_page == get_page_start(paddr_page));
+
+    u64 * leaf_entry = page_table_lookup(page_table, vaddr, true);
+    assert(leaf_entry);
+    *leaf_entry = paddr_page | PAGE_TABLE_ENTRY_VALID;
+}
+
+#endif /* PAGE_TABLE_INCLUDE */
@@ -0,0 +1,79 @@
+#ifndef REQUESTS_INCLUDE
+#define REQUESTS_INCLUDE
+
+#include "jdp.h"
+#include "trace.h"
+#include "io.h"
+
+/*
+Compact encoding for LLC outgoing request traces:
+- The stream starts with an 8 byte header (magic, version, cache line size bits).
+- Each request is a header byte, followed by a zigzag varint delta from the previous request address
+  (counted in cache lines when both addresses are line aligned, in bytes otherwise).
+- The size, tags and known tags masks are only written (as varints) when the header byte says they cannot
+  be inferred, i.e. the size is not the cache line size, or the masks are not empty / fully known.
+
+Readers also accept the plain tag_cache_request_t format, so older request traces can still be used.
+*/
+
+#define REQUESTS_MAGIC              "TCREQS"
+#define REQUESTS_MAGIC_SIZE         6
+#define REQUESTS_VERSION            1
+#define REQUESTS_HEADER_SIZE        8
+
+enum request_header_flags_t
+{
+    REQUEST_HEADER_WRITE            = 1 << 0, // otherwise a read
+    REQUEST_HEADER_KNOWN_ALL        = 1 << 1, // all tags in the request are known
+    REQUEST_HEADER_KNOWN_EXPLICIT   = 1 << 2, // known tags mask follows (otherwise none known, unless KNOWN_ALL)
+    REQUEST_HEADER_TAGS             = 1 << 3, // tags mask follows (otherwise zero)
+    REQUEST_HEADER_SIZE             = 1 << 4, // size follows (otherwise the cache line size)
+    REQUEST_HEADER_UNALIGNED        = 1 << 5  // address delta is in bytes rather than cache lines
+};
+
+typedef struct requests_writer_t requests_writer_t;
+struct requests_writer_t
+{
+    trace_writer_t output;
+    bool compact;
+    u64 prev_addr;
+    u8 * buf;
+    u64 buf_size;
+};
+
+typedef struct requests_reader_t requests_reader_t;
+struct requests_reader_t
+{
+    trace_reader_t input;
+    bool compact;
+    bool input_eof;
+    u8 line_size_bits;
+    u64 prev_addr;
+    u8 * buf;
+    u64 buf_pos;
+    u64 buf_size;
+};
+
+requests_writer_t requests_writer_open(arena_t * arena, char * filename, bool compact);
+void requests_writer_emit(requests_writer_t * writer, tag_cache_request_t request);
+void requests_writer_close(requests_writer_t * writer);
+
+requests_reader_t requests_reader_open(arena_t * arena, char * filename);
+bool requests_reader_get(requests_reader_t * reader, tag_cache_request_t * request);
+void requests_reader_close(requests_reader_t * reader);
+
+// NOTE every condition must hold for a request to match, batches are tested 64 requests at a time (with AVX2 where the
+// CPU supports it, checked at runtime)
+typedef struct requests_filter_t requests_filter_t;
+struct requests_filter_t
+{
+    u64 addr_start; // NOTE requests overlapping [addr_start, addr_end)
+    u64 addr_end;
+    u8 type_mask; // NOTE bit per tag_cache_request_type_t
+    u16 tags_mask; // NOTE requests with any of these tags set (or any request, if 0)
+};
+
+requests_filter_t requests_filter_all(void);
+u64 requests_filter_batch(requests_filter_t * filter, tag_cache_request_t * requests, u64 num_requests, u32 * indices);
+
+#endif /* REQUESTS_INCLUDE */
@@ -0,0 +1,48 @@
+#ifndef REUSE_DISTANCE_INCLUDE
+#define REUSE_DISTANCE_INCLUDE
+
+#include "jdp.h"
+#include "hashmap.h"
+
+/*
+LRU stack (reuse) distances in a single pass, using Bennett and Kruskal's method (as refined by Olken).
+- Every access gets a timestamp, and the most recent access to each key is marked in a Fenwick tree over timestamps.
+- The stack distance of an access is the number of marks after the previous access to the same key, i.e. the number
+  of distinct keys accessed in between, which takes O(log n) rather than a walk down an LRU stack.
+- When the timestamps run out they are renumbered (keeping their order), so the tree only needs to be about twice the
+  number of distinct keys rather than the length of the trace.
+- A fully associative LRU cache of C keys hits exactly when the stack distance is less than C, so one histogram of
+  distances gives the misses for every cache size.
+- The histogram is log-linear: distances below REUSE_DISTANCE_SUB_BUCKETS are exact, then each doubling is split into
+  REUSE_DISTANCE_SUB_BUCKETS buckets. Miss counts are exact for cache sizes on bucket boundaries (e.g. 48 and 64 KiB).
+*/
+
+#define REUSE_DISTANCE_SUB_BUCKET_BITS  3
+#define REUSE_DISTANCE_SUB_BUCKETS      (1 << REUSE_DISTANCE_SUB_BUCKET_BITS)
+#define REUSE_DISTANCE_NUM_BUCKETS      (REUSE_DISTANCE_SUB_BUCKETS * (64 - REUSE_DISTANCE_SUB_BUCKET_BITS + 1))
+#define REUSE_DISTANCE_MIN_CAPACITY     (1 << 20)
+#define REUSE_DISTANCE_COLD             UINT64_MAX
+
+typedef struct reuse_distance_t reuse_distance_t;
+struct reuse_distance_t
+{
+    map_u64 last_access; // NOTE key -> timestamp of its most recent access
+    arena_t tree_arena;
+    u32 * tree; // NOTE Fenwick tree (1-based) over timestamps
+    u64 capacity;
+    u64 next_timestamp;
+
+    u64 num_accesses;
+    u64 num_cold_accesses; // NOTE first accesses to each key (infinite distance)
+    u64 histogram[REUSE_DISTANCE_NUM_BUCKETS];
+};
+
+reuse_distance_t reuse_distance_create(void);
+void reuse_distance_cleanup(reuse_distance_t * tracker);
+u64 reuse_distance_access(reuse_distance_t * tracker, u64 key); // NOTE returns REUSE_DISTANCE_COLD for first accesses
+u64 reuse_distance_num_keys(reuse_distance_t * tracker);
+
+u64 reuse_distance_bucket_start(u32 bucket_idx); // NOTE smallest distance in the bucket
+u64 reuse_distance_misses(reuse_distance_t * tracker, u32 bucket_idx); // NOTE for a cache of reuse_distance_bucket_start(bucket_idx) keys
+
+#endif /* REUSE_DISTANCE_INCLUDE */
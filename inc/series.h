@@ -0,0 +1,61 @@
+#ifndef SERIES_INCLUDE
+#define SERIES_INCLUDE
+
+#include "jdp.h"
+#include "io.h"
+
+#include <stdio.h>
+
+/*
+Time series of counts (e.g. one row per interval of a trace), written either as CSV or as a binary file.
+- Every column is a u64.
+- CSV rows are formatted by hand into a large buffer, as printf ends up dominating runs with small intervals.
+- Binary files start with a series_header_t, followed by the column names (each NUL terminated, padded with NULs to
+  names_size bytes), followed by fixed-size rows of num_columns little-endian u64s.
+- The number of rows follows from the file size, so binary output can also go to a pipe, or be compressed (picked by
+  extension, like traces).
+*/
+
+#define SERIES_MAGIC            "CHERITS"
+#define SERIES_MAGIC_SIZE       8
+#define SERIES_VERSION          1
+
+#define SERIES_MAX_COLUMNS      64
+#define SERIES_BUFFER_SIZE      MEGABYTES(1)
+
+typedef struct series_header_t series_header_t;
+struct series_header_t
+{
+    char magic[SERIES_MAGIC_SIZE];
+    u32 version;
+    u32 num_columns;
+    u64 names_size; // NOTE multiple of 8, so rows are aligned
+};
+
+enum series_format_t
+{
+    SERIES_FORMAT_CSV,
+    SERIES_FORMAT_BINARY
+};
+
+typedef struct series_writer_t series_writer_t;
+struct series_writer_t
+{
+    u8 format;
+    u32 num_columns;
+    FILE * file; // NOTE CSV only
+    trace_writer_t binary; // NOTE binary only
+
+    u8 * buffer;
+    u64 buffer_used;
+};
+
+// NOTE CSV goes to stdout, binary to filename
+series_writer_t series_writer_open(arena_t * arena, u8 format, char * filename, char ** column_names, u32 num_columns);
+void series_writer_row(series_writer_t * writer, u64 * values);
+void series_writer_close(series_writer_t * writer);
+
+u32 format_u64(char * dst, u64 value); // NOTE writes the decimal digits (at most 20, no terminator), returns the count
+u32 format_hex_u64(char * dst, u64 value, u32 min_digits, bool upper); // NOTE like "%0*lx" (or "%0*lX"), returns the count
+
+#endif /* SERIES_INCLUDE */
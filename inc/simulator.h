@@ -3,6 +3,7 @@
 
 #include "jdp.h"
 #include "io.h"
+#include "requests.h"
 
 #define CACHE_LINE_SIZE 64
 #define CACHE_LINE_SIZE_BITS 6
@@ -97,7 +98,7 @@ struct tag_cache_t
 typedef struct controller_interface_t controller_interface_t;
 struct controller_interface_t
 {
-	trace_writer_t output;
+	requests_writer_t output;
     // NOTE the tag table here reflects the controller's view of memory
     tag_table_t tag_table;
     controller_interface_stats_t stats;
@@ -131,7 +132,7 @@ cache_line_t * cache_request(device_t * device, u64 paddr);
 device_t * cache_init(arena_t * arena, char * name, u32 size, u32 num_ways, device_t * parent);
 
 device_t * tag_cache_init(arena_t * arena, char * initial_tags_filename, u32 size, u32 num_ways);
-device_t * controller_interface_init(arena_t * arena, char * output_filename);
+device_t * controller_interface_init(arena_t * arena, char * output_filename, bool compact_output);
 
 void device_write(device_t * device, u64 paddr, tags_t tags_cheri);
 tags_t device_read(device_t * device, u64 paddr);
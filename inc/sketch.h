@@ -0,0 +1,194 @@
+#ifndef SKETCH_INCLUDE
+#define SKETCH_INCLUDE
+
+#include "jdp.h"
+#include "hashmap.h"
+#include "external_set.h"
+
+/*
+HyperLogLog distinct counter, using a fixed 2^HLL_PRECISION_BITS bytes regardless of the number of keys.
+- The top bits of the (64 bit) key hash pick a register, which keeps the largest number of leading zeros (+1)
+  seen in the rest of the hash.
+- Estimates use Ertl's improved raw estimator ("New cardinality estimation algorithms for HyperLogLog
+  sketches", 2017), which has no bias around the switch from linear counting, so there are no empirical tables.
+- The relative standard error is about 1.04 / sqrt(number of registers), i.e. 0.8% with 14 precision bits.
+*/
+
+#define HLL_PRECISION_BITS  14
+#define HLL_NUM_REGISTERS   (1 << HLL_PRECISION_BITS)
+#define HLL_MAX_RANK        (64 - HLL_PRECISION_BITS + 1)
+
+typedef struct hll_t hll_t;
+struct hll_t
+{
+    u8 * registers;
+};
+
+hll_t hll_create(arena_t * arena);
+void hll_merge(hll_t dst, hll_t src);
+u64 hll_estimate(hll_t hll);
+double hll_standard_error(void);
+
+static inline void hll_insert(hll_t hll, u64 key)
+{
+    u64 hash = hash_u64(key);
+    u64 register_idx = hash >> (64 - HLL_PRECISION_BITS);
+    u64 remaining = hash << HLL_PRECISION_BITS;
+
+    u8 rank = remaining == 0 ? HLL_MAX_RANK : __builtin_clzll(remaining) + 1;
+    if (rank > hll.registers[register_idx]) hll.registers[register_idx] = rank;
+}
+
+
+/*
+Counts distinct keys for statistics that only ever need the number of distinct keys, either exactly in memory
+(in a set_u64), approximately (in a HyperLogLog sketch), or exactly within a memory budget (spilling to disk).
+*/
+
+typedef enum distinct_counter_mode_t distinct_counter_mode_t;
+enum distinct_counter_mode_t
+{
+    DISTINCT_COUNTER_EXACT,
+    DISTINCT_COUNTER_APPROXIMATE,
+    DISTINCT_COUNTER_EXTERNAL
+};
+
+typedef struct distinct_counter_config_t distinct_counter_config_t;
+struct distinct_counter_config_t
+{
+    distinct_counter_mode_t mode;
+    u64 memory_budget; // NOTE external mode only
+    char * spill_dir; // NOTE external mode only
+};
+
+typedef struct distinct_counter_t distinct_counter_t;
+struct distinct_counter_t
+{
+    distinct_counter_mode_t mode;
+    set_u64 exact;
+    hll_t hll;
+    external_set_t external;
+};
+
+distinct_counter_t distinct_counter_create(arena_t * arena, distinct_counter_config_t config);
+void distinct_counter_cleanup(distinct_counter_t * counter);
+u64 distinct_counter_count(distinct_counter_t * counter);
+double distinct_counter_standard_error(distinct_counter_t * counter); // NOTE relative, zero when exact
+
+static inline void distinct_counter_insert(distinct_counter_t * counter, u64 key)
+{
+    switch (counter->mode)
+    {
+        case DISTINCT_COUNTER_EXACT: set_u64_insert(counter->exact, key); break;
+        case DISTINCT_COUNTER_APPROXIMATE: hll_insert(counter->hll, key); break;
+        case DISTINCT_COUNTER_EXTERNAL: external_set_insert(&counter->external, key); break;
+        default: assert(!"Impossible.");
+    }
+}
+
+
+/*
+Count-min sketch: COUNT_MIN_DEPTH rows of counters, each key incrementing one counter per row (so the smallest
+of its counters is an overestimate of its count).
+- Uses conservative update (only the counters at the current minimum are incremented), which tightens the
+  overestimates without affecting the bound: with width w, estimates exceed the true count by at most
+  e/w * (total count) with probability 1 - e^-COUNT_MIN_DEPTH.
+- Row indices are derived from a single 64 bit hash (h1 + i * h2).
+*/
+
+#define COUNT_MIN_DEPTH     4
+
+typedef struct count_min_t count_min_t;
+struct count_min_t
+{
+    u64 * counters; // NOTE COUNT_MIN_DEPTH rows of 2^width_bits counters
+    u32 width_bits;
+    u64 total;
+};
+
+count_min_t count_min_create(arena_t * arena, u32 width_bits);
+u64 count_min_error_bound(count_min_t * sketch);
+double count_min_error_probability(void);
+
+// NOTE returns the new estimate for the key
+static inline u64 count_min_add(count_min_t * sketch, u64 key, u64 amount)
+{
+    u64 hash = hash_u64(key);
+    u64 h1 = hash;
+    u64 h2 = (hash >> 32) | (hash << 32) | 1;
+    u64 mask = ((u64) 1 << sketch->width_bits) - 1;
+
+    u64 * counters[COUNT_MIN_DEPTH];
+    u64 estimate = UINT64_MAX;
+    for (i64 row = 0; row < COUNT_MIN_DEPTH; row++)
+    {
+        u64 column = (h1 + row * h2) & mask;
+        counters[row] = &sketch->counters[((u64) row << sketch->width_bits) + column];
+        if (*counters[row] < estimate) estimate = *counters[row];
+    }
+
+    estimate += amount;
+    for (i64 row = 0; row < COUNT_MIN_DEPTH; row++)
+    {
+        if (*counters[row] < estimate) *counters[row] = estimate;
+    }
+
+    sketch->total += amount;
+
+    return estimate;
+}
+
+
+/*
+Keeps the K keys with the largest counts seen so far, in a min-heap (so the smallest of them is at the root),
+with a map from keys to their heap positions so counts of keys already in the heap can be updated.
+*/
+
+typedef struct top_k_entry_t top_k_entry_t;
+struct top_k_entry_t
+{
+    u64 key;
+    u64 count;
+};
+
+typedef struct top_k_t top_k_t;
+struct top_k_t
+{
+    top_k_entry_t * heap;
+    u64 size;
+    u64 capacity;
+    map_u64 positions;
+};
+
+top_k_t top_k_create(arena_t * arena, u64 capacity);
+void top_k_cleanup(top_k_t * top_k);
+void top_k_update(top_k_t * top_k, u64 key, u64 count); // NOTE counts for a key must never decrease
+void top_k_sort(top_k_t * top_k); // NOTE sorts by decreasing count, no more updates are allowed afterwards
+
+
+/*
+Streaming heavy hitters: keys counted in a count-min sketch, with the top K keys by estimated count tracked.
+*/
+
+typedef struct heavy_hitters_t heavy_hitters_t;
+struct heavy_hitters_t
+{
+    count_min_t sketch;
+    top_k_t top_k;
+};
+
+heavy_hitters_t heavy_hitters_create(arena_t * arena, u32 width_bits, u64 k);
+void heavy_hitters_cleanup(heavy_hitters_t * heavy_hitters);
+
+static inline void heavy_hitters_add(heavy_hitters_t * heavy_hitters, u64 key)
+{
+    u64 estimate = count_min_add(&heavy_hitters->sketch, key, 1);
+
+    top_k_t * top_k = &heavy_hitters->top_k;
+    if (top_k->size < top_k->capacity || estimate > top_k->heap[0].count)
+    {
+        top_k_update(top_k, key, estimate);
+    }
+}
+
+#endif /* SKETCH_INCLUDE */
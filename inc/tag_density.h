@@ -0,0 +1,42 @@
+#ifndef TAG_DENSITY_INCLUDE
+#define TAG_DENSITY_INCLUDE
+
+#include "jdp.h"
+#include "hashmap.h"
+
+/*
+Tracks how many regions of memory contain at least one set tag, at several region sizes at once (e.g. to size the root
+table of a compressed tag table, where a leaf line only exists if its root bit is set).
+- The tags themselves are one bitmap with a bit per capability, indexed like the initial state table.
+- Regions of up to a bitmap word (BITSET_WORD_BITS capabilities) are checked directly against the bitmap word.
+- Larger regions keep a counter of their set tags, so a region only changes state when its counter goes to or from 0.
+- Region sizes are powers of two, in bytes.
+*/
+
+#define TAG_DENSITY_MAX_GRANULARITIES   16
+
+typedef struct tag_density_level_t tag_density_level_t;
+struct tag_density_level_t
+{
+    u64 region_size;
+    u64 num_regions;
+    u64 region_num_capabilities;
+    u32 * tag_counts; // NOTE only for regions larger than a bitmap word
+    u64 num_regions_tagged;
+};
+
+typedef struct tag_density_t tag_density_t;
+struct tag_density_t
+{
+    bitset_t tagged_capabilities;
+    u64 num_capabilities_tagged;
+
+    tag_density_level_t levels[TAG_DENSITY_MAX_GRANULARITIES];
+    u32 num_levels;
+};
+
+tag_density_t tag_density_create(arena_t * arena, u64 * region_sizes, u32 num_region_sizes);
+void tag_density_recount(tag_density_t * density); // NOTE after writing tagged_capabilities directly
+void tag_density_update(tag_density_t * density, u64 addr, bool tag_set);
+
+#endif /* TAG_DENSITY_INCLUDE */
@@ -12,6 +12,8 @@ enum custom_trace_type_t
     CUSTOM_TRACE_TYPE_CSTORE,
 };
 
+#define NUM_CUSTOM_TRACE_TYPES (CUSTOM_TRACE_TYPE_CSTORE + 1)
+
 typedef struct custom_trace_entry_t custom_trace_entry_t;
 struct custom_trace_entry_t
 {
@@ -24,10 +26,11 @@ struct custom_trace_entry_t
 
 
 // TODO if we want unknown bits, we could have 2 bits for the tag and 6 for the type
+// NOTE the type is stored plus one, so that an all-zero entry is an address that was never accessed
 typedef struct initial_access_t initial_access_t;
 struct initial_access_t
 {
-    int8_t type : 7;
+    uint8_t type_plus_one : 7;
     uint8_t tag : 1;
 };
 
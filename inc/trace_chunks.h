@@ -0,0 +1,55 @@
+#ifndef TRACE_CHUNKS_INCLUDE
+#define TRACE_CHUNKS_INCLUDE
+
+#include "jdp.h"
+#include "trace.h"
+
+/*
+Splitting (custom format) trace files into chunks that can be decoded independently, and processing them on multiple threads.
+- Uncompressed traces are split into fixed size byte ranges.
+- LZ4 traces are split into runs of blocks, found by walking the frame and block headers (without decompressing
+  anything). This only works if every frame has independent blocks, as traces written by this tool do.
+- gzip streams can only be decoded from the start, so they are never split.
+- Chunk boundaries do not line up with entries. Each worker passes on the whole entries in its chunks, and the entries
+  straddling chunk boundaries are put back together (and passed on) once all the chunks have been decoded.
+- Entries are not processed in trace order, so this is only for order-independent work (e.g. counting).
+*/
+
+#define TRACE_CHUNK_SIZE            MEGABYTES(16)
+
+enum trace_chunks_encoding_t
+{
+    TRACE_CHUNKS_ENCODING_UNCOMPRESSED,
+    TRACE_CHUNKS_ENCODING_LZ4
+};
+
+typedef struct trace_chunk_t trace_chunk_t;
+struct trace_chunk_t
+{
+    u64 offset; // NOTE in the file, for LZ4 this is the start of the first block header
+    u64 size;
+    u32 block_max_size; // NOTE LZ4 only
+    bool block_checksums; // NOTE LZ4 only
+};
+
+typedef struct trace_chunks_t trace_chunks_t;
+struct trace_chunks_t
+{
+    int fd;
+    u8 encoding;
+    trace_chunk_t * chunks;
+    u64 num_chunks;
+    u64 max_chunk_size;
+    u64 max_decoded_size;
+};
+
+// NOTE the same as an analysis' process function, so analyses can be run over chunks
+typedef void (*trace_chunks_entries_func_t)(void * worker_data, custom_trace_entry_t * entries, u64 num_entries);
+
+bool trace_chunks_open(arena_t * arena, char * filename, trace_chunks_t * chunks); // NOTE false if the trace cannot be split
+void trace_chunks_close(trace_chunks_t * chunks);
+u64 trace_chunk_decode(trace_chunks_t * chunks, trace_chunk_t * chunk, u8 * file_buffer, u8 * decoded_buffer);
+void trace_chunks_process(arena_t * arena, trace_chunks_t * chunks, u32 num_threads, trace_chunks_entries_func_t func,
+    void ** worker_data);
+
+#endif /* TRACE_CHUNKS_INCLUDE */
@@ -0,0 +1,37 @@
+#ifndef TRACE_FILTER_INCLUDE
+#define TRACE_FILTER_INCLUDE
+
+#include "jdp.h"
+#include "trace.h"
+
+/*
+Predicates over (custom format) trace entries, applied a batch at a time.
+- Every predicate must hold for an entry to be kept.
+- Each predicate is a mask or a range, so an entry is tested without any branches. A batch gets a bitmask per 64
+  entries, then the kept entries are compacted (whole runs at once when every entry in the 64 is kept).
+- The bitmasks are built using AVX2 where the CPU supports it (checked at runtime, like the trace stats), otherwise
+  with scalar code.
+- Address ranges keep entries overlapping [start, last] (inclusive, so the default range covers every address).
+- The tag is only meaningful for CLOADs and CSTOREs, other entries are (normally) untagged.
+*/
+
+typedef struct trace_filter_t trace_filter_t;
+struct trace_filter_t
+{
+    u8 type_mask; // NOTE bit per custom_trace_type_t
+    u8 tag_mask; // NOTE bit 0 for untagged entries, bit 1 for tagged entries
+    u8 paddr_valid_mask; // NOTE bit 0 for entries with an invalid paddr, bit 1 for a valid one
+    u64 paddr_start;
+    u64 paddr_last;
+    u64 vaddr_start;
+    u64 vaddr_last;
+};
+
+trace_filter_t trace_filter_all(void);
+bool trace_filter_is_all(trace_filter_t * filter);
+
+// NOTE output may be the same as entries (filtering in place), returns the number of entries kept
+u64 trace_filter_batch(trace_filter_t * filter, custom_trace_entry_t * entries, u64 num_entries,
+    custom_trace_entry_t * output);
+
+#endif /* TRACE_FILTER_INCLUDE */
@@ -0,0 +1,47 @@
+#ifndef TRACE_STATS_INCLUDE
+#define TRACE_STATS_INCLUDE
+
+#include "jdp.h"
+#include "trace.h"
+
+/*
+Statistics about the entries in a (custom format) trace, updated a batch of entries at a time.
+- Each block of TRACE_STATS_BLOCK_SIZE entries is turned into bit masks (one per access type, plus missing / invalid
+  paddrs and paddrs matching vaddrs), and the counters are updated from popcounts of the masks, so there are no
+  branches on the entries themselves.
+- The masks are built using AVX2 where the CPU supports it (checked at runtime), otherwise with scalar code.
+- There is no SSE path. SSE can do the paddr range check (with SSE4.2 pcmpgtq, or as 32-bit compares on SSE2 since
+  valid paddrs fit in 32 bits), but it has no gathers to pull the fields out of the 24 byte entries, and nothing has
+  been measured to show that shuffling them into place would beat the scalar loop.
+*/
+
+#define TRACE_STATS_BLOCK_SIZE      64
+
+typedef struct trace_type_stats_t trace_type_stats_t;
+struct trace_type_stats_t
+{
+    u64 num_entries;
+    u64 num_no_paddr;
+    u64 num_invalid_paddr;
+};
+
+typedef struct trace_stats_t trace_stats_t;
+struct trace_stats_t
+{
+    // NOTE invalid paddr counts include missing paddrs
+
+    u64 num_entries;
+    u64 num_entries_no_paddr;
+    u64 num_entries_invalid_paddr;
+
+    u64 num_entries_paddr_matches_vaddr;
+    u64 num_entries_invalid_paddr_matches_vaddr;
+
+    trace_type_stats_t types[NUM_CUSTOM_TRACE_TYPES]; // NOTE indexed by custom_trace_type_t
+};
+
+void update_trace_stats(trace_stats_t * stats, custom_trace_entry_t * entries, u64 num_entries);
+void merge_trace_stats(trace_stats_t * stats, trace_stats_t * other);
+void print_trace_stats(trace_stats_t * stats);
+
+#endif /* TRACE_STATS_INCLUDE */
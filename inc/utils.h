@@ -7,4 +7,8 @@ void quit(void);
 bool file_exists_not_fifo(char * filename);
 bool confirm_overwrite_file(char * filename);
 
+// NOTE these remove matching "--name" / "--name=value" options from the argument list
+bool args_take_flag(int * num_args, char ** args, char * name);
+char * args_take_value(int * num_args, char ** args, char * name);
+
 #endif /* UTILS_INCLUDE */
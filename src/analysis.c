@@ -0,0 +1,47 @@
+#include "jdp.h"
+#include "trace.h"
+#include "io.h"
+#include "analysis.h"
+#include "trace_filter.h"
+
+#include <stdio.h>
+
+void analyses_run(arena_t * arena, trace_reader_t * input_trace, analysis_t * analyses, u32 num_analyses)
+{
+    analyses_run_filtered(arena, input_trace, NULL, analyses, num_analyses);
+}
+
+void analyses_run_filtered(arena_t * arena, trace_reader_t * input_trace, trace_filter_t * filter,
+    analysis_t * analyses, u32 num_analyses)
+{
+    custom_trace_entry_t * batch = arena_push_array(arena, custom_trace_entry_t, TRACE_BATCH_NUM_ENTRIES);
+
+    while (true)
+    {
+        u64 num_entries = trace_reader_get_batch(input_trace, batch, sizeof(custom_trace_entry_t), TRACE_BATCH_NUM_ENTRIES);
+        if (num_entries == 0) break;
+
+        if (filter)
+        {
+            num_entries = trace_filter_batch(filter, batch, num_entries, batch);
+            if (num_entries == 0) continue;
+        }
+
+        for (u32 i = 0; i < num_analyses; i++)
+        {
+            analyses[i].process(analyses[i].state, batch, num_entries);
+        }
+    }
+
+    for (u32 i = 0; i < num_analyses; i++)
+    {
+        // NOTE only labelled when there is more than one set of results
+        if (num_analyses > 1)
+        {
+            if (i > 0) printf("\n");
+            printf("[%s]\n", analyses[i].name);
+        }
+
+        analyses[i].finish(analyses[i].state);
+    }
+}
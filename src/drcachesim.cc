@@ -129,33 +129,27 @@ static void write_drcachesim_page_mapping_entries(trace_writer_t * writer, u64 v
     trace_writer_emit(writer, &vaddr_mapping_entry, sizeof(vaddr_mapping_entry));
 }
 
-void write_drcachesim_trace_entry_vaddr(trace_writer_t * writer, map_u64 page_table, custom_trace_entry_t custom_entry)
+void write_drcachesim_trace_entry_vaddr(trace_writer_t * writer, page_table_t * page_table, custom_trace_entry_t custom_entry)
 {
     assert(writer);
+    assert(page_table);
 
     u64 vaddr = custom_entry.vaddr;
     u64 paddr = custom_entry.paddr;
 
     u64 phys_page_start;
-    if (map_u64_get(page_table, get_page_start(vaddr), &phys_page_start))
+    bool mapped = page_table_get(page_table, vaddr, &phys_page_start);
+
+    if (check_paddr_valid(paddr))
     {
-        if (check_paddr_valid(paddr))
+        if (!mapped || phys_page_start != get_page_start(paddr))
         {
-            if (phys_page_start != get_page_start(paddr))
-            {
-                map_u64_set(page_table, get_page_start(vaddr), get_page_start(paddr));
+            page_table_set(page_table, vaddr, get_page_start(paddr));
 
-                write_drcachesim_page_mapping_entries(writer, vaddr, paddr);
-            }
+            write_drcachesim_page_mapping_entries(writer, vaddr, paddr);
         }
     }
-    else if (check_paddr_valid(paddr))
-    {
-        map_u64_set(page_table, get_page_start(vaddr), get_page_start(paddr));
-
-        write_drcachesim_page_mapping_entries(writer, vaddr, paddr);
-    }
-    else
+    else if (!mapped)
     {
         // TODO skip these instead?
         printf("ERROR: missing paddr for first access to page (vaddr: %lu)\n", vaddr);
@@ -0,0 +1,208 @@
+#include "jdp.h"
+#include "utils.h"
+#include "external_set.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+
+#define EXTERNAL_SET_RUN_RECORDS_SIZE   GIGABYTES(1)
+
+// NOTE LSD radix sort, one byte at a time (skipping bytes that are the same for all keys), result ends up in keys
+static void radix_sort_u64(u64 * keys, u64 * temp, u64 count)
+{
+    u64 * src = keys;
+    u64 * dst = temp;
+
+    for (u32 shift = 0; shift < 64; shift += 8)
+    {
+        u64 offsets[256] = {0};
+        for (u64 i = 0; i < count; i++)
+        {
+            offsets[(src[i] >> shift) & 0xFF]++;
+        }
+
+        if (count == 0 || offsets[(src[0] >> shift) & 0xFF] == count) continue;
+
+        u64 total = 0;
+        for (i64 digit = 0; digit < 256; digit++)
+        {
+            u64 digit_count = offsets[digit];
+            offsets[digit] = total;
+            total += digit_count;
+        }
+
+        for (u64 i = 0; i < count; i++)
+        {
+            dst[offsets[(src[i] >> shift) & 0xFF]++] = src[i];
+        }
+
+        u64 * swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != keys)
+    {
+        for (u64 i = 0; i < count; i++) keys[i] = src[i];
+    }
+}
+
+static u64 sort_unique_u64(u64 * keys, u64 * temp, u64 count)
+{
+    radix_sort_u64(keys, temp, count);
+
+    u64 num_unique = 0;
+    for (u64 i = 0; i < count; i++)
+    {
+        if (num_unique == 0 || keys[i] != keys[num_unique - 1]) keys[num_unique++] = keys[i];
+    }
+
+    return num_unique;
+}
+
+static void external_set_write(external_set_t * set, void * data, u64 size, u64 offset)
+{
+    u8 * ptr = (u8 *) data;
+    while (size > 0)
+    {
+        ssize_t bytes_written = pwrite(set->spill_fd, ptr, size, offset);
+        if (bytes_written < 0)
+        {
+            if (errno == EINTR) continue;
+            printf("ERROR: failed to write to spill file in \"%s\" (%s).\n", set->spill_dir, strerror(errno));
+            quit();
+        }
+
+        ptr += bytes_written;
+        offset += bytes_written;
+        size -= bytes_written;
+    }
+}
+
+static void external_set_read(external_set_t * set, void * data, u64 size, u64 offset)
+{
+    u8 * ptr = (u8 *) data;
+    while (size > 0)
+    {
+        ssize_t bytes_read = pread(set->spill_fd, ptr, size, offset);
+        if (bytes_read <= 0)
+        {
+            if (bytes_read < 0 && errno == EINTR) continue;
+            printf("ERROR: failed to read back spill file in \"%s\".\n", set->spill_dir);
+            quit();
+        }
+
+        ptr += bytes_read;
+        offset += bytes_read;
+        size -= bytes_read;
+    }
+}
+
+// NOTE expects the buffer to already be sorted and deduplicated
+static void external_set_spill(external_set_t * set)
+{
+    if (set->spill_fd < 0)
+    {
+        char path[PATH_MAX];
+        int path_length = snprintf(path, sizeof(path), "%s/traceconv-spill-XXXXXX", set->spill_dir);
+        assert(path_length > 0);
+
+        set->spill_fd = (size_t) path_length < sizeof(path) ? mkstemp(path) : -1;
+        if (set->spill_fd < 0)
+        {
+            printf("ERROR: could not create spill file in \"%s\".\n", set->spill_dir);
+            quit();
+        }
+
+        unlink(path);
+    }
+
+    external_set_run_t * run = arena_push_array(&set->arena, external_set_run_t, 1);
+    run->file_offset = set->spill_file_size;
+
+    u64 partition = 0;
+    for (u64 i = 0; i < set->count; i++)
+    {
+        u64 key_partition = set->keys[i] >> (64 - EXTERNAL_SET_PARTITION_BITS);
+        while (partition <= key_partition) run->partition_starts[partition++] = i;
+    }
+    while (partition <= EXTERNAL_SET_NUM_PARTITIONS) run->partition_starts[partition++] = set->count;
+
+    external_set_write(set, set->keys, set->count * sizeof(u64), run->file_offset);
+    set->spill_file_size += set->count * sizeof(u64);
+
+    run->next = set->runs;
+    set->runs = run;
+    set->num_runs++;
+
+    set->count = 0;
+}
+
+external_set_t external_set_create(u64 memory_budget, char * spill_dir)
+{
+    assert(memory_budget >= EXTERNAL_SET_MIN_MEMORY);
+
+    external_set_t set = {0};
+    set.arena = arena_alloc(memory_budget + EXTERNAL_SET_RUN_RECORDS_SIZE);
+    set.spill_dir = spill_dir;
+    set.spill_fd = -1;
+
+    // NOTE half of the budget is the buffer, the other half is scratch space for sorting it
+    set.capacity = memory_budget / (2 * sizeof(u64));
+    set.keys = arena_push_array(&set.arena, u64, set.capacity);
+    set.scratch = arena_push_array(&set.arena, u64, set.capacity);
+
+    return set;
+}
+
+void external_set_cleanup(external_set_t * set)
+{
+    if (set->spill_fd >= 0) close(set->spill_fd);
+    arena_free(&set->arena);
+}
+
+void external_set_flush(external_set_t * set)
+{
+    set->count = sort_unique_u64(set->keys, set->scratch, set->count);
+    if (set->count > set->capacity / 2) external_set_spill(set);
+}
+
+u64 external_set_count(external_set_t * set)
+{
+    set->count = sort_unique_u64(set->keys, set->scratch, set->count);
+    if (set->num_runs == 0) return set->count;
+
+    if (set->count > 0) external_set_spill(set);
+
+    u64 total = 0;
+    for (u64 partition = 0; partition < EXTERNAL_SET_NUM_PARTITIONS; partition++)
+    {
+        u64 partition_count = 0;
+        for (external_set_run_t * run = set->runs; run; run = run->next)
+        {
+            u64 start = run->partition_starts[partition];
+            u64 run_count = run->partition_starts[partition + 1] - start;
+
+            if (partition_count + run_count > set->capacity)
+            {
+                printf("ERROR: spilled keys do not fit in memory for counting (use a larger memory budget).\n");
+                quit();
+            }
+
+            external_set_read(set, &set->keys[partition_count], run_count * sizeof(u64),
+                run->file_offset + start * sizeof(u64));
+            partition_count += run_count;
+        }
+
+        total += sort_unique_u64(set->keys, set->scratch, partition_count);
+    }
+
+    // NOTE everything is in the runs, the buffer was only borrowed for counting
+    set->count = 0;
+
+    return total;
+}
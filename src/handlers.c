@@ -4,33 +4,51 @@
 #include "common.h"
 #include "handlers.h"
 #include "hashmap.h"
+#include "page_table.h"
 #include "drcachesim.h"
 #include "simulator.h"
 #include "io.h"
+#include "requests.h"
+#include "initial_state.h"
+#include "sketch.h"
+#include "trace_stats.h"
+#include "trace_chunks.h"
+#include "analysis.h"
+#include "reuse_distance.h"
+#include "tag_density.h"
+#include "series.h"
+#include "trace_filter.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
 #include <zlib.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
 
 
-// static char * get_type_string(u8 type)
-// {
-//     switch (type)
-//     {
-//         case CUSTOM_TRACE_TYPE_INSTR:
-//             return "INSTR";
-//         case CUSTOM_TRACE_TYPE_LOAD:
-//             return "LOAD";
-//         case CUSTOM_TRACE_TYPE_STORE:
-//             return "STORE";
-//         case CUSTOM_TRACE_TYPE_CLOAD:
-//             return "CLOAD";
-//         case CUSTOM_TRACE_TYPE_CSTORE:
-//             return "CSTORE";
-//         default: assert(!"Impossible.");
-//     }
-// }
+static char * get_type_string(u8 type)
+{
+    switch (type)
+    {
+        case CUSTOM_TRACE_TYPE_INSTR:
+            return "INSTR";
+        case CUSTOM_TRACE_TYPE_LOAD:
+            return "LOAD";
+        case CUSTOM_TRACE_TYPE_STORE:
+            return "STORE";
+        case CUSTOM_TRACE_TYPE_CLOAD:
+            return "CLOAD";
+        case CUSTOM_TRACE_TYPE_CSTORE:
+            return "CSTORE";
+        default: assert(!"Impossible.");
+    }
+
+    return NULL;
+}
 
 // static void debug_print_entry(custom_trace_entry_t entry)
 // {
@@ -39,170 +57,423 @@
 // }
 
 
-typedef struct trace_stats_t trace_stats_t;
-struct trace_stats_t
+#define MAX_THREADS                 256
+
+#define THREADS_USAGE "[--threads=<number of threads>]"
+
+// NOTE defaults to the number of online CPUs
+static u32 num_threads_from_args(int * num_args, char ** args)
 {
-    // NOTE invalid paddr counts include missing paddrs
+    char * threads_str = args_take_value(num_args, args, "threads");
 
-    u64 num_entries;
-    u64 num_entries_no_paddr;
-    u64 num_entries_invalid_paddr;
+    i64 num_threads;
+    if (threads_str)
+    {
+        char * endptr;
+        num_threads = strtoll(threads_str, &endptr, 10);
+        if (*endptr != '\0' || num_threads < 1 || num_threads > MAX_THREADS)
+        {
+            printf("ERROR: invalid number of threads \"%s\" (expected 1 to %d).\n", threads_str, MAX_THREADS);
+            quit();
+        }
+    }
+    else
+    {
+        num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_threads < 1) num_threads = 1;
+        if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+    }
 
-    u64 num_entries_paddr_matches_vaddr;
-    u64 num_entries_invalid_paddr_matches_vaddr;
+    return (u32) num_threads;
+}
 
-    u64 num_instructions;
-    u64 num_instructions_no_paddr;
-    u64 num_instructions_invalid_paddr;
+static u64 u64_from_arg(char * description, char * str, int base)
+{
+    char * endptr;
+    errno = 0;
+    u64 value = strtoull(str, &endptr, base);
+    if (*str == '\0' || *str == '-' || *endptr != '\0' || errno != 0)
+    {
+        printf("ERROR: invalid %s \"%s\".\n", description, str);
+        quit();
+    }
 
-    u64 num_mem_accesses;
+    return value;
+}
 
-    u64 num_LOADs;
-    u64 num_LOADs_no_paddr;
-    u64 num_LOADs_invalid_paddr;
+// NOTE "<start>-<end>" in hexadecimal (like dumped addresses), for [start, end)
+static void addr_range_from_arg(char * range_str, u64 * start, u64 * end)
+{
+    char * separator = strchr(range_str, '-');
+    if (!separator)
+    {
+        printf("ERROR: invalid address range \"%s\" (expected <start>-<end>).\n", range_str);
+        quit();
+    }
 
-    u64 num_STOREs;
-    u64 num_STOREs_no_paddr;
-    u64 num_STOREs_invalid_paddr;
+    *separator = '\0';
+    *start = u64_from_arg("range start address", range_str, 16);
+    *end = u64_from_arg("range end address", separator + 1, 16);
+    *separator = '-';
 
-    u64 num_CLOADs;
-    u64 num_CLOADs_no_paddr;
-    u64 num_CLOADs_invalid_paddr;
+    if (*end <= *start)
+    {
+        printf("ERROR: empty address range \"%s\".\n", range_str);
+        quit();
+    }
+}
 
-    u64 num_CSTOREs;
-    u64 num_CSTOREs_no_paddr;
-    u64 num_CSTOREs_invalid_paddr;
-};
+#define TRACE_FILTER_USAGE "[--type=<type>,...] [--tag=0|1] [--paddr-range=<start>-<end>] [--vaddr-range=<start>-<end>] " \
+    "[--paddr-valid | --paddr-invalid]"
 
-static void update_trace_stats(trace_stats_t * stats, custom_trace_entry_t entry)
+static trace_filter_t trace_filter_from_args(int * num_args, char ** args)
 {
-    stats->num_entries++;
-    if (!entry.paddr) stats->num_entries_no_paddr++;
-    if (!check_paddr_valid(entry.paddr)) stats->num_entries_invalid_paddr++;
+    trace_filter_t filter = trace_filter_all();
 
-    if (entry.vaddr == entry.paddr)
+    char * types_str = args_take_value(num_args, args, "type");
+    if (types_str)
     {
-        stats->num_entries_paddr_matches_vaddr++;
-        assert(entry.paddr);
-        if (!check_paddr_valid(entry.paddr)) stats->num_entries_invalid_paddr_matches_vaddr++;
-    }
+        filter.type_mask = 0;
+
+        char * str = types_str;
+        while (true)
+        {
+            char * separator = strchr(str, ',');
+            u64 length = separator ? (u64) (separator - str) : strlen(str);
+
+            i64 type = -1;
+            for (i64 i = 0; i < NUM_CUSTOM_TRACE_TYPES; i++)
+            {
+                char * type_name = get_type_string(i);
+                if (strlen(type_name) == length && strncasecmp(type_name, str, length) == 0) type = i;
+            }
 
-    if (entry.type != CUSTOM_TRACE_TYPE_INSTR) stats->num_mem_accesses++;
+            if (type < 0)
+            {
+                printf("ERROR: invalid entry types \"%s\" (expected instr, load, store, cload or cstore, separated by commas).\n",
+                    types_str);
+                quit();
+            }
+            filter.type_mask |= 1 << type;
+
+            if (!separator) break;
+            str = separator + 1;
+        }
+    }
 
-    switch (entry.type)
+    char * tag_str = args_take_value(num_args, args, "tag");
+    if (tag_str)
     {
-        case CUSTOM_TRACE_TYPE_INSTR:
+        if (strcmp(tag_str, "0") == 0) filter.tag_mask = 1 << 0;
+        else if (strcmp(tag_str, "1") == 0) filter.tag_mask = 1 << 1;
+        else
         {
-            stats->num_instructions++;
+            printf("ERROR: invalid tag \"%s\" (expected 0 or 1).\n", tag_str);
+            quit();
+        }
+    }
 
-            if (!entry.paddr) stats->num_instructions_no_paddr++;
-            if (!check_paddr_valid(entry.paddr)) stats->num_instructions_invalid_paddr++;
-        } break;
-        case CUSTOM_TRACE_TYPE_LOAD:
-        {
-            stats->num_LOADs++;
+    char * paddr_range_str = args_take_value(num_args, args, "paddr-range");
+    if (paddr_range_str)
+    {
+        u64 paddr_end;
+        addr_range_from_arg(paddr_range_str, &filter.paddr_start, &paddr_end);
+        filter.paddr_last = paddr_end - 1;
+    }
 
-            if (!entry.paddr) stats->num_LOADs_no_paddr++;
-            if (!check_paddr_valid(entry.paddr)) stats->num_LOADs_invalid_paddr++;
-        } break;
-        case CUSTOM_TRACE_TYPE_STORE:
-        {
-            stats->num_STOREs++;
+    char * vaddr_range_str = args_take_value(num_args, args, "vaddr-range");
+    if (vaddr_range_str)
+    {
+        u64 vaddr_end;
+        addr_range_from_arg(vaddr_range_str, &filter.vaddr_start, &vaddr_end);
+        filter.vaddr_last = vaddr_end - 1;
+    }
 
-            if (!entry.paddr) stats->num_STOREs_no_paddr++;
-            if (!check_paddr_valid(entry.paddr)) stats->num_STOREs_invalid_paddr++;
-            assert(entry.tag == 0);
-        } break;
-        case CUSTOM_TRACE_TYPE_CLOAD:
-        {
-            stats->num_CLOADs++;
+    bool paddr_valid = args_take_flag(num_args, args, "paddr-valid");
+    bool paddr_invalid = args_take_flag(num_args, args, "paddr-invalid");
+    if (paddr_valid && paddr_invalid)
+    {
+        printf("ERROR: --paddr-valid and --paddr-invalid cannot be used together.\n");
+        quit();
+    }
+    if (paddr_valid) filter.paddr_valid_mask = 1 << 1;
+    if (paddr_invalid) filter.paddr_valid_mask = 1 << 0;
 
-            if (!entry.paddr) stats->num_CLOADs_no_paddr++;
-            if (!check_paddr_valid(entry.paddr)) stats->num_CLOADs_invalid_paddr++;
-            assert(entry.tag == 0 || entry.tag == 1);
-        } break;
-        case CUSTOM_TRACE_TYPE_CSTORE:
-        {
-            stats->num_CSTOREs++;
+    return filter;
+}
 
-            if (!entry.paddr) stats->num_CSTOREs_no_paddr++;
-            if (!check_paddr_valid(entry.paddr)) stats->num_CSTOREs_invalid_paddr++;
-            assert(entry.tag == 0 || entry.tag == 1);
-        } break;
-        default: assert(!"Impossible.");
+typedef struct get_info_analysis_t get_info_analysis_t;
+struct get_info_analysis_t
+{
+    trace_stats_t stats;
+    concurrent_set_u64 accessed_pages; // NOTE shared by every thread when the trace is split into chunks
+};
+
+static void get_info_analysis_process(void * state, custom_trace_entry_t * entries, u64 num_entries)
+{
+    get_info_analysis_t * analysis = (get_info_analysis_t *) state;
+
+    update_trace_stats(&analysis->stats, entries, num_entries);
+
+    // NOTE runs of entries are often in the same page, so pages are only passed on when they change
+    u64 pages[CONCURRENT_HASH_TABLE_BULK_SIZE];
+    u64 num_pages = 0;
+    u64 prev_page = UINT64_MAX;
+    for (u64 i = 0; i < num_entries; i++)
+    {
+        if (!check_paddr_valid(entries[i].paddr)) continue;
+
+        u64 page = get_page_start(entries[i].paddr);
+        if (page == prev_page) continue;
+        prev_page = page;
+
+        pages[num_pages++] = page;
+        if (num_pages == array_count(pages))
+        {
+            concurrent_set_u64_insert_bulk(analysis->accessed_pages, pages, num_pages);
+            num_pages = 0;
+        }
     }
+    concurrent_set_u64_insert_bulk(analysis->accessed_pages, pages, num_pages);
 }
 
-static void print_trace_stats(trace_stats_t * stats)
+static void get_info_analysis_finish(void * state)
 {
-    printf("Statistics:\n");
-    printf(INDENT4 "Total entries: %lu\n", stats->num_entries);
-    printf(INDENT4 "Total entries without paddr: %lu\n", stats->num_entries_no_paddr);
-    printf(INDENT4 "Total entries with invalid paddr: %lu\n", stats->num_entries_invalid_paddr);
-    printf("\n");
-    printf(INDENT4 "Total entries where paddr == vaddr: %ld\n", stats->num_entries_paddr_matches_vaddr);
-    printf(INDENT4 "Total entries where invalid paddr == vaddr: %ld\n", stats->num_entries_invalid_paddr_matches_vaddr);
-    printf("\n");
-    printf(INDENT4 "Instructions: %lu\n", stats->num_instructions);
-    printf(INDENT4 "Instructions without paddr: %lu\n", stats->num_instructions_no_paddr);
-    printf(INDENT4 "Instructions with invalid paddr: %lu\n", stats->num_instructions_invalid_paddr);
-    printf("\n");
-    printf(INDENT4 "Total memory accesses: %lu\n", stats->num_mem_accesses);
-    printf("\n");
-    printf(INDENT4 "LOADs: %lu\n", stats->num_LOADs);
-    printf(INDENT4 "LOADs without paddr: %lu\n", stats->num_LOADs_no_paddr);
-    printf(INDENT4 "LOADs with invalid paddr: %lu\n", stats->num_LOADs_invalid_paddr);
-    printf("\n");
-    printf(INDENT4 "STOREs: %lu\n", stats->num_STOREs);
-    printf(INDENT4 "STOREs without paddr: %lu\n", stats->num_STOREs_no_paddr);
-    printf(INDENT4 "STOREs with invalid paddr: %lu\n", stats->num_STOREs_invalid_paddr);
-    printf("\n");
-    printf(INDENT4 "CLOADs: %lu\n", stats->num_CLOADs);
-    printf(INDENT4 "CLOADs without paddr: %lu\n", stats->num_CLOADs_no_paddr);
-    printf(INDENT4 "CLOADs with invalid paddr: %lu\n", stats->num_CLOADs_invalid_paddr);
+    get_info_analysis_t * analysis = (get_info_analysis_t *) state;
+
+    print_trace_stats(&analysis->stats);
     printf("\n");
-    printf(INDENT4 "CSTOREs: %lu\n", stats->num_CSTOREs);
-    printf(INDENT4 "CSTOREs without paddr: %lu\n", stats->num_CSTOREs_no_paddr);
-    printf(INDENT4 "CSTOREs with invalid paddr: %lu\n", stats->num_CSTOREs_invalid_paddr);
+    printf(INDENT4 "Pages accessed (valid paddrs): %lu\n", concurrent_set_u64_size(analysis->accessed_pages));
+
+    concurrent_set_u64_cleanup(&analysis->accessed_pages);
+}
+
+static analysis_t get_info_analysis_create(arena_t * arena)
+{
+    get_info_analysis_t * state = arena_push_array(arena, get_info_analysis_t, 1);
+    state->accessed_pages = concurrent_set_u64_create();
+
+    analysis_t analysis = {0};
+    analysis.name = "get-info";
+    analysis.state = state;
+    analysis.process = get_info_analysis_process;
+    analysis.finish = get_info_analysis_finish;
+
+    return analysis;
 }
 
 void trace_get_info(COMMAND_HANDLER_ARGS)
 {
-    (void) arena;
+    u32 num_threads = num_threads_from_args(&num_args, args);
 
     if (num_args != 1)
     {
-        printf("Usage: %s %s <trace file>\n", exe_name, cmd_name);
+        printf("Usage: %s %s " THREADS_USAGE " <trace file>\n", exe_name, cmd_name);
+        quit();
+    }
+
+    char * input_filename = args[0];
+
+    trace_chunks_t chunks;
+    if (trace_chunks_open(arena, input_filename, &chunks))
+    {
+        if (num_threads > chunks.num_chunks && chunks.num_chunks > 0) num_threads = chunks.num_chunks;
+
+        // NOTE each thread counts into its own stats (merged at the end), accessed pages go straight into the shared set
+        analysis_t analysis = get_info_analysis_create(arena);
+        get_info_analysis_t * totals = (get_info_analysis_t *) analysis.state;
+
+        get_info_analysis_t * thread_states = arena_push_array(arena, get_info_analysis_t, num_threads);
+        void ** worker_data = arena_push_array(arena, void *, num_threads);
+        for (u32 i = 0; i < num_threads; i++)
+        {
+            thread_states[i].accessed_pages = totals->accessed_pages;
+            worker_data[i] = &thread_states[i];
+        }
+
+        trace_chunks_process(arena, &chunks, num_threads, analysis.process, worker_data);
+
+        for (u32 i = 0; i < num_threads; i++) merge_trace_stats(&totals->stats, &thread_states[i].stats);
+
+        trace_chunks_close(&chunks);
+
+        analysis.finish(analysis.state);
+    }
+    else
+    {
+        // NOTE gzip traces (and pipes, LZ4 traces with linked blocks) can only be decoded in order, the encoding is
+        // only known if the file could be looked at (i.e. not for pipes)
+        u8 reader_type = chunks.encoding == TRACE_CHUNKS_ENCODING_LZ4 ?
+            TRACE_READER_TYPE_LZ4 : guess_reader_type(input_filename);
+        trace_reader_t input_trace = trace_reader_open(arena, input_filename, reader_type);
+
+        analysis_t analysis = get_info_analysis_create(arena);
+        analyses_run(arena, &input_trace, &analysis, 1);
+
+        trace_reader_close(&input_trace);
+    }
+}
+
+
+#define HOT_ADDRESSES_DEFAULT_TOP_K         20
+#define HOT_ADDRESSES_SKETCH_WIDTH_BITS     16
+
+static void print_heavy_hitters(char * description, u8 type, heavy_hitters_t * heavy_hitters)
+{
+    top_k_sort(&heavy_hitters->top_k);
+
+    printf("Hottest %s (%s, %lu accesses, counts overestimated by at most %lu with probability %.1f%%):\n",
+        description, get_type_string(type), heavy_hitters->sketch.total,
+        count_min_error_bound(&heavy_hitters->sketch), 100 * (1 - count_min_error_probability()));
+
+    for (u64 i = 0; i < heavy_hitters->top_k.size; i++)
+    {
+        top_k_entry_t entry = heavy_hitters->top_k.heap[i];
+        printf(INDENT4 "%3lu: " FMT_ADDR " %lu\n", i + 1, entry.key, entry.count);
+    }
+}
+
+void trace_get_hot_addresses(COMMAND_HANDLER_ARGS)
+{
+    char * top_k_str = args_take_value(&num_args, args, "top");
+
+    if (num_args != 1)
+    {
+        printf("Usage: %s %s [--top=<number of addresses>] <trace file>\n", exe_name, cmd_name);
         quit();
     }
 
     char * input_filename = args[0];
 
+    u64 top_k = HOT_ADDRESSES_DEFAULT_TOP_K;
+    if (top_k_str)
+    {
+        char * endptr;
+        i64 value = strtoll(top_k_str, &endptr, 10);
+        if (*endptr != '\0' || value < 1)
+        {
+            printf("ERROR: invalid number of addresses \"%s\".\n", top_k_str);
+            quit();
+        }
+        top_k = value;
+    }
+
     trace_reader_t input_trace =
-        trace_reader_open(arena, input_filename, TRACE_READER_TYPE_UNCOMPRESSED_OR_GZIP);
+        trace_reader_open(arena, input_filename, guess_reader_type(input_filename));
 
-    trace_stats_t global_stats = {0};
+    heavy_hitters_t hot_pages[NUM_CUSTOM_TRACE_TYPES];
+    heavy_hitters_t hot_lines[NUM_CUSTOM_TRACE_TYPES];
+    for (i64 type = 0; type < NUM_CUSTOM_TRACE_TYPES; type++)
+    {
+        hot_pages[type] = heavy_hitters_create(arena, HOT_ADDRESSES_SKETCH_WIDTH_BITS, top_k);
+        hot_lines[type] = heavy_hitters_create(arena, HOT_ADDRESSES_SKETCH_WIDTH_BITS, top_k);
+    }
+
+    u64 dbg_paddrs_invalid = 0;
 
     while (true)
     {
         custom_trace_entry_t current_entry;
         if (!trace_reader_get(&input_trace, &current_entry, sizeof(current_entry))) break;
 
-        update_trace_stats(&global_stats, current_entry);
+        assert(current_entry.type < NUM_CUSTOM_TRACE_TYPES);
+
+        u64 paddr = current_entry.paddr;
+        if (!check_paddr_valid(paddr))
+        {
+            dbg_paddrs_invalid++;
+            continue;
+        }
+
+        heavy_hitters_add(&hot_pages[current_entry.type], get_page_start(paddr));
+        heavy_hitters_add(&hot_lines[current_entry.type], align_floor_pow_2(paddr, CACHE_LINE_SIZE));
     }
 
-    print_trace_stats(&global_stats);
+    for (i64 type = 0; type < NUM_CUSTOM_TRACE_TYPES; type++)
+    {
+        print_heavy_hitters("pages", type, &hot_pages[type]);
+        print_heavy_hitters("cache lines", type, &hot_lines[type]);
+        printf("\n");
+    }
+
+    printf("Entries with invalid paddrs (skipped): %lu\n", dbg_paddrs_invalid);
 
     trace_reader_close(&input_trace);
+
+    for (i64 type = 0; type < NUM_CUSTOM_TRACE_TYPES; type++)
+    {
+        heavy_hitters_cleanup(&hot_pages[type]);
+        heavy_hitters_cleanup(&hot_lines[type]);
+    }
+}
+
+
+#define DISTINCT_COUNTER_USAGE "[--approximate | --external-memory=<MiB per counter> [--spill-dir=<directory>]]"
+
+static distinct_counter_config_t distinct_counter_config_from_args(int * num_args, char ** args)
+{
+    distinct_counter_config_t config = {0};
+    config.mode = DISTINCT_COUNTER_EXACT;
+
+    bool approximate = args_take_flag(num_args, args, "approximate");
+    char * memory_budget_str = args_take_value(num_args, args, "external-memory");
+    char * spill_dir = args_take_value(num_args, args, "spill-dir");
+
+    if (approximate && memory_budget_str)
+    {
+        printf("ERROR: --approximate and --external-memory cannot be used together.\n");
+        quit();
+    }
+
+    if (spill_dir && !memory_budget_str)
+    {
+        printf("ERROR: --spill-dir requires --external-memory.\n");
+        quit();
+    }
+
+    if (approximate)
+    {
+        config.mode = DISTINCT_COUNTER_APPROXIMATE;
+    }
+    else if (memory_budget_str)
+    {
+        char * endptr;
+        i64 memory_budget_mib = strtoll(memory_budget_str, &endptr, 10);
+        if (*endptr != '\0' || memory_budget_mib < EXTERNAL_SET_MIN_MEMORY / MEGABYTES(1))
+        {
+            printf("ERROR: invalid memory budget \"%s\" (expected a whole number of MiB, at least %lu).\n",
+                memory_budget_str, (u64) (EXTERNAL_SET_MIN_MEMORY / MEGABYTES(1)));
+            quit();
+        }
+
+        if (!spill_dir) spill_dir = getenv("TMPDIR");
+        if (!spill_dir) spill_dir = "/tmp";
+
+        config.mode = DISTINCT_COUNTER_EXTERNAL;
+        config.memory_budget = MEGABYTES(memory_budget_mib);
+        config.spill_dir = spill_dir;
+    }
+
+    return config;
 }
 
+static void print_distinct_count(char * description, distinct_counter_t * counter)
+{
+    printf("%s: %lu", description, distinct_counter_count(counter));
+    if (counter->mode == DISTINCT_COUNTER_APPROXIMATE)
+    {
+        printf(" (approximate, standard error %.2f%%)", 100 * distinct_counter_standard_error(counter));
+    }
+    printf("\n");
+}
 
-// TODO if you want to implement your own hashmap, checking the output of this with previous results would be a good way to test it
 void trace_patch_paddrs(COMMAND_HANDLER_ARGS)
 {
+    distinct_counter_config_t counter_config = distinct_counter_config_from_args(&num_args, args);
+
     if (num_args != 2)
     {
-        printf("Usage: %s %s <input trace file> <output trace file>\n", exe_name, cmd_name);
+        printf("Usage: %s %s " DISTINCT_COUNTER_USAGE " <input trace file> <output trace file>\n", exe_name, cmd_name);
         quit();
     }
 
@@ -221,10 +492,11 @@ void trace_patch_paddrs(COMMAND_HANDLER_ARGS)
     trace_writer_t output_trace =
         trace_writer_open(arena, output_filename, guess_writer_type(output_filename));
 
-    map_u64 page_table = map_u64_create();
-    set_u64 dbg_pages_changed_mapping = set_u64_create();
-    set_u64 dbg_pages_without_mapping = set_u64_create();
+    page_table_t page_table = page_table_create(arena);
+    distinct_counter_t dbg_pages_changed_mapping = distinct_counter_create(arena, counter_config);
+    distinct_counter_t dbg_pages_without_mapping = distinct_counter_create(arena, counter_config);
 
+    custom_trace_entry_t * batch = arena_push_array(arena, custom_trace_entry_t, TRACE_BATCH_NUM_ENTRIES);
     trace_stats_t global_stats_before = {0};
     trace_stats_t global_stats_after = {0};
 
@@ -234,49 +506,59 @@ void trace_patch_paddrs(COMMAND_HANDLER_ARGS)
 
     while (true)
     {
-        custom_trace_entry_t current_entry;
-        if (!trace_reader_get(&input_trace, &current_entry, sizeof(current_entry))) break;
+        u64 num_entries = trace_reader_get_batch(&input_trace, batch, sizeof(custom_trace_entry_t), TRACE_BATCH_NUM_ENTRIES);
+        if (num_entries == 0) break;
 
-        update_trace_stats(&global_stats_before, current_entry);
-
-        u64 vaddr = current_entry.vaddr;
-        u64 paddr = current_entry.paddr;
-        assert(vaddr);
+        update_trace_stats(&global_stats_before, batch, num_entries);
 
-        if (check_paddr_valid(paddr))
+        // NOTE entries are patched in place
+        for (u64 i = 0; i < num_entries; i++)
         {
-            u64 paddr_page;
-            if (map_u64_get(page_table, get_page_start(vaddr), &paddr_page))
-            {
-                // TODO why is virtual-physical mapping changing during execution (userspace traces)?
-                if (paddr_page != get_page_start(paddr))
-                {
-                    dbg_num_addr_mapping_changes++;
-                    set_u64_insert(dbg_pages_changed_mapping, get_page_start(vaddr));
-                }
-            }
+            custom_trace_entry_t * current_entry = &batch[i];
 
-            map_u64_set(page_table, get_page_start(vaddr), get_page_start(paddr));
-        }
-        else
-        {
-            u64 paddr_page;
-            if (map_u64_get(page_table, get_page_start(vaddr), &paddr_page))
+            u64 vaddr = current_entry->vaddr;
+            u64 paddr = current_entry->paddr;
+            assert(vaddr);
+
+            if (check_paddr_valid(paddr))
             {
-                assert(paddr_page);
+                u64 paddr_page;
+                if (page_table_get(&page_table, vaddr, &paddr_page))
+                {
+                    // TODO why is virtual-physical mapping changing during execution (userspace traces)?
+                    if (paddr_page != get_page_start(paddr))
+                    {
+                        dbg_num_addr_mapping_changes++;
+                        distinct_counter_insert(&dbg_pages_changed_mapping, get_page_start(vaddr));
 
-                current_entry.paddr = paddr_page + (vaddr - get_page_start(vaddr));
+                        page_table_set(&page_table, vaddr, get_page_start(paddr));
+                    }
+                }
+                else
+                {
+                    page_table_set(&page_table, vaddr, get_page_start(paddr));
+                }
             }
             else
             {
-                // NOTE to see how many pages the entries without valid mappings correspond to
-                set_u64_insert(dbg_pages_without_mapping, get_page_start(vaddr));
+                u64 paddr_page;
+                if (page_table_get(&page_table, vaddr, &paddr_page))
+                {
+                    assert(paddr_page);
+
+                    current_entry->paddr = paddr_page + (vaddr - get_page_start(vaddr));
+                }
+                else
+                {
+                    // NOTE to see how many pages the entries without valid mappings correspond to
+                    distinct_counter_insert(&dbg_pages_without_mapping, get_page_start(vaddr));
+                }
             }
-        }
 
-        trace_writer_emit(&output_trace, &current_entry, sizeof(current_entry));
+            trace_writer_emit(&output_trace, current_entry, sizeof(custom_trace_entry_t));
+        }
 
-        update_trace_stats(&global_stats_after, current_entry);
+        update_trace_stats(&global_stats_after, batch, num_entries);
     }
 
     printf("\n");
@@ -290,15 +572,14 @@ void trace_patch_paddrs(COMMAND_HANDLER_ARGS)
     printf("\n");
 
     printf("Mapping changes: %lu\n", dbg_num_addr_mapping_changes);
-    printf("Pages with mapping changes: %lu\n", set_u64_size(dbg_pages_changed_mapping));
-    printf("Pages without paddr mappings: %lu\n", set_u64_size(dbg_pages_without_mapping));
+    print_distinct_count("Pages with mapping changes", &dbg_pages_changed_mapping);
+    print_distinct_count("Pages without paddr mappings", &dbg_pages_without_mapping);
 
     trace_reader_close(&input_trace);
     trace_writer_close(&output_trace);
 
-    map_u64_cleanup(&page_table);
-    set_u64_cleanup(&dbg_pages_changed_mapping);
-    set_u64_cleanup(&dbg_pages_without_mapping);
+    distinct_counter_cleanup(&dbg_pages_changed_mapping);
+    distinct_counter_cleanup(&dbg_pages_without_mapping);
 }
 
 void trace_convert(COMMAND_HANDLER_ARGS)
@@ -322,16 +603,20 @@ void trace_convert(COMMAND_HANDLER_ARGS)
     trace_writer_t output_trace =
         trace_writer_open(arena, output_filename, guess_writer_type(output_filename));
 
+    custom_trace_entry_t * batch = arena_push_array(arena, custom_trace_entry_t, TRACE_BATCH_NUM_ENTRIES);
     trace_stats_t global_stats = {0};
 
     while (true)
     {
-        custom_trace_entry_t current_entry;
-        if (!trace_reader_get(&input_trace, &current_entry, sizeof(current_entry))) break;
+        u64 num_entries = trace_reader_get_batch(&input_trace, batch, sizeof(custom_trace_entry_t), TRACE_BATCH_NUM_ENTRIES);
+        if (num_entries == 0) break;
 
-        update_trace_stats(&global_stats, current_entry);
+        update_trace_stats(&global_stats, batch, num_entries);
 
-        trace_writer_emit(&output_trace, &current_entry, sizeof(current_entry));
+        for (u64 i = 0; i < num_entries; i++)
+        {
+            trace_writer_emit(&output_trace, &batch[i], sizeof(custom_trace_entry_t));
+        }
     }
 
     print_trace_stats(&global_stats);
@@ -340,6 +625,52 @@ void trace_convert(COMMAND_HANDLER_ARGS)
     trace_writer_close(&output_trace);
 }
 
+void trace_filter_entries(COMMAND_HANDLER_ARGS)
+{
+    trace_filter_t filter = trace_filter_from_args(&num_args, args);
+
+    if (num_args != 2)
+    {
+        printf("Usage: %s %s " TRACE_FILTER_USAGE " <input file> <output file>\n", exe_name, cmd_name);
+        quit();
+    }
+
+    char * input_filename = args[0];
+    char * output_filename = args[1];
+
+    if (file_exists_not_fifo(output_filename))
+    {
+        if (!confirm_overwrite_file(output_filename)) quit();
+    }
+
+    trace_reader_t input_trace =
+        trace_reader_open(arena, input_filename, guess_reader_type(input_filename));
+    trace_writer_t output_trace =
+        trace_writer_open(arena, output_filename, guess_writer_type(output_filename));
+
+    custom_trace_entry_t * batch = arena_push_array(arena, custom_trace_entry_t, TRACE_BATCH_NUM_ENTRIES);
+    u64 num_entries_read = 0;
+    u64 num_entries_written = 0;
+
+    while (true)
+    {
+        u64 num_entries = trace_reader_get_batch(&input_trace, batch, sizeof(custom_trace_entry_t), TRACE_BATCH_NUM_ENTRIES);
+        if (num_entries == 0) break;
+        num_entries_read += num_entries;
+
+        // NOTE kept entries are compacted to the start of the batch, then written in one go
+        u64 num_kept = trace_filter_batch(&filter, batch, num_entries, batch);
+        if (num_kept > 0) trace_writer_emit(&output_trace, batch, num_kept * sizeof(custom_trace_entry_t));
+        num_entries_written += num_kept;
+    }
+
+    printf("Entries read: %lu\n", num_entries_read);
+    printf("Entries written: %lu\n", num_entries_written);
+
+    trace_reader_close(&input_trace);
+    trace_writer_close(&output_trace);
+}
+
 void trace_convert_generic(COMMAND_HANDLER_ARGS)
 {
     if (num_args != 2)
@@ -419,59 +750,71 @@ void trace_split(COMMAND_HANDLER_ARGS)
 }
 
 // TODO move main loops here into drcachesim source file?
-void trace_convert_drcachesim_vaddr(COMMAND_HANDLER_ARGS)
+typedef struct drcachesim_analysis_t drcachesim_analysis_t;
+struct drcachesim_analysis_t
 {
-    if (num_args != 2)
-    {
-        printf("Usage: %s %s <input custom trace file> <output drcachesim trace file>\n", exe_name, cmd_name);
-        quit();
-    }
-
-    char * input_trace_filename = args[0];
-    char * output_trace_filename = args[1];
-
-    if (file_exists_not_fifo(output_trace_filename))
-    {
-        if (!confirm_overwrite_file(output_trace_filename)) quit();
-    }
-
-    trace_reader_t input_trace =
-        trace_reader_open(arena, input_trace_filename, guess_reader_type(input_trace_filename));
-
-    trace_writer_t output_trace =
-        trace_writer_open(arena, output_trace_filename, guess_writer_type(output_trace_filename));
-
-    u64 dbg_paddrs_invalid = 0;
-    map_u64 page_table = map_u64_create();
+    trace_writer_t output_trace;
+    bool virtual_addresses;
+    page_table_t page_table; // NOTE only used for virtual address traces
+    u64 dbg_paddrs_invalid;
+};
 
-    write_drcachesim_header(&output_trace);
+static void drcachesim_analysis_process(void * state, custom_trace_entry_t * entries, u64 num_entries)
+{
+    drcachesim_analysis_t * analysis = (drcachesim_analysis_t *) state;
 
-    while (true)
+    for (u64 i = 0; i < num_entries; i++)
     {
-        custom_trace_entry_t current_entry;
-        if (!trace_reader_get(&input_trace, &current_entry, sizeof(current_entry))) break;
+        custom_trace_entry_t current_entry = entries[i];
 
         // skip invalid entries
         if (!check_paddr_valid(current_entry.paddr))
         {
-            dbg_paddrs_invalid++;
+            analysis->dbg_paddrs_invalid++;
             continue;
         }
 
-        write_drcachesim_trace_entry_vaddr(&output_trace, page_table, current_entry);
+        if (analysis->virtual_addresses)
+        {
+            write_drcachesim_trace_entry_vaddr(&analysis->output_trace, &analysis->page_table, current_entry);
+        }
+        else
+        {
+            write_drcachesim_trace_entry_paddr(&analysis->output_trace, current_entry);
+        }
     }
+}
 
-    write_drcachesim_footer(&output_trace);
+static void drcachesim_analysis_finish(void * state)
+{
+    drcachesim_analysis_t * analysis = (drcachesim_analysis_t *) state;
 
-    printf("Entries with invalid paddrs (skipped): %ld\n", dbg_paddrs_invalid);
+    write_drcachesim_footer(&analysis->output_trace);
 
-    map_u64_cleanup(&page_table);
+    printf("Entries with invalid paddrs (skipped): %ld\n", analysis->dbg_paddrs_invalid);
 
-    trace_reader_close(&input_trace);
-    trace_writer_close(&output_trace);
+    trace_writer_close(&analysis->output_trace);
 }
 
-void trace_convert_drcachesim_paddr(COMMAND_HANDLER_ARGS)
+static analysis_t drcachesim_analysis_create(arena_t * arena, char * output_trace_filename, bool virtual_addresses)
+{
+    drcachesim_analysis_t * state = arena_push_array(arena, drcachesim_analysis_t, 1);
+    state->output_trace = trace_writer_open(arena, output_trace_filename, guess_writer_type(output_trace_filename));
+    state->virtual_addresses = virtual_addresses;
+    if (virtual_addresses) state->page_table = page_table_create(arena);
+
+    write_drcachesim_header(&state->output_trace);
+
+    analysis_t analysis = {0};
+    analysis.name = virtual_addresses ? "convert-drcachesim-vaddr" : "convert-drcachesim-paddr";
+    analysis.state = state;
+    analysis.process = drcachesim_analysis_process;
+    analysis.finish = drcachesim_analysis_finish;
+
+    return analysis;
+}
+
+static void trace_convert_drcachesim(COMMAND_HANDLER_ARGS, bool virtual_addresses)
 {
     if (num_args != 2)
     {
@@ -490,34 +833,20 @@ void trace_convert_drcachesim_paddr(COMMAND_HANDLER_ARGS)
     trace_reader_t input_trace =
         trace_reader_open(arena, input_trace_filename, guess_reader_type(input_trace_filename));
 
-    trace_writer_t output_trace =
-        trace_writer_open(arena, output_trace_filename, guess_writer_type(output_trace_filename));
-
-    u64 dbg_paddrs_invalid = 0;
-
-    write_drcachesim_header(&output_trace);
-
-    while (true)
-    {
-        custom_trace_entry_t current_entry;
-        if (!trace_reader_get(&input_trace, &current_entry, sizeof(current_entry))) break;
-
-        // skip invalid entries
-        if (!check_paddr_valid(current_entry.paddr))
-        {
-            dbg_paddrs_invalid++;
-            continue;
-        }
-
-        write_drcachesim_trace_entry_paddr(&output_trace, current_entry);
-    }
+    analysis_t analysis = drcachesim_analysis_create(arena, output_trace_filename, virtual_addresses);
+    analyses_run(arena, &input_trace, &analysis, 1);
 
-    write_drcachesim_footer(&output_trace);
+    trace_reader_close(&input_trace);
+}
 
-    printf("Entries with invalid paddrs (skipped): %ld\n", dbg_paddrs_invalid);
+void trace_convert_drcachesim_vaddr(COMMAND_HANDLER_ARGS)
+{
+    trace_convert_drcachesim(arena, exe_name, cmd_name, num_args, args, true);
+}
 
-    trace_reader_close(&input_trace);
-    trace_writer_close(&output_trace);
+void trace_convert_drcachesim_paddr(COMMAND_HANDLER_ARGS)
+{
+    trace_convert_drcachesim(arena, exe_name, cmd_name, num_args, args, false);
 }
 
 
@@ -561,51 +890,29 @@ static void print_initial_state_stats(initial_state_stats_t * stats)
     printf(INDENT4 "Invalid paddrs (skipped): %lu\n", stats->num_paddrs_invalid);
 }
 
-void trace_get_initial_accesses(COMMAND_HANDLER_ARGS)
+typedef struct initial_state_analysis_t initial_state_analysis_t;
+struct initial_state_analysis_t
 {
-    if (num_args != 2)
-    {
-        printf("Usage: %s %s <input trace file> <output bin file>\n", exe_name, cmd_name);
-        quit();
-    }
-
-    char * input_trace_filename = args[0];
-    char * initial_state_filename = args[1];
-
-    if (file_exists_not_fifo(initial_state_filename))
-    {
-        if (!confirm_overwrite_file(initial_state_filename)) quit();
-    }
-
-    trace_reader_t input_trace =
-        trace_reader_open(arena, input_trace_filename, guess_reader_type(input_trace_filename));
-
-    FILE * initial_state_file = fopen(initial_state_filename, "wb");
-    assert(initial_state_file);
-
-    static_assert(sizeof(initial_access_t) == 1, "Expect initial access record type to be a single byte.");
-
-    i64 initial_state_table_size = MEMORY_SIZE / CAP_SIZE_BYTES;
-    initial_access_t * initial_state_table = arena_push_array(arena, initial_access_t, initial_state_table_size);
-    for (i64 i = 0; i < initial_state_table_size; i++)
-    {
-        initial_state_table[i].type = -1;
-        initial_state_table[i].tag = 0;
-    }
-
-    initial_state_stats_t dbg_stats = {0};
+    arena_t * arena;
+    char * output_filename;
+    initial_access_t * initial_state_table;
+    bitset_t modified_paddrs; // NOTE indexed like the initial state table (by capability-aligned address)
+    initial_state_stats_t dbg_stats;
+    u64 num_accessed_paddrs;
+};
 
-    set_u64 modified_paddrs = set_u64_create();
+static void initial_state_analysis_process(void * state, custom_trace_entry_t * entries, u64 num_entries)
+{
+    initial_state_analysis_t * analysis = (initial_state_analysis_t *) state;
 
-    while (true)
+    for (u64 i = 0; i < num_entries; i++)
     {
-        custom_trace_entry_t current_entry;
-        if (!trace_reader_get(&input_trace, &current_entry, sizeof(current_entry))) break;
+        custom_trace_entry_t current_entry = entries[i];
 
         if (!check_paddr_valid(current_entry.paddr))
         {
-            if (current_entry.paddr == -1) dbg_stats.num_paddrs_missing++;
-            else dbg_stats.num_paddrs_invalid++;
+            if (current_entry.paddr == -1) analysis->dbg_stats.num_paddrs_missing++;
+            else analysis->dbg_stats.num_paddrs_invalid++;
 
             continue;
         }
@@ -618,102 +925,133 @@ void trace_get_initial_accesses(COMMAND_HANDLER_ARGS)
 
         for (u64 paddr = start_addr; paddr < end_addr; paddr += CAP_SIZE_BYTES)
         {
-            assert(check_paddr_valid(paddr));
-            u64 mem_offset = paddr - BASE_PADDR;
-
-            assert(mem_offset % CAP_SIZE_BYTES == 0);
-            i64 table_idx = mem_offset / CAP_SIZE_BYTES;
-            assert(table_idx >= 0 && table_idx < initial_state_table_size);
-
+            i64 table_idx = initial_state_get_index(paddr);
 
-            if (initial_state_table[table_idx].type == -1)
+            if (initial_access_untouched(analysis->initial_state_table[table_idx]))
             {
+                analysis->num_accessed_paddrs++;
+
                 assert(current_entry.tag == 0 || current_entry.tag == 1);
 
                 switch (current_entry.type)
                 {
                     case CUSTOM_TRACE_TYPE_INSTR:
                     {
-                        dbg_stats.num_INSTRs++;
+                        analysis->dbg_stats.num_INSTRs++;
                         assert(current_entry.tag == 0);
                     } break;
                     case CUSTOM_TRACE_TYPE_LOAD:
                     {
-                        dbg_stats.num_LOADs++;
+                        analysis->dbg_stats.num_LOADs++;
                         // TODO unknown tags? use -1?
                         assert(current_entry.tag == 0);
                     } break;
                     case CUSTOM_TRACE_TYPE_STORE:
                     {
-                        dbg_stats.num_STOREs++;
+                        analysis->dbg_stats.num_STOREs++;
                         assert(current_entry.tag == 0);
                     } break;
                     case CUSTOM_TRACE_TYPE_CLOAD:
                     {
-                        dbg_stats.num_CLOADs++;
-                        if (current_entry.tag) dbg_stats.num_CLOADs_tag_set++;
+                        analysis->dbg_stats.num_CLOADs++;
+                        if (current_entry.tag) analysis->dbg_stats.num_CLOADs_tag_set++;
                     } break;
                     case CUSTOM_TRACE_TYPE_CSTORE:
                     {
-                        dbg_stats.num_CSTOREs++;
-                        if (current_entry.tag) dbg_stats.num_CSTOREs_tag_set++;
+                        analysis->dbg_stats.num_CSTOREs++;
+                        if (current_entry.tag) analysis->dbg_stats.num_CSTOREs_tag_set++;
                     } break;
                     default: assert("!Impossible.");
                 }
 
-                initial_state_table[table_idx].type = current_entry.type;
-                initial_state_table[table_idx].tag = current_entry.tag;
+                analysis->initial_state_table[table_idx] = initial_access_create(current_entry.type, current_entry.tag);
             }
-            else if (initial_state_table[table_idx].type == CUSTOM_TRACE_TYPE_LOAD
+            else if (initial_access_get_type(analysis->initial_state_table[table_idx]) == CUSTOM_TRACE_TYPE_LOAD
                 && current_entry.type == CUSTOM_TRACE_TYPE_CLOAD
-                && !set_u64_contains(modified_paddrs, paddr))
+                && !bitset_test(analysis->modified_paddrs, table_idx))
             {
-                dbg_stats.num_LOADs_overwritten_with_CLOADs++;
-                if (current_entry.tag) dbg_stats.num_LOADs_overwritten_with_CLOADs_tag_set++;
+                analysis->dbg_stats.num_LOADs_overwritten_with_CLOADs++;
+                if (current_entry.tag) analysis->dbg_stats.num_LOADs_overwritten_with_CLOADs_tag_set++;
 
                 // TODO unknown tags? use -1 for LOADs?
                 assert(current_entry.tag == 0 || current_entry.tag == 1);
 
-                initial_state_table[table_idx].type = current_entry.type;
-                initial_state_table[table_idx].tag = current_entry.tag;
+                analysis->initial_state_table[table_idx] = initial_access_create(current_entry.type, current_entry.tag);
             }
-            else if (initial_state_table[table_idx].type == CUSTOM_TRACE_TYPE_CLOAD
+            else if (initial_access_get_type(analysis->initial_state_table[table_idx]) == CUSTOM_TRACE_TYPE_CLOAD
                 && current_entry.type == CUSTOM_TRACE_TYPE_CLOAD
-                && !set_u64_contains(modified_paddrs, paddr))
+                && !bitset_test(analysis->modified_paddrs, table_idx))
             {
                 // checks for: CLOAD -> no modification -> CLOAD with different tag
                 // (supposedly impossible case, may happen with userspace traces)
 
-                dbg_stats.num_CLOADs_after_mismatched_CLOAD++;
+                analysis->dbg_stats.num_CLOADs_after_mismatched_CLOAD++;
             }
 
             if (current_entry.type == CUSTOM_TRACE_TYPE_STORE
                 || current_entry.type == CUSTOM_TRACE_TYPE_CSTORE)
             {
                 assert(paddr % CAP_SIZE_BYTES == 0);
-                set_u64_insert(modified_paddrs, paddr);
+                bitset_set(analysis->modified_paddrs, table_idx);
             }
         }
     }
+}
+
+static void initial_state_analysis_finish(void * state)
+{
+    initial_state_analysis_t * analysis = (initial_state_analysis_t *) state;
+
+    initial_state_write(analysis->arena, analysis->output_filename, analysis->initial_state_table);
+
+    print_initial_state_stats(&analysis->dbg_stats);
+
+    printf("\n");
+    printf(INDENT4 "Number of accessed capability-aligned addresses: %lu\n", analysis->num_accessed_paddrs);
+    printf(INDENT4 "Number of modified capability-aligned addresses: %lu\n", bitset_count(analysis->modified_paddrs));
+}
+
+static analysis_t initial_state_analysis_create(arena_t * arena, char * initial_state_filename)
+{
+    initial_state_analysis_t * state = arena_push_array(arena, initial_state_analysis_t, 1);
+    state->arena = arena;
+    state->output_filename = initial_state_filename;
+    // NOTE arena memory is zeroed, which is the untouched state
+    state->initial_state_table = arena_push_array(arena, initial_access_t, INITIAL_STATE_TABLE_SIZE);
+    state->modified_paddrs = bitset_create(arena, INITIAL_STATE_TABLE_SIZE);
+
+    analysis_t analysis = {0};
+    analysis.name = "get-initial-state";
+    analysis.state = state;
+    analysis.process = initial_state_analysis_process;
+    analysis.finish = initial_state_analysis_finish;
+
+    return analysis;
+}
 
-    fwrite(initial_state_table, 1, initial_state_table_size, initial_state_file);
-    fclose(initial_state_file);
+void trace_get_initial_accesses(COMMAND_HANDLER_ARGS)
+{
+    if (num_args != 2)
+    {
+        printf("Usage: %s %s <input trace file> <output bin file>\n", exe_name, cmd_name);
+        quit();
+    }
 
-    print_initial_state_stats(&dbg_stats);
+    char * input_trace_filename = args[0];
+    char * initial_state_filename = args[1];
 
-    u64 num_accessed_paddrs = 0;
-    for (i64 i = 0; i < initial_state_table_size; i++)
+    if (file_exists_not_fifo(initial_state_filename))
     {
-        if (initial_state_table[i].type != -1) num_accessed_paddrs++;
+        if (!confirm_overwrite_file(initial_state_filename)) quit();
     }
 
-    printf("\n");
-    printf(INDENT4 "Number of accessed capability-aligned addresses: %lu\n", num_accessed_paddrs);
-    printf(INDENT4 "Number of modified capability-aligned addresses: %lu\n", set_u64_size(modified_paddrs));
+    trace_reader_t input_trace =
+        trace_reader_open(arena, input_trace_filename, guess_reader_type(input_trace_filename));
 
-    trace_reader_close(&input_trace);
+    analysis_t analysis = initial_state_analysis_create(arena, initial_state_filename);
+    analyses_run(arena, &input_trace, &analysis, 1);
 
-    set_u64_cleanup(&modified_paddrs);
+    trace_reader_close(&input_trace);
 }
 
 
@@ -743,51 +1081,25 @@ static inline void tag_set(tags_t * tags_cheri, u8 tag_idx, u8 value)
     tags_cheri->known |= (1 << tag_idx);
 }
 
-void trace_simulate(COMMAND_HANDLER_ARGS)
+typedef struct simulate_analysis_t simulate_analysis_t;
+struct simulate_analysis_t
 {
-    if (num_args != 2)
-    {
-        printf("Usage: %s %s <trace file> <output file>\n", exe_name, cmd_name);
-        quit();
-    }
-
-    char * input_trace_filename = args[0];
-    char * output_requests_filename = args[1];
-
-    device_t * tag_controller = controller_interface_init(arena, output_requests_filename);
-    device_t * l2_cache = cache_init(arena, "L2", KILOBYTES(1024), 8, tag_controller);
-
-    device_t * l1_instr_cache = cache_init(arena, "L1I", KILOBYTES(64), 4, l2_cache);
-    device_t * l1_data_cache = cache_init(arena, "L1D", KILOBYTES(64), 4, l2_cache);
-    assert(l2_cache->num_children == 2);
-
-    device_t * all_devices[] =
-    {
-        l1_instr_cache,
-        l1_data_cache,
-        l2_cache,
-        tag_controller
-    };
-    assert(array_count(all_devices) <= UINT32_MAX);
-    u32 num_devices = array_count(all_devices);
-
-    printf("Simulating with following configuration:\n");
-    for (i64 i = 0; i < num_devices; i++)
-    {
-        device_print_configuration(all_devices[i]);
-    }
-    printf("\n");
+    device_t * l1_instr_cache;
+    device_t * l1_data_cache;
+    device_t * all_devices[4];
+    u32 num_devices;
 
-    trace_reader_t input_trace =
-        trace_reader_open(arena, input_trace_filename, guess_reader_type(input_trace_filename));
+    i64 dbg_paddrs_missing;
+    i64 dbg_paddrs_invalid;
+};
 
-    i64 dbg_paddrs_missing = 0;
-    i64 dbg_paddrs_invalid = 0;
+static void simulate_analysis_process(void * state, custom_trace_entry_t * entries, u64 num_entries)
+{
+    simulate_analysis_t * analysis = (simulate_analysis_t *) state;
 
-    while (true)
+    for (u64 i = 0; i < num_entries; i++)
     {
-        custom_trace_entry_t current_entry;
-        if (!trace_reader_get(&input_trace, &current_entry, sizeof(current_entry))) break;
+        custom_trace_entry_t current_entry = entries[i];
 
         /* NOTE can just assume all caches are PIPT.
          * VIPT relies on the fact that the lowest bits of the physical and virtual addresses are the same,
@@ -796,8 +1108,8 @@ void trace_simulate(COMMAND_HANDLER_ARGS)
 
         if (!check_paddr_valid(current_entry.paddr))
         {
-            if (current_entry.paddr == 0) dbg_paddrs_missing++;
-            else dbg_paddrs_invalid++;
+            if (current_entry.paddr == 0) analysis->dbg_paddrs_missing++;
+            else analysis->dbg_paddrs_invalid++;
 
             continue;
         }
@@ -827,7 +1139,7 @@ void trace_simulate(COMMAND_HANDLER_ARGS)
                      * modified version of this cache line */
 
                     coherence_search =
-                        notify_peers_coherence_flush(l1_instr_cache, paddr, false);
+                        notify_peers_coherence_flush(analysis->l1_instr_cache, paddr, false);
                 } break;
                 case CUSTOM_TRACE_TYPE_LOAD:
                 case CUSTOM_TRACE_TYPE_CLOAD:
@@ -836,7 +1148,7 @@ void trace_simulate(COMMAND_HANDLER_ARGS)
                      * modified version of this cache line */
 
                     coherence_search =
-                        notify_peers_coherence_flush(l1_data_cache, paddr, false);
+                        notify_peers_coherence_flush(analysis->l1_data_cache, paddr, false);
                 } break;
                 case CUSTOM_TRACE_TYPE_STORE:
                 case CUSTOM_TRACE_TYPE_CSTORE:
@@ -845,7 +1157,7 @@ void trace_simulate(COMMAND_HANDLER_ARGS)
                      * cache line (otherwise stale data could be read from the peer cache later on) */
 
                     coherence_search =
-                        notify_peers_coherence_flush(l1_data_cache, paddr, true);
+                        notify_peers_coherence_flush(analysis->l1_data_cache, paddr, true);
                 } break;
                 default: assert("Impossible.");
             }
@@ -855,7 +1167,7 @@ void trace_simulate(COMMAND_HANDLER_ARGS)
             /* HANDLE REQUEST */
             if (current_entry.type == CUSTOM_TRACE_TYPE_INSTR)
             {
-                cache_line_t * cache_line = cache_request(l1_instr_cache, paddr);
+                cache_line_t * cache_line = cache_request(analysis->l1_instr_cache, paddr);
 
                 assert(current_entry.tag == 0);
 
@@ -874,14 +1186,14 @@ void trace_simulate(COMMAND_HANDLER_ARGS)
                     if (coherence_search.status != COHERENCE_SEARCH_NOT_FOUND)
                     {
                         assert(!cache_line->dirty);
-                        coherence_propagate_known_tags(l1_instr_cache, coherence_search.lowest_common_parent,
+                        coherence_propagate_known_tags(analysis->l1_instr_cache, coherence_search.lowest_common_parent,
                             paddr, cache_line->tags_cheri);
                     }
                 }
             }
             else
             {
-                cache_line_t * cache_line = cache_request(l1_data_cache, paddr);
+                cache_line_t * cache_line = cache_request(analysis->l1_data_cache, paddr);
 
                 switch (current_entry.type)
                 {
@@ -905,7 +1217,7 @@ void trace_simulate(COMMAND_HANDLER_ARGS)
                             if (coherence_search.status != COHERENCE_SEARCH_NOT_FOUND)
                             {
                                 assert(!cache_line->dirty);
-                                coherence_propagate_known_tags(l1_data_cache, coherence_search.lowest_common_parent,
+                                coherence_propagate_known_tags(analysis->l1_data_cache, coherence_search.lowest_common_parent,
                                     paddr, cache_line->tags_cheri);
                             }
                         }
@@ -933,23 +1245,94 @@ void trace_simulate(COMMAND_HANDLER_ARGS)
             }
         }
     }
+}
+
+static void simulate_analysis_finish(void * state)
+{
+    simulate_analysis_t * analysis = (simulate_analysis_t *) state;
+
+    // NOTE printed here rather than on creation, so that it ends up in the simulate section of a run
+    printf("Simulating with following configuration:\n");
+    for (i64 i = 0; i < analysis->num_devices; i++)
+    {
+        device_print_configuration(analysis->all_devices[i]);
+    }
+    printf("\n");
 
-    printf("Entries missing paddrs (skipped): %ld\n", dbg_paddrs_missing);
-    printf("Entries with invalid paddrs (skipped): %ld\n", dbg_paddrs_invalid);
+    printf("Entries missing paddrs (skipped): %ld\n", analysis->dbg_paddrs_missing);
+    printf("Entries with invalid paddrs (skipped): %ld\n", analysis->dbg_paddrs_invalid);
     printf("\n");
 
     printf("Statistics:\n");
-    for (i64 i = 0; i < num_devices; i++)
+    for (i64 i = 0; i < analysis->num_devices; i++)
     {
-        device_print_statistics(all_devices[i]);
+        device_print_statistics(analysis->all_devices[i]);
     }
     printf("\n");
 
-    for (i64 i = 0; i < num_devices; i++)
+    for (i64 i = 0; i < analysis->num_devices; i++)
+    {
+        device_cleanup(analysis->all_devices[i]);
+    }
+}
+
+static analysis_t simulate_analysis_create(arena_t * arena, char * output_requests_filename, bool raw_requests)
+{
+    simulate_analysis_t * state = arena_push_array(arena, simulate_analysis_t, 1);
+
+    device_t * tag_controller = controller_interface_init(arena, output_requests_filename, !raw_requests);
+    device_t * l2_cache = cache_init(arena, "L2", KILOBYTES(1024), 8, tag_controller);
+
+    state->l1_instr_cache = cache_init(arena, "L1I", KILOBYTES(64), 4, l2_cache);
+    state->l1_data_cache = cache_init(arena, "L1D", KILOBYTES(64), 4, l2_cache);
+    assert(l2_cache->num_children == 2);
+
+    device_t * all_devices[] =
+    {
+        state->l1_instr_cache,
+        state->l1_data_cache,
+        l2_cache,
+        tag_controller
+    };
+    static_assert(array_count(all_devices) == array_count(state->all_devices), "Device array sizes should match.");
+    state->num_devices = array_count(all_devices);
+    for (u32 i = 0; i < state->num_devices; i++) state->all_devices[i] = all_devices[i];
+
+    analysis_t analysis = {0};
+    analysis.name = "simulate";
+    analysis.state = state;
+    analysis.process = simulate_analysis_process;
+    analysis.finish = simulate_analysis_finish;
+
+    return analysis;
+}
+
+void trace_simulate(COMMAND_HANDLER_ARGS)
+{
+    // NOTE LLC requests are written in the compact encoding (see requests.h) unless asked otherwise
+    bool raw_requests = args_take_flag(&num_args, args, "raw-requests");
+
+    if (num_args != 2)
+    {
+        printf("Usage: %s %s [--raw-requests] <trace file> <output file>\n", exe_name, cmd_name);
+        quit();
+    }
+
+    char * input_trace_filename = args[0];
+    char * output_requests_filename = args[1];
+
+    if (file_exists_not_fifo(output_requests_filename))
     {
-        device_cleanup(all_devices[i]);
+        if (!confirm_overwrite_file(output_requests_filename)) quit();
     }
 
+    analysis_t analysis = simulate_analysis_create(arena, output_requests_filename, raw_requests);
+
+    trace_reader_t input_trace =
+        trace_reader_open(arena, input_trace_filename, guess_reader_type(input_trace_filename));
+
+    analyses_run(arena, &input_trace, &analysis, 1);
+
     trace_reader_close(&input_trace);
 
     // TODO intialise leaf tag table from initial tag state file
@@ -1014,344 +1397,1206 @@ void trace_simulate(COMMAND_HANDLER_ARGS)
      */
 }
 
-// TODO fix
-void trace_simulate_uncompressed(COMMAND_HANDLER_ARGS)
+enum reuse_distance_stream_t
 {
-    if (num_args != 2)
-    {
-        printf("Usage: %s %s <LLC requests trace file> <initial state file>\n", exe_name, cmd_name);
-        quit();
-    }
-
-    char * requests_trace_filename = args[0];
-    // char * initial_state_filename = args[1];
-
-    // device_t * tag_controller = tag_cache_init(arena, initial_tags_filename, KILOBYTES(32), 4);
+    REUSE_DISTANCE_STREAM_INSTR,
+    REUSE_DISTANCE_STREAM_DATA,
+    REUSE_DISTANCE_STREAM_ALL,
+    NUM_REUSE_DISTANCE_STREAMS
+};
 
-    trace_reader_t tag_controller_requests =
-        trace_reader_open(arena, requests_trace_filename, guess_reader_type(requests_trace_filename));
+typedef struct reuse_distance_analysis_t reuse_distance_analysis_t;
+struct reuse_distance_analysis_t
+{
+    reuse_distance_t streams[NUM_REUSE_DISTANCE_STREAMS]; // NOTE keyed by cache line
+    u64 dbg_paddrs_invalid;
+};
 
-    // printf("Simulating with following configuration:\n");
-    // device_print_configuration(tag_controller);
-    // printf("\n");
+static void reuse_distance_analysis_process(void * state, custom_trace_entry_t * entries, u64 num_entries)
+{
+    reuse_distance_analysis_t * analysis = (reuse_distance_analysis_t *) state;
 
-    while (true)
+    for (u64 i = 0; i < num_entries; i++)
     {
-        tag_cache_request_t current_entry;
-        if (!trace_reader_get(&tag_controller_requests, &current_entry, sizeof(current_entry))) break;
-
-        assert(current_entry.size == CACHE_LINE_SIZE);
+        custom_trace_entry_t current_entry = entries[i];
 
-        u64 paddr = current_entry.addr;
-        assert(check_paddr_valid(paddr));
-        assert(paddr % CACHE_LINE_SIZE == 0);
-        assert(paddr % CAP_SIZE_BYTES == 0);
-
-        // TODO support larger cache line sizes?
-        assert(current_entry.tags == (u8) current_entry.tags);
-        // b8 tags_cheri = current_entry.tags;
-        // b8 tags_known = current_entry.tags_known; // TODO again, makes no sense
+        if (!check_paddr_valid(current_entry.paddr))
+        {
+            analysis->dbg_paddrs_invalid++;
+            continue;
+        }
 
-        printf("%-6s [ addr: " FMT_ADDR ", tags data: %02X, tags known mask: %02X ]\n",
-            current_entry.type == TAG_CACHE_REQUEST_TYPE_READ ? "READ" :
-            current_entry.type == TAG_CACHE_REQUEST_TYPE_WRITE ? "WRITE" : "UNKNOWN",
-            current_entry.addr, current_entry.tags, current_entry.tags_known);
+        reuse_distance_t * stream = current_entry.type == CUSTOM_TRACE_TYPE_INSTR ?
+            &analysis->streams[REUSE_DISTANCE_STREAM_INSTR] : &analysis->streams[REUSE_DISTANCE_STREAM_DATA];
 
-        switch (current_entry.type)
+        u64 start_addr = align_floor_pow_2(current_entry.paddr, CACHE_LINE_SIZE);
+        u64 end_addr = align_ceil_pow_2(current_entry.paddr + current_entry.size, CACHE_LINE_SIZE);
+        for (u64 paddr = start_addr; paddr < end_addr; paddr += CACHE_LINE_SIZE)
         {
-            case TAG_CACHE_REQUEST_TYPE_READ:
-            {
-                // TODO this makes no sense, fix
-                // b8 tags_read, tags_known_read;
-                // device_read(tag_controller, paddr, &tags_read, &tags_known_read);
-                // assert(tags_read == tags_cheri);
-            } break;
-            case TAG_CACHE_REQUEST_TYPE_WRITE:
-            {
-                // device_write(tag_controller, paddr, tags_cheri, tags_known);
-            } break;
-            default: assert(!"Impossible.");
+            u64 line = paddr / CACHE_LINE_SIZE;
+            reuse_distance_access(stream, line);
+            reuse_distance_access(&analysis->streams[REUSE_DISTANCE_STREAM_ALL], line);
         }
     }
-
-    // printf("Statistics:\n");
-    // device_print_statistics(tag_controller);
-    // device_cleanup(tag_controller);
-    // printf("\n");
-
-    trace_reader_close(&tag_controller_requests);
 }
 
-
-typedef struct trace_requests_stats_t trace_requests_stats_t;
-struct trace_requests_stats_t
+static void reuse_distance_analysis_finish(void * state)
 {
-    set_u64 tagged_capabilities;
-    map_u64 page_tag_counts;
-    set_u64 accessed_pages;
+    reuse_distance_analysis_t * analysis = (reuse_distance_analysis_t *) state;
 
-    u64 num_capabilities_tagged;
-    u64 num_lines_tagged;
-    u64 num_pages_tagged;
-};
+    // NOTE stdout is kept to just the CSV
+    fprintf(stderr, "Entries with invalid paddrs (skipped): %lu\n", analysis->dbg_paddrs_invalid);
 
-static trace_requests_stats_t requests_stats_create(void)
-{
-    trace_requests_stats_t stats = {0};
+    printf("cache lines,cache bytes,"
+        "instruction misses,instruction miss ratio,data misses,data miss ratio,all misses,all miss ratio\n");
 
-    stats.tagged_capabilities = set_u64_create();
-    stats.page_tag_counts = map_u64_create();
-    stats.accessed_pages = set_u64_create();
+    u64 max_num_lines = reuse_distance_num_keys(&analysis->streams[REUSE_DISTANCE_STREAM_ALL]);
+    for (u32 bucket_idx = 1; bucket_idx < REUSE_DISTANCE_NUM_BUCKETS; bucket_idx++)
+    {
+        u64 num_lines = reuse_distance_bucket_start(bucket_idx);
+        printf("%lu,%lu", num_lines, num_lines * CACHE_LINE_SIZE);
 
-    return stats;
-}
+        for (i64 i = 0; i < NUM_REUSE_DISTANCE_STREAMS; i++)
+        {
+            reuse_distance_t * stream = &analysis->streams[i];
+            u64 misses = reuse_distance_misses(stream, bucket_idx);
+            f64 miss_ratio = stream->num_accesses > 0 ? (f64) misses / stream->num_accesses : 0;
+            printf(",%lu,%f", misses, miss_ratio);
+        }
+        printf("\n");
 
-static void requests_stats_cleanup(trace_requests_stats_t * stats)
-{
-    set_u64_cleanup(&stats->tagged_capabilities);
-    map_u64_cleanup(&stats->page_tag_counts);
-    set_u64_cleanup(&stats->accessed_pages);
+        // NOTE every line fits in any larger cache, so only cold misses are left
+        if (num_lines >= max_num_lines) break;
+    }
+
+    for (i64 i = 0; i < NUM_REUSE_DISTANCE_STREAMS; i++)
+    {
+        reuse_distance_cleanup(&analysis->streams[i]);
+    }
 }
 
-static void requests_stats_print(trace_requests_stats_t * stats)
+static analysis_t reuse_distance_analysis_create(arena_t * arena)
 {
-    printf("Statistics:\n");
-    printf(INDENT4 "Number of capabilities with tag set: %lu\n", stats->num_capabilities_tagged);
-    printf(INDENT4 "Number of cache lines containing tags: %lu\n", stats->num_lines_tagged);
-    printf(INDENT4 "Number of pages containing tags: %lu\n", stats->num_pages_tagged);
-    printf(INDENT4 "Number of pages accessed: %lu\n", set_u64_size(stats->accessed_pages));
+    reuse_distance_analysis_t * state = arena_push_array(arena, reuse_distance_analysis_t, 1);
+    for (i64 i = 0; i < NUM_REUSE_DISTANCE_STREAMS; i++)
+    {
+        state->streams[i] = reuse_distance_create();
+    }
+
+    analysis_t analysis = {0};
+    analysis.name = "reuse-distance";
+    analysis.state = state;
+    analysis.process = reuse_distance_analysis_process;
+    analysis.finish = reuse_distance_analysis_finish;
+
+    return analysis;
 }
 
-static void requests_stats_print_csv_header(void)
+void trace_reuse_distance(COMMAND_HANDLER_ARGS)
 {
-    printf("index,valid capabilities,cache lines containing tags,pages containing tags,pages accessed\n");
+    if (num_args != 1)
+    {
+        printf("Usage: %s %s <trace file>\n", exe_name, cmd_name);
+        quit();
+    }
+
+    char * input_trace_filename = args[0];
+
+    trace_reader_t input_trace =
+        trace_reader_open(arena, input_trace_filename, guess_reader_type(input_trace_filename));
+
+    analysis_t analysis = reuse_distance_analysis_create(arena);
+    analyses_run(arena, &input_trace, &analysis, 1);
+
+    trace_reader_close(&input_trace);
 }
 
-static void requests_stats_print_csv(u64 index, trace_requests_stats_t * stats)
+
+#define WORKING_SET_DEFAULT_WINDOW  1000000 // NOTE instructions
+
+typedef struct working_set_analysis_t working_set_analysis_t;
+struct working_set_analysis_t
 {
-    printf("%lu,%lu,%lu,%lu,%lu\n",
-        index,
-        stats->num_capabilities_tagged,
-        stats->num_lines_tagged,
-        stats->num_pages_tagged,
-        set_u64_size(stats->accessed_pages)
-    );
+    u64 window_size;
+    u64 window_idx;
+    u64 window_instructions;
+    u64 window_accesses;
+
+    // NOTE indexed by (paddr - BASE_PADDR) at each granularity, reset at the end of every window
+    epoch_set_t window_lines;
+    epoch_set_t window_pages;
+    epoch_set_t window_tagged_lines;
+
+    // NOTE everything touched so far
+    bitset_t footprint_lines;
+    bitset_t footprint_pages;
+    u64 num_footprint_lines;
+    u64 num_footprint_pages;
+
+    u64 dbg_paddrs_invalid;
+};
+
+static void working_set_print_csv_header(void)
+{
+    printf("window,instructions,memory accesses,lines,pages,tagged lines,total lines,total pages\n");
 }
 
-static void requests_stats_update_accessed_pages(trace_requests_stats_t * stats, u64 addr)
+static void working_set_end_window(working_set_analysis_t * analysis)
 {
-    set_u64_insert(stats->accessed_pages, get_page_start(addr));
+    printf("%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+        analysis->window_idx,
+        analysis->window_instructions,
+        analysis->window_accesses,
+        analysis->window_lines.count,
+        analysis->window_pages.count,
+        analysis->window_tagged_lines.count,
+        analysis->num_footprint_lines,
+        analysis->num_footprint_pages
+    );
+
+    analysis->window_idx++;
+    analysis->window_instructions = 0;
+    analysis->window_accesses = 0;
+
+    epoch_set_reset(&analysis->window_lines);
+    epoch_set_reset(&analysis->window_pages);
+    epoch_set_reset(&analysis->window_tagged_lines);
 }
 
-static void requests_stats_update_tag(trace_requests_stats_t * stats, u64 addr, bool tag_set)
+static void working_set_analysis_process(void * state, custom_trace_entry_t * entries, u64 num_entries)
 {
-    bool tag_already_set = set_u64_contains(stats->tagged_capabilities, addr);
+    working_set_analysis_t * analysis = (working_set_analysis_t *) state;
 
-    if (tag_set != tag_already_set)
+    for (u64 i = 0; i < num_entries; i++)
     {
-        if (tag_set)
+        custom_trace_entry_t current_entry = entries[i];
+
+        if (current_entry.type == CUSTOM_TRACE_TYPE_INSTR) analysis->window_instructions++;
+        else analysis->window_accesses++;
+
+        if (check_paddr_valid(current_entry.paddr))
         {
-            assert(stats->num_capabilities_tagged < UINT64_MAX);
-            stats->num_capabilities_tagged++;
+            bool tag_set = current_entry.tag && current_entry.type != CUSTOM_TRACE_TYPE_LOAD;
+
+            u64 start_addr = align_floor_pow_2(current_entry.paddr, CACHE_LINE_SIZE);
+            u64 end_addr = align_ceil_pow_2(current_entry.paddr + current_entry.size, CACHE_LINE_SIZE);
+            for (u64 paddr = start_addr; paddr < end_addr; paddr += CACHE_LINE_SIZE)
+            {
+                // NOTE accesses can run off the end of memory
+                if (!check_paddr_valid(paddr)) break;
+
+                u64 line_idx = (paddr - BASE_PADDR) >> CACHE_LINE_SIZE_BITS;
+                u64 page_idx = (paddr - BASE_PADDR) >> PAGE_SIZE_BITS;
+
+                if (epoch_set_insert(&analysis->window_lines, line_idx))
+                {
+                    if (!bitset_test(analysis->footprint_lines, line_idx))
+                    {
+                        bitset_set(analysis->footprint_lines, line_idx);
+                        analysis->num_footprint_lines++;
+                    }
+                }
+
+                if (epoch_set_insert(&analysis->window_pages, page_idx))
+                {
+                    if (!bitset_test(analysis->footprint_pages, page_idx))
+                    {
+                        bitset_set(analysis->footprint_pages, page_idx);
+                        analysis->num_footprint_pages++;
+                    }
+                }
 
-            set_u64_insert(stats->tagged_capabilities, addr);
+                if (tag_set) epoch_set_insert(&analysis->window_tagged_lines, line_idx);
+            }
         }
         else
         {
-            assert(stats->num_capabilities_tagged > 0);
-            stats->num_capabilities_tagged--;
+            analysis->dbg_paddrs_invalid++;
+        }
+
+        if (analysis->window_instructions == analysis->window_size) working_set_end_window(analysis);
+    }
+}
+
+static void working_set_analysis_finish(void * state)
+{
+    working_set_analysis_t * analysis = (working_set_analysis_t *) state;
+
+    // NOTE the last window is usually partial
+    if (analysis->window_instructions > 0 || analysis->window_accesses > 0) working_set_end_window(analysis);
+
+    // NOTE stdout is kept to just the CSV
+    fprintf(stderr, "Entries with invalid paddrs (skipped): %lu\n", analysis->dbg_paddrs_invalid);
+}
+
+static analysis_t working_set_analysis_create(arena_t * arena, u64 window_size)
+{
+    working_set_analysis_t * state = arena_push_array(arena, working_set_analysis_t, 1);
+    state->window_size = window_size;
+    state->window_lines = epoch_set_create(arena, MEMORY_SIZE / CACHE_LINE_SIZE);
+    state->window_pages = epoch_set_create(arena, MEMORY_SIZE / PAGE_SIZE);
+    state->window_tagged_lines = epoch_set_create(arena, MEMORY_SIZE / CACHE_LINE_SIZE);
+    state->footprint_lines = bitset_create(arena, MEMORY_SIZE / CACHE_LINE_SIZE);
+    state->footprint_pages = bitset_create(arena, MEMORY_SIZE / PAGE_SIZE);
+
+    working_set_print_csv_header();
+
+    analysis_t analysis = {0};
+    analysis.name = "working-set";
+    analysis.state = state;
+    analysis.process = working_set_analysis_process;
+    analysis.finish = working_set_analysis_finish;
+
+    return analysis;
+}
+
+void trace_working_set(COMMAND_HANDLER_ARGS)
+{
+    char * window_str = args_take_value(&num_args, args, "window");
 
-            set_u64_remove(stats->tagged_capabilities, addr);
+    if (num_args != 1)
+    {
+        printf("Usage: %s %s [--window=<number of instructions>] <trace file>\n", exe_name, cmd_name);
+        quit();
+    }
+
+    char * input_trace_filename = args[0];
+
+    u64 window_size = WORKING_SET_DEFAULT_WINDOW;
+    if (window_str)
+    {
+        char * endptr;
+        i64 value = strtoll(window_str, &endptr, 10);
+        if (*endptr != '\0' || value < 1)
+        {
+            printf("ERROR: invalid window size \"%s\".\n", window_str);
+            quit();
         }
+        window_size = value;
+    }
+
+    trace_reader_t input_trace =
+        trace_reader_open(arena, input_trace_filename, guess_reader_type(input_trace_filename));
+
+    // NOTE rows are printed as each window ends, so this is not one of the analyses that can share a pass in `run`
+    analysis_t analysis = working_set_analysis_create(arena, window_size);
+    analyses_run(arena, &input_trace, &analysis, 1);
+
+    trace_reader_close(&input_trace);
+}
+
+
+enum analysis_type_t
+{
+    ANALYSIS_TYPE_GET_INFO,
+    ANALYSIS_TYPE_GET_INITIAL_STATE,
+    ANALYSIS_TYPE_CONVERT_DRCACHESIM_PADDR,
+    ANALYSIS_TYPE_CONVERT_DRCACHESIM_VADDR,
+    ANALYSIS_TYPE_SIMULATE,
+    ANALYSIS_TYPE_REUSE_DISTANCE,
+    NUM_ANALYSIS_TYPES
+};
+
+static char * analysis_type_names[NUM_ANALYSIS_TYPES] =
+{
+    [ANALYSIS_TYPE_GET_INFO] = "get-info",
+    [ANALYSIS_TYPE_GET_INITIAL_STATE] = "get-initial-state",
+    [ANALYSIS_TYPE_CONVERT_DRCACHESIM_PADDR] = "convert-drcachesim-paddr",
+    [ANALYSIS_TYPE_CONVERT_DRCACHESIM_VADDR] = "convert-drcachesim-vaddr",
+    [ANALYSIS_TYPE_SIMULATE] = "simulate",
+    [ANALYSIS_TYPE_REUSE_DISTANCE] = "reuse-distance"
+};
+
+// NOTE runs several analyses (the same as the commands of the same names) over a single read of the trace
+void trace_run(COMMAND_HANDLER_ARGS)
+{
+    bool raw_requests = args_take_flag(&num_args, args, "raw-requests");
+    trace_filter_t filter = trace_filter_from_args(&num_args, args);
+
+    if (num_args < 2)
+    {
+        printf("Usage: %s %s [--raw-requests] " TRACE_FILTER_USAGE " <trace file> <analysis>[=<output file>] ...\n",
+            exe_name, cmd_name);
+        printf("Analyses:\n");
+        printf(INDENT4 "%s\n", analysis_type_names[ANALYSIS_TYPE_GET_INFO]);
+        printf(INDENT4 "%s=<output bin file>\n", analysis_type_names[ANALYSIS_TYPE_GET_INITIAL_STATE]);
+        printf(INDENT4 "%s=<output drcachesim trace file>\n", analysis_type_names[ANALYSIS_TYPE_CONVERT_DRCACHESIM_PADDR]);
+        printf(INDENT4 "%s=<output drcachesim trace file>\n", analysis_type_names[ANALYSIS_TYPE_CONVERT_DRCACHESIM_VADDR]);
+        printf(INDENT4 "%s=<output file>\n", analysis_type_names[ANALYSIS_TYPE_SIMULATE]);
+        printf(INDENT4 "%s\n", analysis_type_names[ANALYSIS_TYPE_REUSE_DISTANCE]);
+        quit();
+    }
+
+    char * input_trace_filename = args[0];
+
+    u32 num_analyses = num_args - 1;
+    u8 * analysis_types = arena_push_array(arena, u8, num_analyses);
+    char ** output_filenames = arena_push_array(arena, char *, num_analyses);
 
-        u64 start_addr = align_floor_pow_2(addr, CACHE_LINE_SIZE);
-        u64 final_addr = align_ceil_pow_2(addr + CAP_SIZE_BYTES, CACHE_LINE_SIZE);
+    // NOTE everything is checked before any outputs are created
+    for (u32 i = 0; i < num_analyses; i++)
+    {
+        char * analysis_str = args[i + 1];
 
-        assert(final_addr > start_addr);
-        assert(final_addr - start_addr == CACHE_LINE_SIZE);
+        char * output_filename = strchr(analysis_str, '=');
+        u64 name_length = output_filename ? (u64) (output_filename - analysis_str) : strlen(analysis_str);
+        if (output_filename) output_filename++;
 
-        bool others_cleared_in_line = true;
-        for (u64 other_addr = start_addr; other_addr < final_addr; other_addr += CAP_SIZE_BYTES)
+        i64 type = -1;
+        for (i64 j = 0; j < NUM_ANALYSIS_TYPES; j++)
         {
-            if (other_addr != addr)
+            if (strlen(analysis_type_names[j]) == name_length
+                && strncmp(analysis_type_names[j], analysis_str, name_length) == 0)
             {
-                if (set_u64_contains(stats->tagged_capabilities, other_addr))
-                {
-                    others_cleared_in_line = false;
-                    break;
-                }
+                type = j;
+                break;
             }
         }
-        if (others_cleared_in_line)
+
+        if (type < 0)
+        {
+            printf("ERROR: Unknown analysis \"%s\".\n", analysis_str);
+            quit();
+        }
+
+        bool needs_output = type != ANALYSIS_TYPE_GET_INFO && type != ANALYSIS_TYPE_REUSE_DISTANCE;
+        if (needs_output && (!output_filename || output_filename[0] == '\0'))
+        {
+            printf("ERROR: Analysis \"%s\" needs an output file.\n", analysis_type_names[type]);
+            quit();
+        }
+        else if (!needs_output && output_filename)
+        {
+            printf("ERROR: Analysis \"%s\" does not take an output file.\n", analysis_type_names[type]);
+            quit();
+        }
+
+        if (output_filename)
         {
-            if (tag_set)
+            for (u32 j = 0; j < i; j++)
             {
-                assert(stats->num_lines_tagged < UINT64_MAX);
-                stats->num_lines_tagged++;
+                if (output_filenames[j] && strcmp(output_filenames[j], output_filename) == 0)
+                {
+                    printf("ERROR: \"%s\" is used as the output of more than one analysis.\n", output_filename);
+                    quit();
+                }
             }
-            else
+
+            if (file_exists_not_fifo(output_filename))
             {
-                assert(stats->num_lines_tagged > 0);
-                stats->num_lines_tagged--;
+                if (!confirm_overwrite_file(output_filename)) quit();
             }
         }
 
+        analysis_types[i] = type;
+        output_filenames[i] = output_filename;
+    }
+
+    trace_reader_t input_trace =
+        trace_reader_open(arena, input_trace_filename, guess_reader_type(input_trace_filename));
+
+    analysis_t * analyses = arena_push_array(arena, analysis_t, num_analyses);
+    for (u32 i = 0; i < num_analyses; i++)
+    {
+        switch (analysis_types[i])
         {
-            u64 page_addr = get_page_start(addr);
-            u64 num_tags_in_page;
-            if (!map_u64_get(stats->page_tag_counts, page_addr, &num_tags_in_page))
+            case ANALYSIS_TYPE_GET_INFO:
             {
-                num_tags_in_page = 0;
-            }
-
-            if (num_tags_in_page == 0)
+                analyses[i] = get_info_analysis_create(arena);
+            } break;
+            case ANALYSIS_TYPE_GET_INITIAL_STATE:
             {
-                assert(tag_set);
-                assert(stats->num_pages_tagged < UINT64_MAX);
-                stats->num_pages_tagged++;
-            }
+                analyses[i] = initial_state_analysis_create(arena, output_filenames[i]);
+            } break;
+            case ANALYSIS_TYPE_CONVERT_DRCACHESIM_PADDR:
+            {
+                analyses[i] = drcachesim_analysis_create(arena, output_filenames[i], false);
+            } break;
+            case ANALYSIS_TYPE_CONVERT_DRCACHESIM_VADDR:
+            {
+                analyses[i] = drcachesim_analysis_create(arena, output_filenames[i], true);
+            } break;
+            case ANALYSIS_TYPE_SIMULATE:
+            {
+                analyses[i] = simulate_analysis_create(arena, output_filenames[i], raw_requests);
+            } break;
+            case ANALYSIS_TYPE_REUSE_DISTANCE:
+            {
+                analyses[i] = reuse_distance_analysis_create(arena);
+            } break;
+            default: assert(!"Impossible.");
+        }
+    }
+
+    // NOTE the analyses only see the entries kept by the filter (e.g. to simulate a physical range on its own)
+    analyses_run_filtered(arena, &input_trace, trace_filter_is_all(&filter) ? NULL : &filter, analyses, num_analyses);
+
+    trace_reader_close(&input_trace);
+}
+
+#define REQUESTS_BATCH_NUM_ENTRIES  4096
+
+static u64 requests_read_batch(requests_reader_t * reader, tag_cache_request_t * batch)
+{
+    u64 num_entries = 0;
+    while (num_entries < REQUESTS_BATCH_NUM_ENTRIES && requests_reader_get(reader, &batch[num_entries])) num_entries++;
+
+    return num_entries;
+}
+
+#define REQUESTS_DUMP_BUFFER_SIZE   MEGABYTES(1)
+#define REQUESTS_DUMP_MAX_LINE_SIZE 128
+
+// NOTE all options are removed from the arguments, filter values are hexadecimal (like the dumped addresses)
+static requests_filter_t requests_filter_from_args(int * num_args, char ** args)
+{
+    requests_filter_t filter = requests_filter_all();
+
+    char * range_str = args_take_value(num_args, args, "range");
+    if (range_str) addr_range_from_arg(range_str, &filter.addr_start, &filter.addr_end);
+
+    char * type_str = args_take_value(num_args, args, "type");
+    if (type_str)
+    {
+        if (strcmp(type_str, "read") == 0) filter.type_mask = 1 << TAG_CACHE_REQUEST_TYPE_READ;
+        else if (strcmp(type_str, "write") == 0) filter.type_mask = 1 << TAG_CACHE_REQUEST_TYPE_WRITE;
+        else
+        {
+            printf("ERROR: invalid request type \"%s\" (expected read or write).\n", type_str);
+            quit();
+        }
+    }
+
+    char * tags_str = args_take_value(num_args, args, "tags");
+    if (tags_str)
+    {
+        u64 tags_mask = u64_from_arg("tags mask", tags_str, 16);
+        if (tags_mask == 0 || tags_mask > UINT16_MAX)
+        {
+            printf("ERROR: invalid tags mask \"%s\" (expected 1 to FFFF).\n", tags_str);
+            quit();
+        }
+        filter.tags_mask = tags_mask;
+    }
+
+    return filter;
+}
+
+static u64 requests_dump_format(char * dst, tag_cache_request_t * request)
+{
+    // NOTE same as printf("%-6s [ addr: " FMT_ADDR ", tags data: %02X, tags known mask: %02X ]\n", ...)
+    char * current = dst;
+
+#define REQUESTS_DUMP_APPEND(str) (memcpy(current, str, sizeof(str) - 1), current += sizeof(str) - 1)
+    switch (request->type)
+    {
+        case TAG_CACHE_REQUEST_TYPE_READ: REQUESTS_DUMP_APPEND("READ  "); break;
+        case TAG_CACHE_REQUEST_TYPE_WRITE: REQUESTS_DUMP_APPEND("WRITE "); break;
+        default: REQUESTS_DUMP_APPEND("UNKNOWN"); break;
+    }
+    REQUESTS_DUMP_APPEND(" [ addr: ");
+    current += format_hex_u64(current, request->addr, 16, false);
+    REQUESTS_DUMP_APPEND(", tags data: ");
+    current += format_hex_u64(current, request->tags, 2, true);
+    REQUESTS_DUMP_APPEND(", tags known mask: ");
+    current += format_hex_u64(current, request->tags_known, 2, true);
+    REQUESTS_DUMP_APPEND(" ]\n");
+#undef REQUESTS_DUMP_APPEND
+
+    assert(current - dst <= REQUESTS_DUMP_MAX_LINE_SIZE);
+    return current - dst;
+}
+
+// TODO fix
+void trace_simulate_uncompressed(COMMAND_HANDLER_ARGS)
+{
+    requests_filter_t filter = requests_filter_from_args(&num_args, args);
+    char * skip_str = args_take_value(&num_args, args, "skip");
+    char * limit_str = args_take_value(&num_args, args, "limit");
+    bool count_only = args_take_flag(&num_args, args, "count");
+
+    if (num_args != 2)
+    {
+        printf("Usage: %s %s [--range=<start address>-<end address>] [--type=read|write] [--tags=<tags mask>] "
+            "[--skip=<number of requests>] [--limit=<number of requests>] [--count] "
+            "<LLC requests trace file> <initial state file>\n", exe_name, cmd_name);
+        quit();
+    }
+
+    // NOTE skip and limit count matching requests
+    u64 num_skip = skip_str ? u64_from_arg("number of requests to skip", skip_str, 10) : 0;
+    u64 limit = limit_str ? u64_from_arg("request limit", limit_str, 10) : UINT64_MAX;
+
+    char * requests_trace_filename = args[0];
+    // char * initial_state_filename = args[1];
+
+    // device_t * tag_controller = tag_cache_init(arena, initial_tags_filename, KILOBYTES(32), 4);
+
+    requests_reader_t tag_controller_requests = requests_reader_open(arena, requests_trace_filename);
+
+    // printf("Simulating with following configuration:\n");
+    // device_print_configuration(tag_controller);
+    // printf("\n");
+
+    tag_cache_request_t * batch = arena_push_array(arena, tag_cache_request_t, REQUESTS_BATCH_NUM_ENTRIES);
+    u32 * matches = arena_push_array(arena, u32, REQUESTS_BATCH_NUM_ENTRIES);
+
+    char * output = arena_push_array(arena, char, REQUESTS_DUMP_BUFFER_SIZE);
+    u64 output_size = 0;
+
+    u64 num_entries = 0;
+    u64 num_matches = 0;
+    u64 num_dumped = 0;
+
+    while (num_dumped < limit)
+    {
+        u64 batch_num_entries = requests_read_batch(&tag_controller_requests, batch);
+        if (batch_num_entries == 0) break;
+        num_entries += batch_num_entries;
+
+        for (u64 i = 0; i < batch_num_entries; i++)
+        {
+            tag_cache_request_t * current_entry = &batch[i];
+
+            assert(current_entry->size == CACHE_LINE_SIZE);
 
-            if (tag_set)
+            u64 paddr = current_entry->addr;
+            assert(check_paddr_valid(paddr));
+            assert(paddr % CACHE_LINE_SIZE == 0);
+            assert(paddr % CAP_SIZE_BYTES == 0);
+
+            // TODO support larger cache line sizes?
+            assert(current_entry->tags == (u8) current_entry->tags);
+            // b8 tags_cheri = current_entry->tags;
+            // b8 tags_known = current_entry->tags_known; // TODO again, makes no sense
+
+            switch (current_entry->type)
             {
-                assert(num_tags_in_page < UINT64_MAX);
-                num_tags_in_page++;
+                case TAG_CACHE_REQUEST_TYPE_READ:
+                {
+                    // TODO this makes no sense, fix
+                    // b8 tags_read, tags_known_read;
+                    // device_read(tag_controller, paddr, &tags_read, &tags_known_read);
+                    // assert(tags_read == tags_cheri);
+                } break;
+                case TAG_CACHE_REQUEST_TYPE_WRITE:
+                {
+                    // device_write(tag_controller, paddr, tags_cheri, tags_known);
+                } break;
+                default: assert(!"Impossible.");
             }
-            else
+        }
+
+        u64 batch_num_matches = requests_filter_batch(&filter, batch, batch_num_entries, matches);
+        num_matches += batch_num_matches;
+
+        for (u64 i = 0; i < batch_num_matches && num_dumped < limit; i++)
+        {
+            if (num_skip > 0)
             {
-                assert(num_tags_in_page > 0);
-                num_tags_in_page--;
+                num_skip--;
+                continue;
             }
+            num_dumped++;
 
-            if (num_tags_in_page == 0)
+            if (count_only) continue;
+
+            if (output_size + REQUESTS_DUMP_MAX_LINE_SIZE > REQUESTS_DUMP_BUFFER_SIZE)
             {
-                assert(!tag_set);
-                assert(stats->num_pages_tagged > 0);
-                stats->num_pages_tagged--;
+                fwrite(output, 1, output_size, stdout);
+                output_size = 0;
             }
+            output_size += requests_dump_format(&output[output_size], &batch[matches[i]]);
+        }
+    }
+
+    fwrite(output, 1, output_size, stdout);
+
+    if (count_only)
+    {
+        // NOTE with a limit, reading stops early so the totals only cover the requests read
+        printf("Matching requests: %lu\n", num_dumped);
+        printf("Total entries read: %lu (%lu matching before skip/limit)\n", num_entries, num_matches);
+    }
+
+    // printf("Statistics:\n");
+    // device_print_statistics(tag_controller);
+    // device_cleanup(tag_controller);
+    // printf("\n");
+
+    requests_reader_close(&tag_controller_requests);
+}
+
+
+typedef struct trace_requests_stats_t trace_requests_stats_t;
+struct trace_requests_stats_t
+{
+    bitset_t tagged_capabilities; // NOTE indexed like the initial state table, may be shared by shards
+    u16 * page_tag_counts; // NOTE indexed by page offset from the base paddr
+    distinct_counter_t accessed_pages;
+
+    u64 num_capabilities_tagged;
+    u64 num_lines_tagged;
+    u64 num_pages_tagged;
+};
+
+typedef struct trace_requests_counts_t trace_requests_counts_t;
+struct trace_requests_counts_t
+{
+    u64 num_capabilities_tagged;
+    u64 num_lines_tagged;
+    u64 num_pages_tagged;
+    u64 num_pages_accessed;
+};
+
+static trace_requests_stats_t requests_stats_create(arena_t * arena, distinct_counter_config_t counter_config,
+    bitset_t tagged_capabilities)
+{
+    trace_requests_stats_t stats = {0};
+
+    stats.tagged_capabilities = tagged_capabilities;
+    stats.page_tag_counts = arena_push_array(arena, u16, MEMORY_SIZE / PAGE_SIZE);
+    stats.accessed_pages = distinct_counter_create(arena, counter_config);
+
+    return stats;
+}
+
+static void requests_stats_cleanup(trace_requests_stats_t * stats)
+{
+    distinct_counter_cleanup(&stats->accessed_pages);
+}
+
+static trace_requests_counts_t requests_stats_get_counts(trace_requests_stats_t * stats)
+{
+    trace_requests_counts_t counts = {0};
+    counts.num_capabilities_tagged = stats->num_capabilities_tagged;
+    counts.num_lines_tagged = stats->num_lines_tagged;
+    counts.num_pages_tagged = stats->num_pages_tagged;
+    counts.num_pages_accessed = distinct_counter_count(&stats->accessed_pages);
+
+    return counts;
+}
+
+static void requests_counts_add(trace_requests_counts_t * counts, trace_requests_counts_t * other)
+{
+    counts->num_capabilities_tagged += other->num_capabilities_tagged;
+    counts->num_lines_tagged += other->num_lines_tagged;
+    counts->num_pages_tagged += other->num_pages_tagged;
+    counts->num_pages_accessed += other->num_pages_accessed;
+}
 
-            map_u64_set(stats->page_tag_counts, page_addr, num_tags_in_page);
+// NOTE accessed_pages is one of the counters, for noting approximate counts (the shards' sketches are merged, so the
+// standard error is that of a single sketch)
+static void requests_counts_print(trace_requests_counts_t * counts, distinct_counter_t * accessed_pages)
+{
+    printf("Statistics:\n");
+    printf(INDENT4 "Number of capabilities with tag set: %lu\n", counts->num_capabilities_tagged);
+    printf(INDENT4 "Number of cache lines containing tags: %lu\n", counts->num_lines_tagged);
+    printf(INDENT4 "Number of pages containing tags: %lu\n", counts->num_pages_tagged);
+    printf(INDENT4 "Number of pages accessed: %lu", counts->num_pages_accessed);
+    if (accessed_pages->mode == DISTINCT_COUNTER_APPROXIMATE)
+    {
+        printf(" (approximate, standard error %.2f%%)", 100 * distinct_counter_standard_error(accessed_pages));
+    }
+    printf("\n");
+}
+
+static char * requests_counts_column_names[] =
+{
+    "index",
+    "valid capabilities",
+    "cache lines containing tags",
+    "pages containing tags",
+    "pages accessed"
+};
+
+static series_writer_t requests_counts_series_open(arena_t * arena, u8 format, char * filename)
+{
+    return series_writer_open(arena, format, filename,
+        requests_counts_column_names, array_count(requests_counts_column_names));
+}
+
+static void requests_counts_write_row(series_writer_t * writer, u64 index, trace_requests_counts_t * counts)
+{
+    u64 values[] =
+    {
+        index,
+        counts->num_capabilities_tagged,
+        counts->num_lines_tagged,
+        counts->num_pages_tagged,
+        counts->num_pages_accessed
+    };
+    static_assert(array_count(values) == array_count(requests_counts_column_names), "Missing CSV column.");
+
+    series_writer_row(writer, values);
+}
+
+static void requests_stats_update_accessed_pages(trace_requests_stats_t * stats, u64 addr)
+{
+    distinct_counter_insert(&stats->accessed_pages, get_page_start(addr));
+}
+
+#define CAPS_PER_LINE   (CACHE_LINE_SIZE / CAP_SIZE_BYTES)
+static_assert(BITSET_WORD_BITS % CAPS_PER_LINE == 0, "Lines must not straddle bitset words.");
+static_assert(PAGE_SIZE / CAP_SIZE_BYTES <= UINT16_MAX, "Page tag counts must fit in 16 bits.");
+
+// NOTE sets the tags of num_caps capabilities (within one cache line) starting at addr, bit i of tags is capability i
+static void requests_stats_set_tags(trace_requests_stats_t * stats, u64 addr, u64 num_caps, u64 tags)
+{
+    assert(num_caps > 0 && num_caps <= CAPS_PER_LINE);
+
+    i64 table_idx = initial_state_get_index(addr);
+    i64 line_table_idx = initial_state_get_index(align_floor_pow_2(addr, CACHE_LINE_SIZE));
+    assert(table_idx + (i64) num_caps <= line_table_idx + (i64) CAPS_PER_LINE);
+
+    u64 * word = &stats->tagged_capabilities.words[table_idx / BITSET_WORD_BITS];
+    u64 caps_mask = (((u64) 1 << num_caps) - 1) << (table_idx % BITSET_WORD_BITS);
+    u64 line_mask = (((u64) 1 << CAPS_PER_LINE) - 1) << (line_table_idx % BITSET_WORD_BITS);
+
+    u64 old_word = *word;
+    u64 new_word = (old_word & ~caps_mask) | ((tags << (table_idx % BITSET_WORD_BITS)) & caps_mask);
+    if (new_word == old_word) return;
+
+    *word = new_word;
+
+    i64 delta = (i64) __builtin_popcountll(new_word & caps_mask) - (i64) __builtin_popcountll(old_word & caps_mask);
+    assert(delta >= 0 || stats->num_capabilities_tagged >= (u64) -delta);
+    stats->num_capabilities_tagged += delta;
+
+    bool line_was_tagged = (old_word & line_mask) != 0;
+    bool line_now_tagged = (new_word & line_mask) != 0;
+    if (!line_was_tagged && line_now_tagged) stats->num_lines_tagged++;
+    else if (line_was_tagged && !line_now_tagged)
+    {
+        assert(stats->num_lines_tagged > 0);
+        stats->num_lines_tagged--;
+    }
+
+    if (delta != 0)
+    {
+        u16 * num_tags_in_page = &stats->page_tag_counts[(addr - BASE_PADDR) >> PAGE_SIZE_BITS];
+        assert((i64) *num_tags_in_page + delta >= 0);
+
+        bool page_was_tagged = *num_tags_in_page != 0;
+        *num_tags_in_page += delta;
+        bool page_now_tagged = *num_tags_in_page != 0;
+
+        if (!page_was_tagged && page_now_tagged) stats->num_pages_tagged++;
+        else if (page_was_tagged && !page_now_tagged)
+        {
+            assert(stats->num_pages_tagged > 0);
+            stats->num_pages_tagged--;
+        }
+    }
+}
+
+// NOTE sets up the stats for the tags guessed from the initial state, for stats that have not been updated yet
+// (only for the pages in the given shard)
+static void requests_stats_init_tags(trace_requests_stats_t * stats, initial_access_t * initial_state_table,
+    bitset_t loaded_pages, u32 shard_idx, u32 num_shards)
+{
+    assert(stats->num_capabilities_tagged == 0);
+
+    static_assert(INITIAL_STATE_PAGE_ENTRIES % BITSET_WORD_BITS == 0, "Pages must be whole bitset words.");
+    static_assert(CACHE_LINE_SIZE / CAP_SIZE_BYTES == 4, "Counting tagged lines assumes 4 capabilities per line.");
+    u64 line_mask = 0x1111111111111111ULL; // NOTE bottom bit of every capability group making up a line
+
+    u64 num_table_pages = INITIAL_STATE_TABLE_SIZE / INITIAL_STATE_PAGE_ENTRIES;
+    for (u64 page_idx = 0; page_idx < num_table_pages; page_idx++)
+    {
+        // skip whole words of pages that were not in the initial state file
+        if (loaded_pages.words[page_idx / BITSET_WORD_BITS] == 0)
+        {
+            page_idx = align_floor_pow_2(page_idx, BITSET_WORD_BITS) + BITSET_WORD_BITS - 1;
+            continue;
+        }
+        if (!bitset_test(loaded_pages, page_idx)) continue;
+        if (page_idx % num_shards != shard_idx) continue;
+
+        u64 first_idx = page_idx * INITIAL_STATE_PAGE_ENTRIES;
+        u64 num_tags_in_page = 0;
+
+        for (u64 word_idx = first_idx; word_idx < first_idx + INITIAL_STATE_PAGE_ENTRIES; word_idx += BITSET_WORD_BITS)
+        {
+            u64 tags = initial_state_guess_tags_word(initial_state_table, word_idx);
+            if (tags == 0) continue;
+
+            stats->tagged_capabilities.words[word_idx / BITSET_WORD_BITS] = tags;
+
+            u64 lines = tags | (tags >> 1);
+            lines |= lines >> 2;
+            stats->num_lines_tagged += __builtin_popcountll(lines & line_mask);
+
+            num_tags_in_page += __builtin_popcountll(tags);
+        }
+
+        if (num_tags_in_page > 0)
+        {
+            stats->num_capabilities_tagged += num_tags_in_page;
+            stats->num_pages_tagged++;
+
+            stats->page_tag_counts[page_idx] = num_tags_in_page;
         }
     }
 }
 
-static bool guess_initial_tag(initial_access_t initial_access)
+static void requests_stats_update_request(trace_requests_stats_t * stats, tag_cache_request_t * request,
+    initial_access_t * initial_state_table)
 {
-    if (initial_access.type == CUSTOM_TRACE_TYPE_CLOAD || initial_access.type == CUSTOM_TRACE_TYPE_CSTORE)
+    u64 line_size = request->size;
+    assert(line_size % CAP_SIZE_BYTES == 0);
+    assert(line_size == CACHE_LINE_SIZE); // TODO error instead
+
+    u64 start_paddr = request->addr;
+    u64 final_paddr = request->addr + line_size;
+
+    assert(start_paddr % CAP_SIZE_BYTES == 0);
+    assert(final_paddr % CAP_SIZE_BYTES == 0);
+    assert(final_paddr > start_paddr);
+    assert(check_paddr_valid(start_paddr) && check_paddr_valid(final_paddr - CAP_SIZE_BYTES));
+
+    // NOTE requests are at most a cache line, and are not expected to cross pages (shards assume this too)
+    assert(get_page_start(start_paddr) == get_page_start(final_paddr - 1)); // TODO error instead
+    requests_stats_update_accessed_pages(stats, start_paddr);
+
+    u64 num_caps = line_size / CAP_SIZE_BYTES;
+    u64 all_caps = ((u64) 1 << num_caps) - 1;
+
+    u64 tags = request->tags & request->tags_known;
+    if ((request->tags_known & all_caps) != all_caps)
     {
-        if (initial_access.tag)
+        for (u64 i = 0; i < num_caps; i++)
         {
-            return true;
+            if (((1 << i) & request->tags_known) != 0) continue;
+
+            u64 paddr = start_paddr + i * CAP_SIZE_BYTES;
+            tags |= (u64) initial_access_guess_tag(initial_state_table[initial_state_get_index(paddr)]) << i;
         }
     }
 
-    // memory accessed initially by LOADs, STOREs, INSTRs are assumed to not have tags before
-    return false;
+    if (start_paddr % CACHE_LINE_SIZE == 0)
+    {
+        requests_stats_set_tags(stats, start_paddr, num_caps, tags);
+    }
+    else
+    {
+        // NOTE unaligned requests are split at the cache line boundary
+        u64 num_first_caps = (align_ceil_pow_2(start_paddr, CACHE_LINE_SIZE) - start_paddr) / CAP_SIZE_BYTES;
+        requests_stats_set_tags(stats, start_paddr, num_first_caps, tags);
+        requests_stats_set_tags(stats, start_paddr + num_first_caps * CAP_SIZE_BYTES, num_caps - num_first_caps,
+            tags >> num_first_caps);
+    }
 }
 
-void trace_requests_get_info(COMMAND_HANDLER_ARGS)
+
+/*
+The request stats split up by physical page, so they can be updated on several threads without any locking.
+- Each shard owns the pages whose index is shard_idx modulo the number of shards (interleaved for balance), and
+  since requests never cross a cache line, every request belongs to exactly one shard.
+- The main thread decodes batches of requests, and every shard goes over the whole batch (updating only its own
+  pages) while the next batch is being decoded.
+- The counts of the shards are disjoint, so the totals (and the CSV rows) are just their sums.
+*/
+
+typedef struct requests_shards_t requests_shards_t;
+
+typedef struct requests_shard_t requests_shard_t;
+struct requests_shard_t
 {
-    if (num_args != 2)
+    requests_shards_t * shards;
+    u32 shard_idx;
+    trace_requests_stats_t stats;
+    trace_requests_counts_t * rows; // NOTE counts after each entry of the current batch that gets a CSV row
+    u64 num_rows;
+    pthread_t thread;
+};
+
+struct requests_shards_t
+{
+    requests_shard_t * shards;
+    u32 num_shards;
+    initial_access_t * initial_state_table;
+    u64 row_interval; // NOTE 0 for no rows
+
+    tag_cache_request_t * batch;
+    u64 batch_num_entries;
+    u64 batch_first_index;
+
+    pthread_barrier_t batch_start;
+    pthread_barrier_t batch_done;
+};
+
+static inline u32 requests_get_shard(u64 addr, u32 num_shards)
+{
+    return ((addr - BASE_PADDR) >> PAGE_SIZE_BITS) % num_shards;
+}
+
+static requests_shards_t requests_shards_create(arena_t * arena, u32 num_shards, distinct_counter_config_t counter_config,
+    initial_access_t * initial_state_table, bitset_t loaded_pages, u64 row_interval)
+{
+    assert(num_shards > 0);
+
+    // NOTE the shards split one counter, so they split its memory budget (using fewer shards if it does not go round)
+    if (counter_config.mode == DISTINCT_COUNTER_EXTERNAL)
     {
-        printf("Usage: %s %s <LLC requests trace file> <initial state file>\n", exe_name, cmd_name);
-        quit();
+        u64 max_shards = counter_config.memory_budget / EXTERNAL_SET_MIN_MEMORY;
+        if (num_shards > max_shards) num_shards = max_shards;
+        counter_config.memory_budget /= num_shards;
     }
 
-    char * requests_trace_filename = args[0];
-    char * initial_state_filename = args[1];
+    requests_shards_t shards = {0};
+    shards.shards = arena_push_array(arena, requests_shard_t, num_shards);
+    shards.num_shards = num_shards;
+    shards.initial_state_table = initial_state_table;
+    shards.row_interval = row_interval;
+
+    // NOTE pages (and so bitset words) are never shared between shards
+    static_assert(INITIAL_STATE_PAGE_ENTRIES % BITSET_WORD_BITS == 0, "Pages must be whole bitset words.");
+    bitset_t tagged_capabilities = bitset_create(arena, INITIAL_STATE_TABLE_SIZE);
 
-    trace_reader_t tag_controller_requests =
-        trace_reader_open(arena, requests_trace_filename, guess_reader_type(requests_trace_filename));
+    for (u32 i = 0; i < num_shards; i++)
+    {
+        requests_shard_t * shard = &shards.shards[i];
+        shard->shard_idx = i;
+        shard->stats = requests_stats_create(arena, counter_config, tagged_capabilities);
+        if (row_interval > 0) shard->rows = arena_push_array(arena, trace_requests_counts_t, REQUESTS_BATCH_NUM_ENTRIES);
+
+        requests_stats_init_tags(&shard->stats, initial_state_table, loaded_pages, i, num_shards);
+    }
 
-    FILE * initial_state_file = fopen(initial_state_filename, "rb");
+    return shards;
+}
 
-    trace_requests_stats_t stats = requests_stats_create();
+static void requests_shards_cleanup(requests_shards_t * shards)
+{
+    for (u32 i = 0; i < shards->num_shards; i++)
+    {
+        requests_stats_cleanup(&shards->shards[i].stats);
+    }
+}
 
-    i64 initial_state_table_size = MEMORY_SIZE / CAP_SIZE_BYTES;
-    initial_access_t * initial_state_table = arena_push_array(arena, initial_access_t, initial_state_table_size);
-    for (i64 i = 0; i < initial_state_table_size; i++)
+static trace_requests_counts_t requests_shards_get_counts(requests_shards_t * shards)
+{
+    trace_requests_counts_t counts = {0};
+    for (u32 i = 0; i < shards->num_shards; i++)
     {
-        initial_access_t current;
-        size_t bytes_read = fread(&current, sizeof(current), 1, initial_state_file);
-        assert(bytes_read == sizeof(current));
+        trace_requests_counts_t shard_counts = requests_stats_get_counts(&shards->shards[i].stats);
+        requests_counts_add(&counts, &shard_counts);
+    }
 
-        initial_state_table[i] = current;
+    // NOTE the shards count disjoint sets of pages, so merging their sketches gives a sketch of every accessed page,
+    // with the usual standard error (summing the estimates would add up their errors instead)
+    if (shards->shards[0].stats.accessed_pages.mode == DISTINCT_COUNTER_APPROXIMATE && shards->num_shards > 1)
+    {
+        arena_temp_t scratch = arena_temp_begin(arena_get_scratch(NULL));
 
-        u64 paddr = i * CAP_SIZE_BYTES + BASE_PADDR;
-        assert(check_paddr_valid(paddr));
+        hll_t accessed_pages = hll_create(scratch.arena);
+        for (u32 i = 0; i < shards->num_shards; i++)
+        {
+            hll_merge(accessed_pages, shards->shards[i].stats.accessed_pages.hll);
+        }
+        counts.num_pages_accessed = hll_estimate(accessed_pages);
 
-        requests_stats_update_tag(&stats, paddr, guess_initial_tag(current));
+        arena_temp_end(scratch);
     }
 
-    requests_stats_print(&stats);
+    return counts;
+}
 
-    // TODO more stats
-    u64 total_entries = 0;
+static void requests_shard_process_batch(requests_shard_t * shard)
+{
+    requests_shards_t * shards = shard->shards;
+
+    shard->num_rows = 0;
+    for (u64 i = 0; i < shards->batch_num_entries; i++)
+    {
+        tag_cache_request_t * request = &shards->batch[i];
+        if (requests_get_shard(request->addr, shards->num_shards) == shard->shard_idx)
+        {
+            requests_stats_update_request(&shard->stats, request, shards->initial_state_table);
+        }
+
+        u64 entry_index = shards->batch_first_index + i;
+        if (shards->row_interval > 0 && entry_index % shards->row_interval == 0)
+        {
+            shard->rows[shard->num_rows++] = requests_stats_get_counts(&shard->stats);
+        }
+    }
+}
+
+static void * requests_shard_worker(void * data)
+{
+    requests_shard_t * shard = (requests_shard_t *) data;
+    requests_shards_t * shards = shard->shards;
 
     while (true)
     {
-        tag_cache_request_t current_entry;
-        if (!trace_reader_get(&tag_controller_requests, &current_entry, sizeof(current_entry))) break;
+        pthread_barrier_wait(&shards->batch_start);
+        if (shards->batch_num_entries == 0) break;
 
-        total_entries++;
+        requests_shard_process_batch(shard);
 
-        u64 line_size = current_entry.size;
-        assert(line_size % CAP_SIZE_BYTES == 0);
-        assert(line_size == CACHE_LINE_SIZE); // TODO error instead
+        pthread_barrier_wait(&shards->batch_done);
+    }
 
-        u64 start_paddr = current_entry.addr;
-        u64 final_paddr = current_entry.addr + line_size;
+    arena_release_scratch();
 
-        assert(start_paddr % CAP_SIZE_BYTES == 0);
-        assert(final_paddr % CAP_SIZE_BYTES == 0);
-        assert(final_paddr > start_paddr);
+    return NULL;
+}
 
-        uint16_t i = 0;
-        for (u64 paddr = start_paddr; paddr < final_paddr; paddr += CAP_SIZE_BYTES, i++)
+// NOTE writes the rows (if there is a row interval) as they are completed, returns the number of entries
+static u64 requests_shards_run(arena_t * arena, requests_shards_t * shards, requests_reader_t * reader,
+    series_writer_t * rows)
+{
+    bool threaded = shards->num_shards > 1;
+
+    tag_cache_request_t * batches[2];
+    batches[0] = arena_push_array(arena, tag_cache_request_t, REQUESTS_BATCH_NUM_ENTRIES);
+    batches[1] = arena_push_array(arena, tag_cache_request_t, REQUESTS_BATCH_NUM_ENTRIES);
+
+    if (threaded)
+    {
+        pthread_barrier_init(&shards->batch_start, NULL, shards->num_shards + 1);
+        pthread_barrier_init(&shards->batch_done, NULL, shards->num_shards + 1);
+
+        for (u32 i = 0; i < shards->num_shards; i++)
         {
-            assert(i < UINT16_MAX);
-            assert(i < line_size / CAP_SIZE_BYTES);
+            requests_shard_t * shard = &shards->shards[i];
+            shard->shards = shards;
 
-            assert(check_paddr_valid(paddr));
+            int result = pthread_create(&shard->thread, NULL, requests_shard_worker, shard);
+            assert(result == 0);
+        }
+    }
+    else
+    {
+        shards->shards[0].shards = shards;
+    }
 
-            bool tag_set;
-            if (((1 << i) & current_entry.tags_known) != 0)
-            {
-                tag_set = ((1 << i) & current_entry.tags) != 0;
-            }
-            else
+    u32 current_batch = 0;
+    u64 num_entries = requests_read_batch(reader, batches[current_batch]);
+    u64 first_index = 0;
+
+    while (true)
+    {
+        shards->batch = batches[current_batch];
+        shards->batch_num_entries = num_entries;
+        shards->batch_first_index = first_index;
+
+        u64 next_num_entries;
+        if (threaded)
+        {
+            // NOTE workers quit on an empty batch
+            pthread_barrier_wait(&shards->batch_start);
+            if (num_entries == 0) break;
+
+            next_num_entries = requests_read_batch(reader, batches[current_batch ^ 1]);
+
+            pthread_barrier_wait(&shards->batch_done);
+        }
+        else
+        {
+            if (num_entries == 0) break;
+
+            requests_shard_process_batch(&shards->shards[0]);
+
+            next_num_entries = requests_read_batch(reader, batches[current_batch ^ 1]);
+        }
+
+        if (shards->row_interval > 0)
+        {
+            u64 first_row_index = (first_index + shards->row_interval - 1) / shards->row_interval * shards->row_interval;
+            for (u64 row = 0; row < shards->shards[0].num_rows; row++)
             {
-                u64 mem_offset = paddr - BASE_PADDR;
-                assert(mem_offset % CAP_SIZE_BYTES == 0);
-                i64 table_idx = mem_offset / CAP_SIZE_BYTES;
-                assert(table_idx >= 0 && table_idx < initial_state_table_size);
+                trace_requests_counts_t counts = {0};
+                for (u32 i = 0; i < shards->num_shards; i++)
+                {
+                    assert(shards->shards[i].num_rows == shards->shards[0].num_rows);
+                    requests_counts_add(&counts, &shards->shards[i].rows[row]);
+                }
 
-                tag_set = guess_initial_tag(initial_state_table[table_idx]);
+                requests_counts_write_row(rows, first_row_index + row * shards->row_interval, &counts);
             }
-            requests_stats_update_accessed_pages(&stats, paddr);
-            requests_stats_update_tag(&stats, paddr, tag_set);
         }
+
+        first_index += num_entries;
+        num_entries = next_num_entries;
+        current_batch ^= 1;
+    }
+
+    if (threaded)
+    {
+        for (u32 i = 0; i < shards->num_shards; i++)
+        {
+            pthread_join(shards->shards[i].thread, NULL);
+        }
+
+        pthread_barrier_destroy(&shards->batch_start);
+        pthread_barrier_destroy(&shards->batch_done);
+    }
+
+    return first_index;
+}
+
+void trace_requests_get_info(COMMAND_HANDLER_ARGS)
+{
+    distinct_counter_config_t counter_config = distinct_counter_config_from_args(&num_args, args);
+    u32 num_threads = num_threads_from_args(&num_args, args);
+
+    if (num_args != 2)
+    {
+        printf("Usage: %s %s " DISTINCT_COUNTER_USAGE " " THREADS_USAGE " <LLC requests trace file> <initial state file>\n",
+            exe_name, cmd_name);
+        quit();
     }
 
+    char * requests_trace_filename = args[0];
+    char * initial_state_filename = args[1];
+
+    bitset_t loaded_pages;
+    initial_access_t * initial_state_table = initial_state_load(arena, initial_state_filename, &loaded_pages);
+
+    requests_shards_t shards =
+        requests_shards_create(arena, num_threads, counter_config, initial_state_table, loaded_pages, 0);
+
+    requests_reader_t tag_controller_requests = requests_reader_open(arena, requests_trace_filename);
+
+    trace_requests_counts_t counts = requests_shards_get_counts(&shards);
+    requests_counts_print(&counts, &shards.shards[0].stats.accessed_pages);
+
+    // TODO more stats
+    u64 total_entries = requests_shards_run(arena, &shards, &tag_controller_requests, NULL);
+
     printf("\n");
 
-    requests_stats_print(&stats);
+    counts = requests_shards_get_counts(&shards);
+    requests_counts_print(&counts, &shards.shards[0].stats.accessed_pages);
 
     printf("\n");
 
     printf("Total entries: %lu\n", total_entries);
 
-    trace_reader_close(&tag_controller_requests);
-    requests_stats_cleanup(&stats);
+    requests_reader_close(&tag_controller_requests);
+    requests_shards_cleanup(&shards);
 }
 
 void trace_requests_make_tag_csv(COMMAND_HANDLER_ARGS)
 {
+    u32 num_threads = num_threads_from_args(&num_args, args);
+    char * binary_filename = args_take_value(&num_args, args, "binary");
+
     if (num_args != 3)
     {
-        printf("Usage: %s %s <LLC requests trace file> <initial state file> <interval between entries>\n", exe_name, cmd_name);
+        printf("Usage: %s %s " THREADS_USAGE " [--binary=<output file>] "
+            "<LLC requests trace file> <initial state file> <interval between entries>\n", exe_name, cmd_name);
         quit();
     }
 
+    if (binary_filename && file_exists_not_fifo(binary_filename))
+    {
+        if (!confirm_overwrite_file(binary_filename)) quit();
+    }
+
     char * requests_trace_filename = args[0];
     char * initial_state_filename = args[1];
     char * print_interval_str = args[2];
@@ -1364,38 +2609,146 @@ void trace_requests_make_tag_csv(COMMAND_HANDLER_ARGS)
     }
     assert(print_interval >= 1);
 
-    trace_reader_t tag_controller_requests =
-        trace_reader_open(arena, requests_trace_filename, guess_reader_type(requests_trace_filename));
+    distinct_counter_config_t counter_config = { DISTINCT_COUNTER_EXACT };
+
+    bitset_t loaded_pages;
+    initial_access_t * initial_state_table = initial_state_load(arena, initial_state_filename, &loaded_pages);
+
+    requests_shards_t shards =
+        requests_shards_create(arena, num_threads, counter_config, initial_state_table, loaded_pages, print_interval);
+
+    requests_reader_t tag_controller_requests = requests_reader_open(arena, requests_trace_filename);
+
+    // NOTE same rows either way, the binary file is for reading full resolution series without parsing text
+    u8 format = binary_filename ? SERIES_FORMAT_BINARY : SERIES_FORMAT_CSV;
+    series_writer_t rows = requests_counts_series_open(arena, format, binary_filename);
+
+    u64 entry_index = requests_shards_run(arena, &shards, &tag_controller_requests, &rows);
 
-    FILE * initial_state_file = fopen(initial_state_filename, "rb");
+    trace_requests_counts_t counts = requests_shards_get_counts(&shards);
+    requests_counts_write_row(&rows, entry_index, &counts);
 
-    trace_requests_stats_t stats = requests_stats_create();
+    series_writer_close(&rows);
+    requests_reader_close(&tag_controller_requests);
+    requests_shards_cleanup(&shards);
+}
+
+#define TAG_DENSITY_DEFAULT_GRANULARITIES "64,512,4096,65536"
+
+static u32 tag_density_granularities_from_args(int * num_args, char ** args, u64 * region_sizes)
+{
+    char * granularities_str = args_take_value(num_args, args, "granularities");
+    if (!granularities_str) granularities_str = TAG_DENSITY_DEFAULT_GRANULARITIES;
 
-    i64 initial_state_table_size = MEMORY_SIZE / CAP_SIZE_BYTES;
-    initial_access_t * initial_state_table = arena_push_array(arena, initial_access_t, initial_state_table_size);
-    for (i64 i = 0; i < initial_state_table_size; i++)
+    u32 num_region_sizes = 0;
+    char * str = granularities_str;
+    while (true)
     {
-        initial_access_t current;
-        size_t bytes_read = fread(&current, sizeof(current), 1, initial_state_file);
-        assert(bytes_read == sizeof(current));
+        char * endptr;
+        i64 value = strtoll(str, &endptr, 10);
+
+        bool valid = endptr != str && (*endptr == ',' || *endptr == '\0')
+            && value >= CAP_SIZE_BYTES && value <= MEMORY_SIZE && (value & (value - 1)) == 0
+            && num_region_sizes < TAG_DENSITY_MAX_GRANULARITIES;
+        if (!valid)
+        {
+            printf("ERROR: invalid region sizes \"%s\" (expected up to %d powers of two from %d to %lu bytes, separated by commas).\n",
+                granularities_str, TAG_DENSITY_MAX_GRANULARITIES, CAP_SIZE_BYTES, (u64) MEMORY_SIZE);
+            quit();
+        }
+
+        region_sizes[num_region_sizes++] = value;
+
+        if (*endptr == '\0') break;
+        str = endptr + 1;
+    }
 
-        initial_state_table[i] = current;
+    return num_region_sizes;
+}
 
-        u64 paddr = i * CAP_SIZE_BYTES + BASE_PADDR;
-        assert(check_paddr_valid(paddr));
+static void tag_density_init_tags(tag_density_t * density, initial_access_t * initial_state_table, bitset_t loaded_pages)
+{
+    u64 num_table_pages = INITIAL_STATE_TABLE_SIZE / INITIAL_STATE_PAGE_ENTRIES;
+    for (u64 page_idx = 0; page_idx < num_table_pages; page_idx++)
+    {
+        if (!bitset_test(loaded_pages, page_idx)) continue;
 
-        requests_stats_update_tag(&stats, paddr, guess_initial_tag(current));
+        u64 first_idx = page_idx * INITIAL_STATE_PAGE_ENTRIES;
+        for (u64 word_idx = first_idx; word_idx < first_idx + INITIAL_STATE_PAGE_ENTRIES; word_idx += BITSET_WORD_BITS)
+        {
+            density->tagged_capabilities.words[word_idx / BITSET_WORD_BITS] =
+                initial_state_guess_tags_word(initial_state_table, word_idx);
+        }
     }
 
-    i64 interval_counter = 0;
-    requests_stats_print_csv_header();
+    tag_density_recount(density);
+}
+
+static void tag_density_print_csv_header(tag_density_t * density)
+{
+    printf("index,valid capabilities");
+    for (u32 i = 0; i < density->num_levels; i++)
+    {
+        u64 region_size = density->levels[i].region_size;
+        printf(",%lu byte regions containing tags,%lu byte regions containing tags (fraction)", region_size, region_size);
+    }
+    printf("\n");
+}
+
+static void tag_density_print_csv(u64 index, tag_density_t * density)
+{
+    printf("%lu,%lu", index, density->num_capabilities_tagged);
+    for (u32 i = 0; i < density->num_levels; i++)
+    {
+        tag_density_level_t * level = &density->levels[i];
+        printf(",%lu,%f", level->num_regions_tagged, (f64) level->num_regions_tagged / level->num_regions);
+    }
+    printf("\n");
+}
+
+void trace_requests_tag_density(COMMAND_HANDLER_ARGS)
+{
+    u64 region_sizes[TAG_DENSITY_MAX_GRANULARITIES];
+    u32 num_region_sizes = tag_density_granularities_from_args(&num_args, args, region_sizes);
+
+    if (num_args != 3)
+    {
+        printf("Usage: %s %s [--granularities=<region size in bytes>,...] "
+            "<LLC requests trace file> <initial state file> <interval between entries>\n", exe_name, cmd_name);
+        quit();
+    }
+
+    char * requests_trace_filename = args[0];
+    char * initial_state_filename = args[1];
+    char * print_interval_str = args[2];
+
+    i64 print_interval;
+    {
+        char * endptr;
+        print_interval = strtoll(print_interval_str, &endptr, 10);
+        if (*endptr != '\0' || print_interval < 1)
+        {
+            printf("ERROR: invalid interval \"%s\".\n", print_interval_str);
+            quit();
+        }
+    }
+
+    tag_density_t density = tag_density_create(arena, region_sizes, num_region_sizes);
+
+    bitset_t loaded_pages;
+    initial_access_t * initial_state_table = initial_state_load(arena, initial_state_filename, &loaded_pages);
+    tag_density_init_tags(&density, initial_state_table, loaded_pages);
+
+    requests_reader_t tag_controller_requests = requests_reader_open(arena, requests_trace_filename);
+
+    tag_density_print_csv_header(&density);
 
     u64 entry_index = 0;
 
     while (true)
     {
         tag_cache_request_t current_entry;
-        if (!trace_reader_get(&tag_controller_requests, &current_entry, sizeof(current_entry))) break;
+        if (!requests_reader_get(&tag_controller_requests, &current_entry)) break;
 
         u64 line_size = current_entry.size;
         assert(line_size % CAP_SIZE_BYTES == 0);
@@ -1405,15 +2758,11 @@ void trace_requests_make_tag_csv(COMMAND_HANDLER_ARGS)
         u64 final_paddr = current_entry.addr + line_size;
 
         assert(start_paddr % CAP_SIZE_BYTES == 0);
-        assert(final_paddr % CAP_SIZE_BYTES == 0);
         assert(final_paddr > start_paddr);
 
         uint16_t i = 0;
         for (u64 paddr = start_paddr; paddr < final_paddr; paddr += CAP_SIZE_BYTES, i++)
         {
-            assert(i < UINT16_MAX);
-            assert(i < line_size / CAP_SIZE_BYTES);
-
             assert(check_paddr_valid(paddr));
 
             bool tag_set;
@@ -1423,31 +2772,21 @@ void trace_requests_make_tag_csv(COMMAND_HANDLER_ARGS)
             }
             else
             {
-                u64 mem_offset = paddr - BASE_PADDR;
-                assert(mem_offset % CAP_SIZE_BYTES == 0);
-                i64 table_idx = mem_offset / CAP_SIZE_BYTES;
-                assert(table_idx >= 0 && table_idx < initial_state_table_size);
-
-                tag_set = guess_initial_tag(initial_state_table[table_idx]);
+                tag_set = initial_access_guess_tag(initial_state_table[initial_state_get_index(paddr)]);
             }
-            requests_stats_update_accessed_pages(&stats, paddr);
-            requests_stats_update_tag(&stats, paddr, tag_set);
+            tag_density_update(&density, paddr, tag_set);
         }
 
-        if (interval_counter == 0)
+        // NOTE same rows as requests-tag-csv
+        if (entry_index % print_interval == 0)
         {
-            requests_stats_print_csv(entry_index, &stats);
+            tag_density_print_csv(entry_index, &density);
         }
-        assert(interval_counter < INT64_MAX);
-        interval_counter++;
-        if (interval_counter >= print_interval)
-            interval_counter = 0;
 
         entry_index++;
     }
 
-    requests_stats_print_csv(entry_index, &stats);
+    tag_density_print_csv(entry_index, &density);
 
-    trace_reader_close(&tag_controller_requests);
-    requests_stats_cleanup(&stats);
+    requests_reader_close(&tag_controller_requests);
 }
@@ -0,0 +1,344 @@
+#include "jdp.h"
+#include "common.h"
+#include "utils.h"
+#include "trace.h"
+#include "initial_state.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if defined(__SSE2__)
+ #include <emmintrin.h>
+#endif
+
+#define INITIAL_STATE_RECORD_SIZE       (sizeof(u64) + INITIAL_STATE_PAGE_ENTRIES * sizeof(initial_access_t))
+#define INITIAL_STATE_BUFFER_RECORDS    4096
+
+static_assert(sizeof(initial_access_t) == 1, "Expect initial access record type to be a single byte.");
+static_assert(INITIAL_STATE_PAGE_ENTRIES % sizeof(u64) == 0, "Pages are checked for accesses a word at a time.");
+static_assert(MEMORY_SIZE % PAGE_SIZE == 0, "Memory size must be a whole number of pages.");
+static_assert(INITIAL_STATE_TABLE_SIZE * sizeof(initial_access_t) >= sizeof(initial_state_header_t),
+    "Dense files must be larger than a header.");
+
+
+static bool page_untouched(initial_access_t * page_entries)
+{
+    u64 * page_words = (u64 *) page_entries;
+    for (u64 i = 0; i < INITIAL_STATE_PAGE_ENTRIES / sizeof(u64); i++)
+    {
+        if (page_words[i] != 0) return false;
+    }
+
+    return true;
+}
+
+// NOTE version 1 / dense entries have the type without the offset (bottom 7 bits) and the tag (top bit)
+static void convert_unbiased_entries(initial_access_t * entries, u64 count)
+{
+    u8 * bytes = (u8 *) entries;
+    for (u64 i = 0; i < count; i++)
+    {
+        bytes[i] = ((bytes[i] + 1) & 0x7F) | (bytes[i] & 0x80);
+    }
+}
+
+void initial_state_write(arena_t * arena, char * filename, initial_access_t * table)
+{
+    FILE * file = fopen(filename, "wb");
+    if (!file)
+    {
+        printf("ERROR: could not open initial state file \"%s\" for writing.\n", filename);
+        quit();
+    }
+
+    u64 num_table_pages = INITIAL_STATE_TABLE_SIZE / INITIAL_STATE_PAGE_ENTRIES;
+
+    initial_state_header_t header = {0};
+    for (i64 i = 0; i < INITIAL_STATE_MAGIC_SIZE && INITIAL_STATE_MAGIC[i] != '\0'; i++)
+    {
+        header.magic[i] = INITIAL_STATE_MAGIC[i];
+    }
+    header.version = INITIAL_STATE_VERSION;
+    header.cap_size_bytes = CAP_SIZE_BYTES;
+    header.base_paddr = BASE_PADDR;
+    header.memory_size = MEMORY_SIZE;
+    header.page_size = PAGE_SIZE;
+
+    for (u64 page_idx = 0; page_idx < num_table_pages; page_idx++)
+    {
+        if (!page_untouched(&table[page_idx * INITIAL_STATE_PAGE_ENTRIES])) header.num_pages++;
+    }
+
+    size_t items_written = fwrite(&header, sizeof(header), 1, file);
+    assert(items_written == 1);
+
+    arena_temp_t scratch = arena_temp_begin(arena_get_scratch(arena));
+
+    u64 buffer_capacity = INITIAL_STATE_BUFFER_RECORDS * INITIAL_STATE_RECORD_SIZE;
+    u8 * buffer = arena_push_array(scratch.arena, u8, buffer_capacity);
+    u64 buffer_size = 0;
+
+    for (u64 page_idx = 0; page_idx < num_table_pages; page_idx++)
+    {
+        initial_access_t * page_entries = &table[page_idx * INITIAL_STATE_PAGE_ENTRIES];
+        if (page_untouched(page_entries)) continue;
+
+        if (buffer_size + INITIAL_STATE_RECORD_SIZE > buffer_capacity)
+        {
+            items_written = fwrite(buffer, buffer_size, 1, file);
+            assert(items_written == 1);
+            buffer_size = 0;
+        }
+
+        u8 * record = &buffer[buffer_size];
+        *(u64 *) record = page_idx;
+        for (i64 i = 0; i < INITIAL_STATE_PAGE_ENTRIES; i++)
+        {
+            record[sizeof(u64) + i] = *(u8 *) &page_entries[i];
+        }
+        buffer_size += INITIAL_STATE_RECORD_SIZE;
+    }
+
+    if (buffer_size > 0)
+    {
+        items_written = fwrite(buffer, buffer_size, 1, file);
+        assert(items_written == 1);
+    }
+
+    arena_temp_end(scratch);
+
+    fclose(file);
+}
+
+static bool initial_state_magic_matches(initial_state_header_t * header)
+{
+    for (u64 i = 0; i < INITIAL_STATE_MAGIC_SIZE; i++)
+    {
+        char expected = i < sizeof(INITIAL_STATE_MAGIC) ? INITIAL_STATE_MAGIC[i] : '\0';
+        if (header->magic[i] != expected) return false;
+    }
+
+    return true;
+}
+
+static void initial_state_check_header(char * filename, initial_state_header_t * header)
+{
+    if ((header->version != INITIAL_STATE_VERSION && header->version != 1)
+        || header->cap_size_bytes != CAP_SIZE_BYTES
+        || header->page_size != PAGE_SIZE
+        || header->base_paddr != BASE_PADDR
+        || header->memory_size > MEMORY_SIZE)
+    {
+        printf("ERROR: initial state file \"%s\" does not match the memory configuration "
+            "(version %u, capability size %u, page size %lu, base paddr " FMT_ADDR ", memory size %lu).\n",
+            filename, header->version, header->cap_size_bytes, header->page_size, header->base_paddr, header->memory_size);
+        quit();
+    }
+}
+
+static void initial_state_load_record(char * filename, u8 * record, u64 num_table_pages, u32 version,
+    initial_access_t * table, bitset_t * loaded_pages)
+{
+    u64 page_idx;
+    memcpy(&page_idx, record, sizeof(page_idx));
+    if (page_idx >= num_table_pages)
+    {
+        printf("ERROR: initial state file \"%s\" contains an out of range page (%lu).\n", filename, page_idx);
+        quit();
+    }
+
+    initial_access_t * page_entries = &table[page_idx * INITIAL_STATE_PAGE_ENTRIES];
+    memcpy(page_entries, record + sizeof(u64), INITIAL_STATE_PAGE_ENTRIES * sizeof(initial_access_t));
+    if (version == 1) convert_unbiased_entries(page_entries, INITIAL_STATE_PAGE_ENTRIES);
+
+    if (loaded_pages) bitset_set(*loaded_pages, page_idx);
+}
+
+static void initial_state_load_dense(char * filename, u64 file_size, initial_access_t * table, bitset_t * loaded_pages)
+{
+    if (file_size != INITIAL_STATE_TABLE_SIZE * sizeof(initial_access_t))
+    {
+        printf("ERROR: \"%s\" is not an initial state file (unrecognised header, unexpected size %lu).\n",
+            filename, file_size);
+        quit();
+    }
+
+    convert_unbiased_entries(table, INITIAL_STATE_TABLE_SIZE);
+
+    u64 num_table_pages = INITIAL_STATE_TABLE_SIZE / INITIAL_STATE_PAGE_ENTRIES;
+    if (loaded_pages) bitset_assign_range(*loaded_pages, 0, num_table_pages, true);
+}
+
+// NOTE the whole file is validated up front, then page records are copied straight out of the mapping
+static void initial_state_load_mapped(char * filename, u8 * data, u64 file_size,
+    initial_access_t * table, bitset_t * loaded_pages)
+{
+    initial_state_header_t header = {0};
+    if (file_size >= sizeof(header)) memcpy(&header, data, sizeof(header));
+
+    if (file_size >= sizeof(header) && initial_state_magic_matches(&header))
+    {
+        initial_state_check_header(filename, &header);
+
+        u64 num_table_pages = header.memory_size / PAGE_SIZE;
+        u64 expected_size = sizeof(header) + header.num_pages * INITIAL_STATE_RECORD_SIZE;
+        if (header.num_pages > num_table_pages || file_size != expected_size)
+        {
+            printf("ERROR: initial state file \"%s\" has an unexpected size (%lu bytes for %lu pages).\n",
+                filename, file_size, header.num_pages);
+            quit();
+        }
+
+        u8 * records = data + sizeof(header);
+        for (u64 record_idx = 0; record_idx < header.num_pages; record_idx++)
+        {
+            initial_state_load_record(filename, &records[record_idx * INITIAL_STATE_RECORD_SIZE], num_table_pages,
+                header.version, table, loaded_pages);
+        }
+    }
+    else
+    {
+        // NOTE old dense format, one entry per capability-aligned address in memory
+        if (file_size == INITIAL_STATE_TABLE_SIZE * sizeof(initial_access_t))
+        {
+            memcpy(table, data, INITIAL_STATE_TABLE_SIZE * sizeof(initial_access_t));
+        }
+        initial_state_load_dense(filename, file_size, table, loaded_pages);
+    }
+}
+
+static void initial_state_load_stream(arena_t * arena, FILE * file, char * filename,
+    initial_access_t * table, bitset_t * loaded_pages)
+{
+    initial_state_header_t header = {0};
+    size_t header_size = fread(&header, 1, sizeof(header), file);
+
+    if (header_size == sizeof(header) && initial_state_magic_matches(&header))
+    {
+        initial_state_check_header(filename, &header);
+
+        u64 num_table_pages = header.memory_size / PAGE_SIZE;
+        arena_temp_t scratch = arena_temp_begin(arena_get_scratch(arena));
+        u8 * buffer = arena_push_array(scratch.arena, u8, INITIAL_STATE_BUFFER_RECORDS * INITIAL_STATE_RECORD_SIZE);
+
+        u64 pages_remaining = header.num_pages;
+        while (pages_remaining > 0)
+        {
+            u64 num_records = pages_remaining < INITIAL_STATE_BUFFER_RECORDS ? pages_remaining : INITIAL_STATE_BUFFER_RECORDS;
+
+            size_t records_read = fread(buffer, INITIAL_STATE_RECORD_SIZE, num_records, file);
+            if (records_read != num_records)
+            {
+                printf("ERROR: initial state file \"%s\" is truncated.\n", filename);
+                quit();
+            }
+
+            for (u64 record_idx = 0; record_idx < num_records; record_idx++)
+            {
+                initial_state_load_record(filename, &buffer[record_idx * INITIAL_STATE_RECORD_SIZE], num_table_pages,
+                    header.version, table, loaded_pages);
+            }
+
+            pages_remaining -= num_records;
+        }
+
+        arena_temp_end(scratch);
+    }
+    else
+    {
+        // NOTE old dense format, one entry per capability-aligned address in memory. A stream cannot be rewound (or
+        // sized up front), so the bytes read as a header are the start of the table and the size is counted as it is read
+        u64 table_size = INITIAL_STATE_TABLE_SIZE * sizeof(initial_access_t);
+        memcpy(table, &header, header_size);
+        u64 file_size = header_size + fread((u8 *) table + header_size, 1, table_size - header_size, file);
+
+        u8 excess[4096];
+        size_t excess_size;
+        while ((excess_size = fread(excess, 1, sizeof(excess), file)) > 0) file_size += excess_size;
+
+        initial_state_load_dense(filename, file_size, table, loaded_pages);
+    }
+}
+
+initial_access_t * initial_state_load(arena_t * arena, char * filename, bitset_t * loaded_pages)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        printf("ERROR: could not open initial state file \"%s\".\n", filename);
+        quit();
+    }
+
+    struct stat file_stat;
+    int success = fstat(fd, &file_stat);
+    assert(success != -1);
+    u64 file_size = file_stat.st_size;
+
+    initial_access_t * table = arena_push_array(arena, initial_access_t, INITIAL_STATE_TABLE_SIZE);
+
+    u64 num_table_pages = INITIAL_STATE_TABLE_SIZE / INITIAL_STATE_PAGE_ENTRIES;
+    if (loaded_pages) *loaded_pages = bitset_create(arena, num_table_pages);
+
+    void * data = MAP_FAILED;
+    if (S_ISREG(file_stat.st_mode) && file_size > 0)
+    {
+        data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    if (data != MAP_FAILED)
+    {
+        madvise(data, file_size, MADV_SEQUENTIAL);
+        initial_state_load_mapped(filename, (u8 *) data, file_size, table, loaded_pages);
+
+        munmap(data, file_size);
+        close(fd);
+    }
+    else
+    {
+        // NOTE pipes (and anything else that cannot be mapped) are read as a stream
+        FILE * file = fdopen(fd, "rb");
+        assert(file);
+
+        initial_state_load_stream(arena, file, filename, table, loaded_pages);
+
+        fclose(file);
+    }
+
+    return table;
+}
+
+u64 initial_state_guess_tags_word(initial_access_t * table, u64 table_idx)
+{
+    // NOTE only two entry values have a tag guessed, a tagged CLOAD or CSTORE
+    initial_access_t cload_tagged = initial_access_create(CUSTOM_TRACE_TYPE_CLOAD, 1);
+    initial_access_t cstore_tagged = initial_access_create(CUSTOM_TRACE_TYPE_CSTORE, 1);
+    u8 cload_tagged_byte, cstore_tagged_byte;
+    memcpy(&cload_tagged_byte, &cload_tagged, 1);
+    memcpy(&cstore_tagged_byte, &cstore_tagged, 1);
+
+    u8 * bytes = (u8 *) &table[table_idx];
+    u64 tags = 0;
+
+#if defined(__SSE2__)
+    __m128i cload_tagged_bytes = _mm_set1_epi8((char) cload_tagged_byte);
+    __m128i cstore_tagged_bytes = _mm_set1_epi8((char) cstore_tagged_byte);
+
+    for (u64 i = 0; i < 64; i += 16)
+    {
+        __m128i entries = _mm_loadu_si128((__m128i *) &bytes[i]);
+        __m128i tagged = _mm_or_si128(_mm_cmpeq_epi8(entries, cload_tagged_bytes), _mm_cmpeq_epi8(entries, cstore_tagged_bytes));
+        tags |= (u64) (u16) _mm_movemask_epi8(tagged) << i;
+    }
+#else
+    for (u64 i = 0; i < 64; i++)
+    {
+        tags |= (u64) (bytes[i] == cload_tagged_byte || bytes[i] == cstore_tagged_byte) << i;
+    }
+#endif
+
+    return tags;
+}
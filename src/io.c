@@ -83,9 +83,12 @@ static void lz4_reader_close(lz4_reader_t * state)
     state->file = NULL;
 }
 
-static bool lz4_reader_get_entry(lz4_reader_t * state, const void * entry, size_t entry_size)
+// NOTE returns false once the stream is exhausted before the requested amount could be made available
+static bool lz4_reader_fill(lz4_reader_t * state, size_t required_size)
 {
-    while (state->dst_remaining < entry_size)
+    assert(required_size <= LZ4_BUFFER_SIZE);
+
+    while (state->dst_remaining < required_size)
     {
         // check if we need to read more source
         if (state->src_remaining == 0 && !state->src_eof)
@@ -100,7 +103,6 @@ static bool lz4_reader_get_entry(lz4_reader_t * state, const void * entry, size_
         // check if we are done
         if (state->src_eof && state->finished_frame)
         {
-            assert(state->dst_remaining == 0);
             return false;
         }
 
@@ -126,6 +128,17 @@ static bool lz4_reader_get_entry(lz4_reader_t * state, const void * entry, size_
         state->finished_frame = (lz4_ret == 0);
     }
 
+    return true;
+}
+
+static bool lz4_reader_get_entry(lz4_reader_t * state, const void * entry, size_t entry_size)
+{
+    if (!lz4_reader_fill(state, entry_size))
+    {
+        assert(state->dst_remaining == 0);
+        return false;
+    }
+
     assert(state->dst_remaining >= entry_size);
     assert(state->dst_current < state->dst_buf + LZ4_BUFFER_SIZE);
 
@@ -141,6 +154,31 @@ static bool lz4_reader_get_entry(lz4_reader_t * state, const void * entry, size_
     return true;
 }
 
+static size_t lz4_reader_read(lz4_reader_t * state, void * buffer, size_t size)
+{
+    u8 * buffer_ptr = (u8 *) buffer;
+    size_t bytes_read = 0;
+
+    while (bytes_read < size)
+    {
+        if (state->dst_remaining == 0 && !lz4_reader_fill(state, 1)) break;
+
+        size_t chunk_size = size - bytes_read;
+        if (chunk_size > state->dst_remaining) chunk_size = state->dst_remaining;
+
+        for (size_t i = 0; i < chunk_size; i++)
+        {
+            buffer_ptr[bytes_read + i] = state->dst_current[i];
+        }
+
+        state->dst_current += chunk_size;
+        state->dst_remaining -= chunk_size;
+        bytes_read += chunk_size;
+    }
+
+    return bytes_read;
+}
+
 
 static bool gz_at_eof(int bytes_read, int expected_bytes)
 {
@@ -264,6 +302,49 @@ bool trace_reader_get(trace_reader_t * reader, void * entry, size_t entry_size)
     return false;
 }
 
+size_t trace_reader_read(trace_reader_t * reader, void * buffer, size_t size)
+{
+    switch (reader->type)
+    {
+        case TRACE_READER_TYPE_UNCOMPRESSED_OR_GZIP:
+        {
+            assert(reader->as.gzip);
+            assert(size <= INT_MAX);
+            int bytes_read = gzread(reader->as.gzip, buffer, size);
+            if (bytes_read < 0)
+            {
+                printf("ERROR: error reading gzip file.\n");
+                quit();
+            }
+
+            return (size_t) bytes_read;
+        } break;
+        case TRACE_READER_TYPE_LZ4:
+        {
+            return lz4_reader_read(&reader->as.lz4, buffer, size);
+        } break;
+        default: assert(!"Impossible");
+    }
+
+    assert(!"Impossible");
+    return 0;
+}
+
+// NOTE returns the number of whole entries read, 0 once the end of the trace is reached
+size_t trace_reader_get_batch(trace_reader_t * reader, void * entries, size_t entry_size, size_t max_entries)
+{
+    assert(entry_size > 0);
+    size_t bytes_read = trace_reader_read(reader, entries, entry_size * max_entries);
+
+    if (bytes_read % entry_size != 0)
+    {
+        printf("ERROR: attempted to read %zu bytes, was only able to read %zu bytes.\n",
+            (bytes_read / entry_size + 1) * entry_size, bytes_read);
+    }
+
+    return bytes_read / entry_size;
+}
+
 void trace_reader_close(trace_reader_t * reader)
 {
     switch (reader->type)
@@ -298,7 +379,7 @@ void lz4_writer_open(arena_t * arena, int fd, lz4_writer_t * state)
     {
         {
             LZ4F_max4MB,
-            LZ4F_blockLinked, // NOTE this affects ability to randomly access traces
+            LZ4F_blockIndependent, // NOTE lets traces be split up and decoded on multiple threads
             LZ4F_noContentChecksum,
             LZ4F_frame,
             0, /* content size unknown */
@@ -1,13 +1,21 @@
 #include "utils.h"
 #include "handlers.h"
+#include "common.h"
+#include "initial_state.h"
+#include "memory_report.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 
 #define JDP_IMPLEMENTATION
 #include "jdp.h"
 #undef JDP_IMPLEMENTATION
 
+#define HASHMAP_IMPLEMENTATION
+#include "hashmap.h"
+#undef HASHMAP_IMPLEMENTATION
+
 typedef struct command_t command_t;
 struct command_t
 {
@@ -29,6 +37,8 @@ void print_commands_and_quit(char * exe_name, command_t * commands, u32 num_comm
 
     printf("\n");
     printf("Run a command without any arguments for usage information.\n");
+    printf("Any command also takes --memory-report[=<seconds>], printing its memory usage to stderr at exit\n");
+    printf("(and every <seconds> while it runs).\n");
     printf("\n");
     quit();
 }
@@ -40,7 +50,12 @@ void print_commands_and_quit(char * exe_name, command_t * commands, u32 num_comm
 
 int main(int argc, char * argv[])
 {
-    arena_t arena = arena_alloc(MEGABYTES(512));
+    // NOTE the largest tables commands allocate (initial state table, tag bitmaps) scale with the memory size,
+    // anything beyond this just chains on another block
+    u64 arena_size = INITIAL_STATE_TABLE_SIZE * sizeof(initial_access_t)
+        + 4 * (MEMORY_SIZE / CAP_SIZE_BYTES / 8)
+        + MEGABYTES(64);
+    arena_t arena = arena_alloc_ex(arena_size, ARENA_FLAG_HUGE_PAGES);
 
     command_t commands[] =
     {
@@ -49,6 +64,11 @@ int main(int argc, char * argv[])
             trace_get_info,
             string_lit("Prints statistics about a trace.")
         },
+        {
+            string_lit("get-hot-addresses"),
+            trace_get_hot_addresses,
+            string_lit("Prints the most frequently accessed physical pages and cache lines for each access type (estimated in bounded memory).")
+        },
         {
             string_lit("patch-paddrs"),
             trace_patch_paddrs,
@@ -59,6 +79,11 @@ int main(int argc, char * argv[])
             trace_convert,
             string_lit("Converts standard QEMU-CHERI traces from one compression type to another.")
         },
+        {
+            string_lit("filter"),
+            trace_filter_entries,
+            string_lit("Writes out the entries of a QEMU-CHERI trace matching every given filter (type, tag, address ranges, paddr validity).")
+        },
         {
             string_lit("convert-generic"),
             trace_convert_generic,
@@ -89,10 +114,25 @@ int main(int argc, char * argv[])
             trace_simulate,
             string_lit("Simulates instruction and data caches, outputs the outgoing requests from the LLC.")
         },
+        {
+            string_lit("reuse-distance"),
+            trace_reuse_distance,
+            string_lit("Prints miss ratio curves (as CSV) for fully associative LRU caches of every size, for instructions and data, in one pass over a trace.")
+        },
+        {
+            string_lit("working-set"),
+            trace_working_set,
+            string_lit("Prints (as CSV) the number of distinct lines, pages and tagged lines touched in each window of instructions.")
+        },
+        {
+            string_lit("run"),
+            trace_run,
+            string_lit("Runs several of the commands above (get-info, get-initial-state, convert-drcachesim-*, simulate, reuse-distance) over a single read of a trace, optionally only over the entries kept by the same filters as filter.")
+        },
         {
             string_lit("simulate-tag-cache"),
             trace_simulate_uncompressed,
-            string_lit("Simulates a tag cache without compression, given a trace of the outgoing requests from the LLC.")
+            string_lit("Simulates a tag cache without compression, given a trace of the outgoing requests from the LLC. Currently dumps the requests (optionally filtered by address range, type and tags).")
         },
         {
             string_lit("requests-get-info"),
@@ -102,7 +142,12 @@ int main(int argc, char * argv[])
         {
             string_lit("requests-tag-csv"),
             trace_requests_make_tag_csv,
-            string_lit("Reads in an LLC outgoing requests trace, outputs to stdout (in CSV form) information about how tags change over time.")
+            string_lit("Reads in an LLC outgoing requests trace, outputs to stdout (in CSV form, or to a binary file with --binary) information about how tags change over time.")
+        },
+        {
+            string_lit("requests-tag-density"),
+            trace_requests_tag_density,
+            string_lit("Like requests-tag-csv, but for the number of regions containing tags at several region sizes at once (e.g. for compressed tag tables).")
         }
     };
 
@@ -128,7 +173,33 @@ int main(int argc, char * argv[])
     if (match_index >= 0)
     {
         assert(match_index < num_commands);
-        commands[match_index].handler(&arena, argv[0], argv[1], argc - 2, &argv[2]);
+
+        int num_args = argc - 2;
+        char ** args = &argv[2];
+
+        bool memory_report = args_take_flag(&num_args, args, "memory-report");
+        char * memory_report_interval_str = args_take_value(&num_args, args, "memory-report");
+        if (memory_report_interval_str)
+        {
+            char * end = NULL;
+            f64 memory_report_interval = strtod(memory_report_interval_str, &end);
+            if (*end != '\0' || !(memory_report_interval > 0))
+            {
+                printf("ERROR: Invalid memory report interval \"%s\" (expected a number of seconds).\n", memory_report_interval_str);
+                quit();
+            }
+
+            memory_report = true;
+            memory_report_start_interval(memory_report_interval);
+        }
+
+        commands[match_index].handler(&arena, argv[0], argv[1], num_args, args);
+
+        if (memory_report)
+        {
+            memory_report_stop_interval();
+            memory_report_print(argv[1]);
+        }
     }
     else
     {
@@ -0,0 +1,150 @@
+#include "jdp.h"
+#include "hashmap.h"
+#include "memory_report.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+typedef struct memory_report_interval_t memory_report_interval_t;
+struct memory_report_interval_t
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t stop_cond;
+    bool running;
+    bool stop;
+    f64 seconds;
+};
+
+static memory_report_interval_t memory_report_interval = { .lock = PTHREAD_MUTEX_INITIALIZER, .stop_cond = PTHREAD_COND_INITIALIZER };
+
+static f64 bytes_to_mib(u64 bytes)
+{
+    return (f64) bytes / MEGABYTES(1);
+}
+
+static u64 get_peak_rss(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+
+    return (u64) usage.ru_maxrss * KILOBYTES(1); // NOTE in kilobytes on Linux
+}
+
+static u64 get_current_rss(void)
+{
+    FILE * file = fopen("/proc/self/statm", "r");
+    if (!file) return 0;
+
+    u64 total_pages = 0;
+    u64 resident_pages = 0;
+    int num_read = fscanf(file, "%lu %lu", &total_pages, &resident_pages);
+    fclose(file);
+
+    if (num_read != 2) return 0;
+    return resident_pages * (u64) sysconf(_SC_PAGESIZE);
+}
+
+static int allocation_site_compare(const void * a, const void * b)
+{
+    const allocation_site_t * site_a = (const allocation_site_t *) a;
+    const allocation_site_t * site_b = (const allocation_site_t *) b;
+
+    if (site_a->num_bytes != site_b->num_bytes) return site_a->num_bytes < site_b->num_bytes ? 1 : -1;
+    return strcmp(site_a->name, site_b->name);
+}
+
+void memory_report_print(char * cmd_name)
+{
+    memory_stats_t stats = memory_get_stats();
+
+    allocation_site_t sites[ARENA_MAX_ALLOCATION_SITES];
+    u64 num_sites = memory_get_allocation_sites(sites, array_count(sites));
+    qsort(sites, num_sites, sizeof(allocation_site_t), allocation_site_compare);
+
+    fprintf(stderr, "Memory usage (%s):\n", cmd_name);
+    fprintf(stderr, INDENT4 "Peak resident set size: %.2f MiB\n", bytes_to_mib(get_peak_rss()));
+    fprintf(stderr, INDENT4 "Arena memory used: %.2f MiB (peak %.2f MiB)\n",
+        bytes_to_mib(stats.used), bytes_to_mib(stats.peak_used));
+    fprintf(stderr, INDENT4 "Arena memory committed: %.2f MiB (peak %.2f MiB)\n",
+        bytes_to_mib(stats.committed), bytes_to_mib(stats.peak_committed));
+    fprintf(stderr, INDENT4 "Arena memory reserved: %.2f MiB (peak %.2f MiB)\n",
+        bytes_to_mib(stats.reserved), bytes_to_mib(stats.peak_reserved));
+    fprintf(stderr, INDENT4 "Hash containers: %lu tables, %.2f MiB (peak %lu tables, %.2f MiB)\n",
+        hash_table_stats.num_tables, bytes_to_mib(hash_table_stats.bytes),
+        hash_table_stats.peak_num_tables, bytes_to_mib(hash_table_stats.peak_bytes));
+
+    fprintf(stderr, INDENT4 "Largest allocation sites (total pushed, allocations):\n");
+    for (u64 i = 0; i < num_sites && i < MEMORY_REPORT_NUM_SITES; i++)
+    {
+        fprintf(stderr, INDENT8 "%10.2f MiB %10lu  %s\n",
+            bytes_to_mib(sites[i].num_bytes), sites[i].num_allocations, sites[i].name);
+    }
+}
+
+static void * memory_report_interval_thread(void * data)
+{
+    memory_report_interval_t * interval = (memory_report_interval_t *) data;
+
+    struct timespec start_time;
+    clock_gettime(CLOCK_REALTIME, &start_time);
+    struct timespec deadline = start_time;
+
+    pthread_mutex_lock(&interval->lock);
+    while (!interval->stop)
+    {
+        f64 deadline_seconds = deadline.tv_sec + deadline.tv_nsec / 1e9 + interval->seconds;
+        deadline.tv_sec = (time_t) deadline_seconds;
+        deadline.tv_nsec = (long) ((deadline_seconds - deadline.tv_sec) * 1e9);
+
+        int result = 0;
+        while (!interval->stop && result != ETIMEDOUT)
+        {
+            result = pthread_cond_timedwait(&interval->stop_cond, &interval->lock, &deadline);
+        }
+        if (interval->stop) break;
+
+        memory_stats_t stats = memory_get_stats();
+        f64 elapsed = (deadline.tv_sec - start_time.tv_sec) + (deadline.tv_nsec - start_time.tv_nsec) / 1e9;
+        fprintf(stderr, "[memory %.2fs] RSS %.2f MiB, arena used %.2f MiB, committed %.2f MiB, hash containers %.2f MiB\n",
+            elapsed, bytes_to_mib(get_current_rss()), bytes_to_mib(stats.used), bytes_to_mib(stats.committed),
+            bytes_to_mib(__atomic_load_n(&hash_table_stats.bytes, __ATOMIC_RELAXED)));
+    }
+    pthread_mutex_unlock(&interval->lock);
+
+    return NULL;
+}
+
+void memory_report_start_interval(f64 seconds)
+{
+    memory_report_interval_t * interval = &memory_report_interval;
+    assert(seconds > 0);
+    assert(!interval->running);
+
+    interval->seconds = seconds;
+    interval->stop = false;
+
+    int result = pthread_create(&interval->thread, NULL, memory_report_interval_thread, interval);
+    assert(result == 0);
+    interval->running = true;
+}
+
+void memory_report_stop_interval(void)
+{
+    memory_report_interval_t * interval = &memory_report_interval;
+    if (!interval->running) return;
+
+    pthread_mutex_lock(&interval->lock);
+    interval->stop = true;
+    pthread_cond_signal(&interval->stop_cond);
+    pthread_mutex_unlock(&interval->lock);
+
+    pthread_join(interval->thread, NULL);
+    interval->running = false;
+}
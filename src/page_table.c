@@ -0,0 +1,38 @@
+#include "jdp.h"
+#include "common.h"
+#include "page_table.h"
+
+static u64 * page_table_node_create(arena_t * arena)
+{
+    // NOTE arena memory is zeroed, so all entries start out empty
+    return arena_push_array(arena, u64, PAGE_TABLE_NODE_ENTRIES);
+}
+
+page_table_t page_table_create(arena_t * arena)
+{
+    page_table_t page_table = {0};
+    page_table.arena = arena;
+    page_table.root = page_table_node_create(arena);
+
+    return page_table;
+}
+
+u64 * page_table_walk(page_table_t * page_table, u64 vaddr, bool create)
+{
+    u64 vpn = vaddr >> PAGE_SIZE_BITS;
+    u64 * node = page_table->root;
+
+    for (i64 level = PAGE_TABLE_NUM_LEVELS - 1; level > 0; level--)
+    {
+        u64 idx = (vpn >> (level * PAGE_TABLE_LEVEL_BITS)) & (PAGE_TABLE_NODE_ENTRIES - 1);
+        if (!node[idx])
+        {
+            if (!create) return NULL;
+            node[idx] = (u64) page_table_node_create(page_table->arena);
+        }
+
+        node = (u64 *) node[idx];
+    }
+
+    return &node[vpn & (PAGE_TABLE_NODE_ENTRIES - 1)];
+}
@@ -0,0 +1,431 @@
+#include "jdp.h"
+#include "common.h"
+#include "utils.h"
+#include "trace.h"
+#include "simulator.h"
+#include "requests.h"
+#include "io.h"
+
+#include <stdio.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+ #include <immintrin.h>
+ #define REQUESTS_FILTER_X86 1
+#endif
+
+#define REQUESTS_BUFFER_SIZE        KILOBYTES(64)
+#define REQUEST_MAX_ENCODED_SIZE    32 // header byte + 10 byte address varint + 3 * 3 byte varints (rounded up)
+
+static_assert(sizeof(tag_cache_request_t) <= REQUEST_MAX_ENCODED_SIZE, "Request buffering assumes small records.");
+
+
+static inline u64 zigzag_encode(i64 value)
+{
+    return ((u64) value << 1) ^ (u64) (value >> 63);
+}
+
+static inline i64 zigzag_decode(u64 value)
+{
+    return (i64) (value >> 1) ^ -(i64) (value & 1);
+}
+
+static inline u8 * varint_encode(u8 * ptr, u64 value)
+{
+    while (value >= 0x80)
+    {
+        *ptr++ = (u8) (value | 0x80);
+        value >>= 7;
+    }
+    *ptr++ = (u8) value;
+
+    return ptr;
+}
+
+static inline u64 get_known_all_mask(u64 size)
+{
+    assert(size % CAP_SIZE_BYTES == 0);
+    u64 num_tags = size / CAP_SIZE_BYTES;
+    assert(num_tags <= 16);
+
+    return (1 << num_tags) - 1;
+}
+
+
+static void requests_writer_flush(requests_writer_t * writer)
+{
+    if (writer->buf_size > 0)
+    {
+        trace_writer_emit(&writer->output, writer->buf, writer->buf_size);
+        writer->buf_size = 0;
+    }
+}
+
+requests_writer_t requests_writer_open(arena_t * arena, char * filename, bool compact)
+{
+    requests_writer_t writer = {0};
+    writer.output = trace_writer_open(arena, filename, guess_writer_type(filename));
+    writer.compact = compact;
+
+    if (compact)
+    {
+        writer.buf = arena_push_array(arena, u8, REQUESTS_BUFFER_SIZE);
+
+        u8 header[REQUESTS_HEADER_SIZE] = {0};
+        for (i64 i = 0; i < REQUESTS_MAGIC_SIZE; i++)
+        {
+            header[i] = REQUESTS_MAGIC[i];
+        }
+        header[REQUESTS_MAGIC_SIZE] = REQUESTS_VERSION;
+        header[REQUESTS_MAGIC_SIZE + 1] = CACHE_LINE_SIZE_BITS;
+
+        trace_writer_emit(&writer.output, header, sizeof(header));
+    }
+
+    return writer;
+}
+
+void requests_writer_emit(requests_writer_t * writer, tag_cache_request_t request)
+{
+    if (!writer->compact)
+    {
+        trace_writer_emit(&writer->output, &request, sizeof(request));
+        return;
+    }
+
+    if (writer->buf_size + REQUEST_MAX_ENCODED_SIZE > REQUESTS_BUFFER_SIZE)
+        requests_writer_flush(writer);
+
+    assert(request.type == TAG_CACHE_REQUEST_TYPE_READ || request.type == TAG_CACHE_REQUEST_TYPE_WRITE);
+    assert((request.tags & ~request.tags_known) == 0);
+
+    u8 * header_ptr = &writer->buf[writer->buf_size];
+    u8 * ptr = header_ptr + 1;
+
+    u8 header = 0;
+    if (request.type == TAG_CACHE_REQUEST_TYPE_WRITE) header |= REQUEST_HEADER_WRITE;
+
+    bool aligned = (request.addr % CACHE_LINE_SIZE == 0) && (writer->prev_addr % CACHE_LINE_SIZE == 0);
+    i64 addr_delta = (i64) (request.addr - writer->prev_addr);
+    if (aligned)
+    {
+        ptr = varint_encode(ptr, zigzag_encode(addr_delta >> CACHE_LINE_SIZE_BITS));
+    }
+    else
+    {
+        header |= REQUEST_HEADER_UNALIGNED;
+        ptr = varint_encode(ptr, zigzag_encode(addr_delta));
+    }
+    writer->prev_addr = request.addr;
+
+    if (request.size != CACHE_LINE_SIZE)
+    {
+        header |= REQUEST_HEADER_SIZE;
+        ptr = varint_encode(ptr, request.size);
+    }
+
+    if (request.tags != 0)
+    {
+        header |= REQUEST_HEADER_TAGS;
+        ptr = varint_encode(ptr, request.tags);
+    }
+
+    if (request.tags_known == get_known_all_mask(request.size))
+    {
+        header |= REQUEST_HEADER_KNOWN_ALL;
+    }
+    else if (request.tags_known != 0)
+    {
+        header |= REQUEST_HEADER_KNOWN_EXPLICIT;
+        ptr = varint_encode(ptr, request.tags_known);
+    }
+
+    *header_ptr = header;
+
+    assert(ptr - header_ptr <= REQUEST_MAX_ENCODED_SIZE);
+    writer->buf_size += ptr - header_ptr;
+}
+
+void requests_writer_close(requests_writer_t * writer)
+{
+    if (writer->compact)
+        requests_writer_flush(writer);
+
+    trace_writer_close(&writer->output);
+}
+
+
+// NOTE tries to make sure there are at least REQUEST_MAX_ENCODED_SIZE bytes buffered (unless at the end of the input)
+static void requests_reader_refill(requests_reader_t * reader)
+{
+    assert(reader->buf_pos <= reader->buf_size);
+    u64 remaining = reader->buf_size - reader->buf_pos;
+    if (remaining >= REQUEST_MAX_ENCODED_SIZE || reader->input_eof) return;
+
+    for (u64 i = 0; i < remaining; i++)
+    {
+        reader->buf[i] = reader->buf[reader->buf_pos + i];
+    }
+    reader->buf_pos = 0;
+    reader->buf_size = remaining;
+
+    while (reader->buf_size < REQUEST_MAX_ENCODED_SIZE && !reader->input_eof)
+    {
+        size_t bytes_read = trace_reader_read(&reader->input,
+            &reader->buf[reader->buf_size], REQUESTS_BUFFER_SIZE - reader->buf_size);
+
+        if (bytes_read == 0) reader->input_eof = true;
+        reader->buf_size += bytes_read;
+    }
+}
+
+requests_reader_t requests_reader_open(arena_t * arena, char * filename)
+{
+    requests_reader_t reader = {0};
+    reader.input = trace_reader_open(arena, filename, guess_reader_type(filename));
+    reader.buf = arena_push_array(arena, u8, REQUESTS_BUFFER_SIZE);
+
+    requests_reader_refill(&reader);
+
+    bool magic_matches = reader.buf_size >= REQUESTS_HEADER_SIZE;
+    for (i64 i = 0; magic_matches && i < REQUESTS_MAGIC_SIZE; i++)
+    {
+        if (reader.buf[i] != (u8) REQUESTS_MAGIC[i]) magic_matches = false;
+    }
+
+    if (magic_matches)
+    {
+        u8 version = reader.buf[REQUESTS_MAGIC_SIZE];
+        if (version != REQUESTS_VERSION)
+        {
+            printf("ERROR: unsupported LLC requests trace version (%u) in \"%s\".\n", version, filename);
+            quit();
+        }
+
+        reader.compact = true;
+        reader.line_size_bits = reader.buf[REQUESTS_MAGIC_SIZE + 1];
+        reader.buf_pos = REQUESTS_HEADER_SIZE;
+
+        if (reader.line_size_bits >= 16)
+        {
+            printf("ERROR: invalid cache line size in LLC requests trace \"%s\".\n", filename);
+            quit();
+        }
+    }
+    else
+    {
+        // NOTE the plain format starts with a request type, which can never match the magic
+        reader.compact = false;
+    }
+
+    return reader;
+}
+
+static inline u64 requests_reader_varint(requests_reader_t * reader)
+{
+    u64 result = 0;
+    for (u32 shift = 0; ; shift += 7)
+    {
+        if (reader->buf_pos >= reader->buf_size || shift >= 64)
+        {
+            printf("ERROR: corrupted LLC requests trace (invalid varint).\n");
+            requests_reader_close(reader); // NOTE so quitting does not trip the open readers check
+            quit();
+        }
+
+        u8 byte = reader->buf[reader->buf_pos++];
+        result |= (u64) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) break;
+    }
+
+    return result;
+}
+
+bool requests_reader_get(requests_reader_t * reader, tag_cache_request_t * request)
+{
+    requests_reader_refill(reader);
+
+    if (reader->buf_pos == reader->buf_size)
+    {
+        assert(reader->input_eof);
+        return false;
+    }
+
+    if (!reader->compact)
+    {
+        if (reader->buf_size - reader->buf_pos < sizeof(tag_cache_request_t))
+        {
+            printf("ERROR: LLC requests trace ends with a partial entry (%lu bytes).\n",
+                reader->buf_size - reader->buf_pos);
+            requests_reader_close(reader);
+            quit();
+        }
+
+        u8 * request_ptr = (u8 *) request;
+        for (u64 i = 0; i < sizeof(tag_cache_request_t); i++)
+        {
+            request_ptr[i] = reader->buf[reader->buf_pos + i];
+        }
+        reader->buf_pos += sizeof(tag_cache_request_t);
+
+        return true;
+    }
+
+    u8 header = reader->buf[reader->buf_pos++];
+
+    *request = (tag_cache_request_t) {0};
+    request->type = (header & REQUEST_HEADER_WRITE) ? TAG_CACHE_REQUEST_TYPE_WRITE : TAG_CACHE_REQUEST_TYPE_READ;
+
+    i64 addr_delta = zigzag_decode(requests_reader_varint(reader));
+    if ((header & REQUEST_HEADER_UNALIGNED) == 0) addr_delta = (i64) ((u64) addr_delta << reader->line_size_bits);
+    request->addr = reader->prev_addr + (u64) addr_delta;
+    reader->prev_addr = request->addr;
+
+    u64 size = (header & REQUEST_HEADER_SIZE) ? requests_reader_varint(reader) : ((u64) 1 << reader->line_size_bits);
+    assert(size <= UINT16_MAX);
+    request->size = size;
+
+    u64 tags = (header & REQUEST_HEADER_TAGS) ? requests_reader_varint(reader) : 0;
+    assert(tags <= UINT16_MAX);
+    request->tags = tags;
+
+    u64 tags_known = 0;
+    if (header & REQUEST_HEADER_KNOWN_ALL) tags_known = get_known_all_mask(request->size);
+    else if (header & REQUEST_HEADER_KNOWN_EXPLICIT) tags_known = requests_reader_varint(reader);
+    assert(tags_known <= UINT16_MAX);
+    request->tags_known = tags_known;
+
+    return true;
+}
+
+void requests_reader_close(requests_reader_t * reader)
+{
+    trace_reader_close(&reader->input);
+}
+
+
+requests_filter_t requests_filter_all(void)
+{
+    requests_filter_t filter = {0};
+    filter.addr_start = 0;
+    filter.addr_end = UINT64_MAX;
+    filter.type_mask = (1 << TAG_CACHE_REQUEST_TYPE_READ) | (1 << TAG_CACHE_REQUEST_TYPE_WRITE);
+    filter.tags_mask = 0;
+
+    return filter;
+}
+
+static_assert(sizeof(tag_cache_request_t) == 16, "LLC requests are expected to be 16 bytes.");
+static_assert(offsetof(tag_cache_request_t, type) == 0 && offsetof(tag_cache_request_t, size) == 2
+    && offsetof(tag_cache_request_t, tags) == 4 && offsetof(tag_cache_request_t, addr) == 8,
+    "Type, size and tags are expected in the first word, the address in the second.");
+
+// NOTE bit i is set if request i (of up to 64) matches, for requests [start, end)
+static u64 requests_filter_mask_scalar(requests_filter_t * filter, tag_cache_request_t * requests, u64 start, u64 end)
+{
+    assert(end <= 64);
+
+    u64 addr_start = filter->addr_start;
+    u64 addr_end = filter->addr_end;
+    u32 type_mask = filter->type_mask;
+    u32 tags_mask = filter->tags_mask;
+    u32 any_tags = tags_mask == 0;
+
+    u64 mask = 0;
+    for (u64 i = start; i < end; i++)
+    {
+        tag_cache_request_t * request = &requests[i];
+
+        u32 match = (request->addr < addr_end)
+            & (request->addr + request->size > addr_start)
+            & (request->type < 8)
+            & (type_mask >> (request->type & 7))
+            & (any_tags | ((request->tags & tags_mask) != 0));
+
+        mask |= (u64) (match & 1) << i;
+    }
+
+    return mask;
+}
+
+#if REQUESTS_FILTER_X86
+__attribute__((target("avx2")))
+static u64 requests_filter_mask_avx2(requests_filter_t * filter, tag_cache_request_t * requests, u64 num_requests)
+{
+    assert(num_requests <= 64);
+
+    // NOTE gathers 4 requests at a time, indices are in words (each request is 2 words)
+    const __m256i request_words = _mm256_setr_epi64x(0, 2, 4, 6);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i zero = _mm256_setzero_si256();
+
+    // NOTE there are no unsigned 64-bit compares, so addresses have their sign bits flipped and are compared signed
+    const __m256i sign_bit = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i addr_start_flipped = _mm256_set1_epi64x(filter->addr_start ^ INT64_MIN);
+    const __m256i addr_end_flipped = _mm256_set1_epi64x(filter->addr_end ^ INT64_MIN);
+
+    // NOTE shifted right by the type (variable shifts of 64 or more give 0)
+    const __m256i type_mask = _mm256_set1_epi64x(filter->type_mask);
+    const __m256i tags_mask = _mm256_set1_epi64x((u64) filter->tags_mask << 32);
+    const __m256i any_tags = _mm256_set1_epi64x(filter->tags_mask == 0 ? -1 : 0);
+
+    u64 mask = 0;
+    u64 i = 0;
+    for (; i + 4 <= num_requests; i += 4)
+    {
+        const long long * words = (const long long *) &requests[i];
+        __m256i header = _mm256_i64gather_epi64(words, request_words, 8);
+        __m256i addr = _mm256_i64gather_epi64(words + 1, request_words, 8);
+
+        __m256i type = _mm256_and_si256(header, _mm256_set1_epi64x(0xFF));
+        __m256i size = _mm256_and_si256(_mm256_srli_epi64(header, 16), _mm256_set1_epi64x(0xFFFF));
+
+        __m256i match = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_srlv_epi64(type_mask, type), one), one);
+
+        __m256i addr_flipped = _mm256_xor_si256(addr, sign_bit);
+        __m256i end_flipped = _mm256_xor_si256(_mm256_add_epi64(addr, size), sign_bit);
+        match = _mm256_and_si256(match, _mm256_cmpgt_epi64(addr_end_flipped, addr_flipped));
+        match = _mm256_and_si256(match, _mm256_cmpgt_epi64(end_flipped, addr_start_flipped));
+
+        __m256i no_tags_matched = _mm256_cmpeq_epi64(_mm256_and_si256(header, tags_mask), zero);
+        match = _mm256_and_si256(match, _mm256_or_si256(any_tags, _mm256_xor_si256(no_tags_matched, _mm256_set1_epi64x(-1))));
+
+        mask |= (u64) _mm256_movemask_pd(_mm256_castsi256_pd(match)) << i;
+    }
+
+    return mask | requests_filter_mask_scalar(filter, requests, i, num_requests);
+}
+#endif
+
+// NOTE writes the indices of matching requests, returns how many matched
+u64 requests_filter_batch(requests_filter_t * filter, tag_cache_request_t * requests, u64 num_requests, u32 * indices)
+{
+    assert(num_requests <= UINT32_MAX);
+
+#if REQUESTS_FILTER_X86
+    bool use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    // NOTE a bit mask per 64 requests (built without branches), then the set bits are turned into indices
+    u64 num_matches = 0;
+    for (u64 first_idx = 0; first_idx < num_requests; first_idx += 64)
+    {
+        u64 num_group = num_requests - first_idx < 64 ? num_requests - first_idx : 64;
+
+#if REQUESTS_FILTER_X86
+        u64 mask = use_avx2 ?
+            requests_filter_mask_avx2(filter, &requests[first_idx], num_group) :
+            requests_filter_mask_scalar(filter, &requests[first_idx], 0, num_group);
+#else
+        u64 mask = requests_filter_mask_scalar(filter, &requests[first_idx], 0, num_group);
+#endif
+
+        while (mask != 0)
+        {
+            indices[num_matches++] = (u32) (first_idx + __builtin_ctzll(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    return num_matches;
+}
@@ -0,0 +1,153 @@
+#include "jdp.h"
+#include "hashmap.h"
+#include "reuse_distance.h"
+
+#include <string.h>
+
+static u32 * reuse_distance_alloc_tree(reuse_distance_t * tracker, u64 capacity)
+{
+    assert(capacity <= UINT32_MAX);
+
+    if (tracker->tree) arena_free(&tracker->tree_arena);
+
+    tracker->tree_arena = arena_alloc((capacity + 1) * sizeof(u32));
+    tracker->tree = arena_push_array(&tracker->tree_arena, u32, capacity + 1);
+    tracker->capacity = capacity;
+
+    return tracker->tree;
+}
+
+static inline void reuse_distance_tree_add(reuse_distance_t * tracker, u64 pos, i32 delta)
+{
+    assert(pos > 0 && pos <= tracker->capacity);
+    for (; pos <= tracker->capacity; pos += pos & -pos) tracker->tree[pos] += delta;
+}
+
+static inline u64 reuse_distance_tree_prefix(reuse_distance_t * tracker, u64 pos) // NOTE sum over [1, pos]
+{
+    assert(pos <= tracker->capacity);
+    u64 sum = 0;
+    for (; pos > 0; pos -= pos & -pos) sum += tracker->tree[pos];
+    return sum;
+}
+
+// NOTE renumbers the live timestamps to 0..n-1 (keeping their order), then marks them in a fresh tree
+static void reuse_distance_compact(reuse_distance_t * tracker)
+{
+    hash_table_u64_t * table = tracker->last_access.ptr;
+    u64 num_keys = table->count;
+
+    for (i64 idx = hash_table_u64_next(table, -1); idx >= 0; idx = hash_table_u64_next(table, idx))
+    {
+        u64 timestamp = table->values[idx];
+        table->values[idx] = reuse_distance_tree_prefix(tracker, timestamp + 1) - 1;
+    }
+
+    u64 capacity = tracker->capacity;
+    if (capacity < 2 * num_keys) capacity = 2 * num_keys;
+
+    if (capacity == tracker->capacity) memset(tracker->tree, 0, (capacity + 1) * sizeof(u32));
+    else reuse_distance_alloc_tree(tracker, capacity);
+
+    // NOTE each node covers (i - lowbit(i), i], marks are at 1..num_keys
+    for (u64 i = 1; i <= num_keys; i++)
+    {
+        u64 node_start = i - (i & -i);
+        tracker->tree[i] = (u32) (i - node_start);
+    }
+    for (u64 i = num_keys + 1; i <= capacity; i++)
+    {
+        u64 node_start = i - (i & -i);
+        tracker->tree[i] = node_start < num_keys ? (u32) (num_keys - node_start) : 0;
+    }
+
+    tracker->next_timestamp = num_keys;
+}
+
+static inline u32 reuse_distance_bucket(u64 distance)
+{
+    if (distance < REUSE_DISTANCE_SUB_BUCKETS) return (u32) distance;
+
+    u32 exponent = 63 - __builtin_clzll(distance);
+    u32 shift = exponent - REUSE_DISTANCE_SUB_BUCKET_BITS;
+    u32 sub_bucket = (u32) (distance >> shift) - REUSE_DISTANCE_SUB_BUCKETS;
+
+    return REUSE_DISTANCE_SUB_BUCKETS + shift * REUSE_DISTANCE_SUB_BUCKETS + sub_bucket;
+}
+
+u64 reuse_distance_bucket_start(u32 bucket_idx)
+{
+    assert(bucket_idx < REUSE_DISTANCE_NUM_BUCKETS);
+    if (bucket_idx < REUSE_DISTANCE_SUB_BUCKETS) return bucket_idx;
+
+    u32 shift = bucket_idx / REUSE_DISTANCE_SUB_BUCKETS - 1;
+    u64 sub_bucket = bucket_idx % REUSE_DISTANCE_SUB_BUCKETS;
+
+    return (REUSE_DISTANCE_SUB_BUCKETS + sub_bucket) << shift;
+}
+
+reuse_distance_t reuse_distance_create(void)
+{
+    reuse_distance_t tracker = {0};
+    tracker.last_access = map_u64_create();
+    reuse_distance_alloc_tree(&tracker, REUSE_DISTANCE_MIN_CAPACITY);
+
+    return tracker;
+}
+
+void reuse_distance_cleanup(reuse_distance_t * tracker)
+{
+    map_u64_cleanup(&tracker->last_access);
+    arena_free(&tracker->tree_arena);
+    tracker->tree = NULL;
+}
+
+u64 reuse_distance_access(reuse_distance_t * tracker, u64 key)
+{
+    if (tracker->next_timestamp == tracker->capacity) reuse_distance_compact(tracker);
+
+    u64 timestamp = tracker->next_timestamp++;
+    tracker->num_accesses++;
+
+    u64 distance;
+    hash_table_u64_t * table = tracker->last_access.ptr;
+    i64 idx = hash_table_u64_find(table, key);
+    if (idx >= 0)
+    {
+        u64 prev_timestamp = table->values[idx];
+        assert(prev_timestamp < timestamp);
+
+        // NOTE marks strictly between the two accesses (positions are timestamp + 1)
+        distance = reuse_distance_tree_prefix(tracker, timestamp) - reuse_distance_tree_prefix(tracker, prev_timestamp + 1);
+        reuse_distance_tree_add(tracker, prev_timestamp + 1, -1);
+        table->values[idx] = timestamp;
+
+        tracker->histogram[reuse_distance_bucket(distance)]++;
+    }
+    else
+    {
+        distance = REUSE_DISTANCE_COLD;
+        map_u64_set(tracker->last_access, key, timestamp);
+
+        tracker->num_cold_accesses++;
+    }
+
+    reuse_distance_tree_add(tracker, timestamp + 1, 1);
+
+    return distance;
+}
+
+u64 reuse_distance_num_keys(reuse_distance_t * tracker)
+{
+    return tracker->last_access.ptr->count;
+}
+
+u64 reuse_distance_misses(reuse_distance_t * tracker, u32 bucket_idx)
+{
+    assert(bucket_idx < REUSE_DISTANCE_NUM_BUCKETS);
+
+    u64 misses = tracker->num_cold_accesses;
+    for (u32 i = bucket_idx; i < REUSE_DISTANCE_NUM_BUCKETS; i++) misses += tracker->histogram[i];
+
+    return misses;
+}
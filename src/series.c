@@ -0,0 +1,175 @@
+#include "jdp.h"
+#include "io.h"
+#include "series.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// NOTE room for a full row of 20 digit values and separators
+#define SERIES_MAX_ROW_SIZE     (SERIES_MAX_COLUMNS * 21)
+static_assert(SERIES_BUFFER_SIZE >= SERIES_MAX_ROW_SIZE, "Series buffer must hold at least one row.");
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+u32 format_u64(char * dst, u64 value)
+{
+    // NOTE digits are produced backwards, two at a time
+    char digits[20];
+    char * current = digits + sizeof(digits);
+
+    while (value >= 100)
+    {
+        u64 pair = value % 100;
+        value /= 100;
+        current -= 2;
+        memcpy(current, &digit_pairs[pair * 2], 2);
+    }
+
+    if (value >= 10)
+    {
+        current -= 2;
+        memcpy(current, &digit_pairs[value * 2], 2);
+    }
+    else
+    {
+        *--current = '0' + value;
+    }
+
+    u32 length = digits + sizeof(digits) - current;
+    memcpy(dst, current, length);
+
+    return length;
+}
+
+u32 format_hex_u64(char * dst, u64 value, u32 min_digits, bool upper)
+{
+    assert(min_digits <= 16);
+    const char * hex_digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    u32 num_digits = value == 0 ? 1 : (67 - __builtin_clzll(value)) / 4;
+    if (num_digits < min_digits) num_digits = min_digits;
+
+    for (u32 i = num_digits; i > 0; i--)
+    {
+        dst[i - 1] = hex_digits[value & 0xF];
+        value >>= 4;
+    }
+
+    return num_digits;
+}
+
+static void series_writer_flush(series_writer_t * writer)
+{
+    if (writer->buffer_used == 0) return;
+
+    if (writer->format == SERIES_FORMAT_CSV)
+    {
+        size_t bytes_written = fwrite(writer->buffer, 1, writer->buffer_used, writer->file);
+        assert(bytes_written == writer->buffer_used);
+    }
+    else
+    {
+        trace_writer_emit(&writer->binary, writer->buffer, writer->buffer_used);
+    }
+
+    writer->buffer_used = 0;
+}
+
+static void series_writer_append(series_writer_t * writer, const void * data, u64 size)
+{
+    assert(size <= SERIES_BUFFER_SIZE);
+    if (writer->buffer_used + size > SERIES_BUFFER_SIZE) series_writer_flush(writer);
+
+    memcpy(writer->buffer + writer->buffer_used, data, size);
+    writer->buffer_used += size;
+}
+
+series_writer_t series_writer_open(arena_t * arena, u8 format, char * filename, char ** column_names, u32 num_columns)
+{
+    assert(num_columns > 0 && num_columns <= SERIES_MAX_COLUMNS);
+
+    series_writer_t writer = {0};
+    writer.format = format;
+    writer.num_columns = num_columns;
+    writer.buffer = arena_push_array(arena, u8, SERIES_BUFFER_SIZE);
+
+    switch (format)
+    {
+        case SERIES_FORMAT_CSV:
+        {
+            assert(!filename);
+            writer.file = stdout;
+
+            for (u32 i = 0; i < num_columns; i++)
+            {
+                if (i > 0) series_writer_append(&writer, ",", 1);
+                series_writer_append(&writer, column_names[i], strlen(column_names[i]));
+            }
+            series_writer_append(&writer, "\n", 1);
+        } break;
+        case SERIES_FORMAT_BINARY:
+        {
+            assert(filename);
+            writer.binary = trace_writer_open(arena, filename, guess_writer_type(filename));
+
+            u64 names_size = 0;
+            for (u32 i = 0; i < num_columns; i++) names_size += strlen(column_names[i]) + 1;
+
+            series_header_t header = {0};
+            memcpy(header.magic, SERIES_MAGIC, sizeof(SERIES_MAGIC));
+            header.version = SERIES_VERSION;
+            header.num_columns = num_columns;
+            header.names_size = align_ceil_pow_2(names_size, sizeof(u64));
+            series_writer_append(&writer, &header, sizeof(header));
+
+            for (u32 i = 0; i < num_columns; i++)
+            {
+                series_writer_append(&writer, column_names[i], strlen(column_names[i]) + 1);
+            }
+
+            u64 padding = 0;
+            series_writer_append(&writer, &padding, header.names_size - names_size);
+        } break;
+        default: assert(!"Impossible");
+    }
+
+    return writer;
+}
+
+void series_writer_row(series_writer_t * writer, u64 * values)
+{
+    if (writer->format == SERIES_FORMAT_BINARY)
+    {
+        series_writer_append(writer, values, writer->num_columns * sizeof(u64));
+        return;
+    }
+
+    if (writer->buffer_used + SERIES_MAX_ROW_SIZE > SERIES_BUFFER_SIZE) series_writer_flush(writer);
+
+    char * current = (char *) writer->buffer + writer->buffer_used;
+    for (u32 i = 0; i < writer->num_columns; i++)
+    {
+        current += format_u64(current, values[i]);
+        *current++ = i + 1 < writer->num_columns ? ',' : '\n';
+    }
+
+    writer->buffer_used = (u8 *) current - writer->buffer;
+}
+
+void series_writer_close(series_writer_t * writer)
+{
+    series_writer_flush(writer);
+
+    if (writer->format == SERIES_FORMAT_CSV) fflush(writer->file);
+    else trace_writer_close(&writer->binary);
+}
@@ -59,7 +59,7 @@ device_t * tag_cache_init(arena_t * arena, char * initial_tags_filename, u32 siz
     return device;
 }
 
-device_t * controller_interface_init(arena_t * arena, char * output_filename)
+device_t * controller_interface_init(arena_t * arena, char * output_filename, bool compact_output)
 {
     device_t * device = arena_push(arena, sizeof(device_t));
     *device = (device_t) {0};
@@ -68,20 +68,11 @@ device_t * controller_interface_init(arena_t * arena, char * output_filename)
     u32 tag_table_size = MEMORY_SIZE / CAP_SIZE_BYTES / 8;
     device->controller_interface.tag_table.size = tag_table_size;
     device->controller_interface.tag_table.data = arena_push_array(arena, u8, tag_table_size);
-    device->controller_interface.tag_table.known = arena_push_array(arena, u8, tag_table_size);
-    for (i64 i = 0; i < tag_table_size; i++)
-    {
-        device->controller_interface.tag_table.data[i] = 0;
-        device->controller_interface.tag_table.known[i] = 0;
-    }
+    device->controller_interface.tag_table.known = arena_push_array(arena, u8, tag_table_size); // NOTE zeroed
 
+    // NOTE the caller confirms overwriting the output (before any other outputs are opened)
     assert(output_filename);
-    if (file_exists_not_fifo(output_filename))
-    {
-        if (!confirm_overwrite_file(output_filename)) quit();
-    }
-
-    device->controller_interface.output = trace_writer_open(arena, output_filename, guess_writer_type(output_filename));
+    device->controller_interface.output = requests_writer_open(arena, output_filename, compact_output);
 
     return device;
 }
@@ -101,14 +92,14 @@ static void controller_interface_write_entry(device_t * device, u8 type, u64 pad
     static_assert(CACHE_LINE_SIZE <= UINT16_MAX, "Invalid cache line size.");
     request.size = CACHE_LINE_SIZE;
 
-    trace_writer_emit(&device->controller_interface.output, &request, sizeof(request));
+    requests_writer_emit(&device->controller_interface.output, request);
 }
 
 static void controller_interface_cleanup(device_t * device)
 {
     assert(device->type == DEVICE_TYPE_CONTROLLER_INTERFACE);
 
-    trace_writer_close(&device->controller_interface.output);
+    requests_writer_close(&device->controller_interface.output);
 }
 
 static inline void tag_table_get_index(u32 tag_table_size, u64 paddr,
@@ -0,0 +1,258 @@
+#include "jdp.h"
+#include "hashmap.h"
+#include "sketch.h"
+
+#include <math.h>
+
+hll_t hll_create(arena_t * arena)
+{
+    hll_t hll = {0};
+    hll.registers = arena_push_array(arena, u8, HLL_NUM_REGISTERS);
+
+    return hll;
+}
+
+void hll_merge(hll_t dst, hll_t src)
+{
+    for (i64 i = 0; i < HLL_NUM_REGISTERS; i++)
+    {
+        if (src.registers[i] > dst.registers[i]) dst.registers[i] = src.registers[i];
+    }
+}
+
+// NOTE the sigma and tau functions from Ertl's paper, for the registers that are still zero and that are saturated
+static double hll_sigma(double x)
+{
+    assert(x >= 0 && x < 1);
+
+    double y = 1;
+    double z = x;
+    double prev_z;
+    do
+    {
+        x *= x;
+        prev_z = z;
+        z += x * y;
+        y += y;
+    } while (z != prev_z);
+
+    return z;
+}
+
+static double hll_tau(double x)
+{
+    assert(x >= 0 && x <= 1);
+    if (x == 0 || x == 1) return 0;
+
+    double y = 1;
+    double z = 1 - x;
+    double prev_z;
+    do
+    {
+        x = sqrt(x);
+        prev_z = z;
+        y *= 0.5;
+        z -= (1 - x) * (1 - x) * y;
+    } while (z != prev_z);
+
+    return z / 3;
+}
+
+u64 hll_estimate(hll_t hll)
+{
+    u64 rank_counts[HLL_MAX_RANK + 1] = {0};
+    for (i64 i = 0; i < HLL_NUM_REGISTERS; i++)
+    {
+        assert(hll.registers[i] <= HLL_MAX_RANK);
+        rank_counts[hll.registers[i]]++;
+    }
+
+    if (rank_counts[0] == HLL_NUM_REGISTERS) return 0;
+
+    double m = HLL_NUM_REGISTERS;
+    double z = m * hll_tau(1 - rank_counts[HLL_MAX_RANK] / m);
+    for (i64 rank = HLL_MAX_RANK - 1; rank >= 1; rank--)
+    {
+        z = 0.5 * (z + rank_counts[rank]);
+    }
+    z += m * hll_sigma(rank_counts[0] / m);
+
+    double alpha = 0.5 / log(2);
+    return (u64) llround(alpha * m * m / z);
+}
+
+double hll_standard_error(void)
+{
+    return 1.04 / sqrt(HLL_NUM_REGISTERS);
+}
+
+
+distinct_counter_t distinct_counter_create(arena_t * arena, distinct_counter_config_t config)
+{
+    distinct_counter_t counter = {0};
+    counter.mode = config.mode;
+
+    switch (config.mode)
+    {
+        case DISTINCT_COUNTER_EXACT: counter.exact = set_u64_create(); break;
+        case DISTINCT_COUNTER_APPROXIMATE: counter.hll = hll_create(arena); break;
+        case DISTINCT_COUNTER_EXTERNAL:
+        {
+            counter.external = external_set_create(config.memory_budget, config.spill_dir);
+        } break;
+        default: assert(!"Impossible.");
+    }
+
+    return counter;
+}
+
+void distinct_counter_cleanup(distinct_counter_t * counter)
+{
+    if (counter->mode == DISTINCT_COUNTER_EXACT) set_u64_cleanup(&counter->exact);
+    else if (counter->mode == DISTINCT_COUNTER_EXTERNAL) external_set_cleanup(&counter->external);
+}
+
+u64 distinct_counter_count(distinct_counter_t * counter)
+{
+    switch (counter->mode)
+    {
+        case DISTINCT_COUNTER_EXACT: return set_u64_size(counter->exact);
+        case DISTINCT_COUNTER_APPROXIMATE: return hll_estimate(counter->hll);
+        case DISTINCT_COUNTER_EXTERNAL: return external_set_count(&counter->external);
+        default: assert(!"Impossible.");
+    }
+
+    return 0;
+}
+
+double distinct_counter_standard_error(distinct_counter_t * counter)
+{
+    return counter->mode == DISTINCT_COUNTER_APPROXIMATE ? hll_standard_error() : 0;
+}
+
+
+count_min_t count_min_create(arena_t * arena, u32 width_bits)
+{
+    assert(width_bits > 0 && width_bits < 32);
+
+    count_min_t sketch = {0};
+    sketch.counters = arena_push_array(arena, u64, (u64) COUNT_MIN_DEPTH << width_bits);
+    sketch.width_bits = width_bits;
+
+    return sketch;
+}
+
+u64 count_min_error_bound(count_min_t * sketch)
+{
+    return (u64) ceil(M_E * sketch->total / ((u64) 1 << sketch->width_bits));
+}
+
+double count_min_error_probability(void)
+{
+    return exp(-COUNT_MIN_DEPTH);
+}
+
+
+static void top_k_swap(top_k_t * top_k, u64 a, u64 b)
+{
+    top_k_entry_t temp = top_k->heap[a];
+    top_k->heap[a] = top_k->heap[b];
+    top_k->heap[b] = temp;
+
+    map_u64_set(top_k->positions, top_k->heap[a].key, a);
+    map_u64_set(top_k->positions, top_k->heap[b].key, b);
+}
+
+static void top_k_sift_down(top_k_t * top_k, u64 idx)
+{
+    while (true)
+    {
+        u64 smallest = idx;
+        u64 left = 2 * idx + 1;
+        u64 right = 2 * idx + 2;
+
+        if (left < top_k->size && top_k->heap[left].count < top_k->heap[smallest].count) smallest = left;
+        if (right < top_k->size && top_k->heap[right].count < top_k->heap[smallest].count) smallest = right;
+        if (smallest == idx) break;
+
+        top_k_swap(top_k, idx, smallest);
+        idx = smallest;
+    }
+}
+
+top_k_t top_k_create(arena_t * arena, u64 capacity)
+{
+    assert(capacity > 0);
+
+    top_k_t top_k = {0};
+    top_k.heap = arena_push_array(arena, top_k_entry_t, capacity);
+    top_k.capacity = capacity;
+    top_k.positions = map_u64_create();
+
+    return top_k;
+}
+
+void top_k_cleanup(top_k_t * top_k)
+{
+    map_u64_cleanup(&top_k->positions);
+}
+
+void top_k_update(top_k_t * top_k, u64 key, u64 count)
+{
+    u64 idx;
+    if (map_u64_get(top_k->positions, key, &idx))
+    {
+        assert(count >= top_k->heap[idx].count);
+        top_k->heap[idx].count = count;
+        top_k_sift_down(top_k, idx);
+    }
+    else if (top_k->size < top_k->capacity)
+    {
+        idx = top_k->size++;
+        top_k->heap[idx] = (top_k_entry_t) { key, count };
+        map_u64_set(top_k->positions, key, idx);
+
+        // sift up
+        while (idx > 0 && top_k->heap[(idx - 1) / 2].count > top_k->heap[idx].count)
+        {
+            top_k_swap(top_k, idx, (idx - 1) / 2);
+            idx = (idx - 1) / 2;
+        }
+    }
+    else if (count > top_k->heap[0].count)
+    {
+        map_u64_remove(top_k->positions, top_k->heap[0].key);
+
+        top_k->heap[0] = (top_k_entry_t) { key, count };
+        map_u64_set(top_k->positions, key, 0);
+        top_k_sift_down(top_k, 0);
+    }
+}
+
+void top_k_sort(top_k_t * top_k)
+{
+    // heap sort: repeatedly move the smallest remaining entry to the end, leaving the entries in decreasing order
+    u64 size = top_k->size;
+    while (top_k->size > 1)
+    {
+        top_k_swap(top_k, 0, top_k->size - 1);
+        top_k->size--;
+        top_k_sift_down(top_k, 0);
+    }
+    top_k->size = size;
+}
+
+
+heavy_hitters_t heavy_hitters_create(arena_t * arena, u32 width_bits, u64 k)
+{
+    heavy_hitters_t heavy_hitters = {0};
+    heavy_hitters.sketch = count_min_create(arena, width_bits);
+    heavy_hitters.top_k = top_k_create(arena, k);
+
+    return heavy_hitters;
+}
+
+void heavy_hitters_cleanup(heavy_hitters_t * heavy_hitters)
+{
+    top_k_cleanup(&heavy_hitters->top_k);
+}
@@ -0,0 +1,136 @@
+#include "jdp.h"
+#include "common.h"
+#include "hashmap.h"
+#include "initial_state.h"
+#include "tag_density.h"
+
+#include <string.h>
+
+tag_density_t tag_density_create(arena_t * arena, u64 * region_sizes, u32 num_region_sizes)
+{
+    assert(num_region_sizes <= TAG_DENSITY_MAX_GRANULARITIES);
+
+    tag_density_t density = {0};
+    density.tagged_capabilities = bitset_create(arena, INITIAL_STATE_TABLE_SIZE);
+
+    for (u32 i = 0; i < num_region_sizes; i++)
+    {
+        u64 region_size = region_sizes[i];
+        assert(region_size >= CAP_SIZE_BYTES && region_size <= MEMORY_SIZE);
+        assert((region_size & (region_size - 1)) == 0);
+
+        tag_density_level_t * level = &density.levels[density.num_levels++];
+        level->region_size = region_size;
+        level->num_regions = MEMORY_SIZE / region_size;
+        level->region_num_capabilities = region_size / CAP_SIZE_BYTES;
+
+        if (level->region_num_capabilities > BITSET_WORD_BITS)
+        {
+            assert(level->region_num_capabilities <= UINT32_MAX);
+            level->tag_counts = arena_push_array(arena, u32, level->num_regions);
+        }
+    }
+
+    return density;
+}
+
+// NOTE mask of the capabilities in the same region as bit idx of a bitmap word (region within a word)
+static inline u64 tag_density_word_region_mask(tag_density_level_t * level, u64 idx)
+{
+    assert(level->region_num_capabilities <= BITSET_WORD_BITS);
+
+    u64 mask = level->region_num_capabilities == BITSET_WORD_BITS ?
+        ~(u64) 0 : ((u64) 1 << level->region_num_capabilities) - 1;
+    u64 first_bit = align_floor_pow_2(idx % BITSET_WORD_BITS, level->region_num_capabilities);
+
+    return mask << first_bit;
+}
+
+void tag_density_recount(tag_density_t * density)
+{
+    density->num_capabilities_tagged = 0;
+    for (u32 i = 0; i < density->num_levels; i++)
+    {
+        tag_density_level_t * level = &density->levels[i];
+        level->num_regions_tagged = 0;
+        if (level->tag_counts) memset(level->tag_counts, 0, level->num_regions * sizeof(u32));
+    }
+
+    u64 num_words = align_ceil_pow_2(density->tagged_capabilities.num_bits, BITSET_WORD_BITS) / BITSET_WORD_BITS;
+    for (u64 word_idx = 0; word_idx < num_words; word_idx++)
+    {
+        u64 tags = density->tagged_capabilities.words[word_idx];
+        if (tags == 0) continue;
+
+        u64 num_tags = __builtin_popcountll(tags);
+        density->num_capabilities_tagged += num_tags;
+
+        u64 first_idx = word_idx * BITSET_WORD_BITS;
+        for (u32 i = 0; i < density->num_levels; i++)
+        {
+            tag_density_level_t * level = &density->levels[i];
+
+            if (level->tag_counts)
+            {
+                u64 region_idx = first_idx / level->region_num_capabilities;
+                if (level->tag_counts[region_idx] == 0) level->num_regions_tagged++;
+                level->tag_counts[region_idx] += num_tags;
+            }
+            else
+            {
+                for (u64 bit = 0; bit < BITSET_WORD_BITS; bit += level->region_num_capabilities)
+                {
+                    if (tags & tag_density_word_region_mask(level, bit)) level->num_regions_tagged++;
+                }
+            }
+        }
+    }
+}
+
+void tag_density_update(tag_density_t * density, u64 addr, bool tag_set)
+{
+    i64 table_idx = initial_state_get_index(addr);
+    if (bitset_test(density->tagged_capabilities, table_idx) == tag_set) return;
+
+    u64 * word = &density->tagged_capabilities.words[table_idx / BITSET_WORD_BITS];
+    u64 old_tags = *word;
+    bitset_assign(density->tagged_capabilities, table_idx, tag_set);
+    u64 new_tags = *word;
+
+    if (tag_set) density->num_capabilities_tagged++;
+    else density->num_capabilities_tagged--;
+
+    for (u32 i = 0; i < density->num_levels; i++)
+    {
+        tag_density_level_t * level = &density->levels[i];
+
+        bool was_tagged, now_tagged;
+        if (level->tag_counts)
+        {
+            u32 * tag_count = &level->tag_counts[table_idx / level->region_num_capabilities];
+            was_tagged = *tag_count > 0;
+
+            if (tag_set) (*tag_count)++;
+            else
+            {
+                assert(*tag_count > 0);
+                (*tag_count)--;
+            }
+
+            now_tagged = *tag_count > 0;
+        }
+        else
+        {
+            u64 mask = tag_density_word_region_mask(level, table_idx);
+            was_tagged = (old_tags & mask) != 0;
+            now_tagged = (new_tags & mask) != 0;
+        }
+
+        if (!was_tagged && now_tagged) level->num_regions_tagged++;
+        else if (was_tagged && !now_tagged)
+        {
+            assert(level->num_regions_tagged > 0);
+            level->num_regions_tagged--;
+        }
+    }
+}
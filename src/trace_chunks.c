@@ -0,0 +1,410 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "jdp.h"
+#include "utils.h"
+#include "trace_chunks.h"
+
+#include <stdio.h>
+#include <pthread.h>
+#include <lz4.h>
+
+#define LZ4_FRAME_MAGIC                 0x184D2204
+#define LZ4_SKIPPABLE_FRAME_MAGIC       0x184D2A50
+#define LZ4_SKIPPABLE_FRAME_MAGIC_MASK  0xFFFFFFF0
+#define LZ4_BLOCK_UNCOMPRESSED_BIT      0x80000000
+#define LZ4_FLG_BLOCK_INDEPENDENCE      0x20
+#define LZ4_FLG_BLOCK_CHECKSUM          0x10
+#define LZ4_FLG_CONTENT_SIZE            0x08
+#define LZ4_FLG_CONTENT_CHECKSUM        0x04
+#define LZ4_FLG_DICT_ID                 0x01
+
+#define GZIP_MAGIC_0                    0x1F
+#define GZIP_MAGIC_1                    0x8B
+
+
+static bool read_exact(int fd, void * buffer, u64 size, u64 offset)
+{
+    u8 * buffer_ptr = (u8 *) buffer;
+    while (size > 0)
+    {
+        ssize_t bytes_read = pread(fd, buffer_ptr, size, offset);
+        if (bytes_read <= 0) return false;
+
+        buffer_ptr += bytes_read;
+        offset += bytes_read;
+        size -= bytes_read;
+    }
+
+    return true;
+}
+
+static u32 read_u32_le(u8 * bytes)
+{
+    return (u32) bytes[0] | ((u32) bytes[1] << 8) | ((u32) bytes[2] << 16) | ((u32) bytes[3] << 24);
+}
+
+static void trace_chunks_add(trace_chunks_t * chunks, trace_chunk_t chunk, u32 num_blocks)
+{
+    // NOTE with no chunk array, this is just counting them
+    if (chunks->chunks) chunks->chunks[chunks->num_chunks] = chunk;
+    chunks->num_chunks++;
+
+    u64 max_decoded_size = chunks->encoding == TRACE_CHUNKS_ENCODING_LZ4 ? (u64) num_blocks * chunk.block_max_size : chunk.size;
+    if (chunk.size > chunks->max_chunk_size) chunks->max_chunk_size = chunk.size;
+    if (max_decoded_size > chunks->max_decoded_size) chunks->max_decoded_size = max_decoded_size;
+}
+
+// NOTE returns false if any frame cannot be split up (or the file is not valid LZ4)
+static bool trace_chunks_scan_lz4(trace_chunks_t * chunks, u64 file_size)
+{
+    u64 offset = 0;
+    while (offset < file_size)
+    {
+        u8 header[4 + 2 + 8 + 4 + 1] = {0};
+        u64 header_size = file_size - offset < sizeof(header) ? file_size - offset : sizeof(header);
+        if (header_size < 7 || !read_exact(chunks->fd, header, header_size, offset)) return false;
+
+        u32 magic = read_u32_le(header);
+        if ((magic & LZ4_SKIPPABLE_FRAME_MAGIC_MASK) == LZ4_SKIPPABLE_FRAME_MAGIC)
+        {
+            offset += 8 + read_u32_le(&header[4]);
+            continue;
+        }
+        if (magic != LZ4_FRAME_MAGIC) return false;
+
+        u8 flags = header[4];
+        u8 block_size_id = (header[5] >> 4) & 0x7;
+        if ((flags >> 6) != 1 || block_size_id < 4) return false;
+        if (!(flags & LZ4_FLG_BLOCK_INDEPENDENCE) || (flags & LZ4_FLG_DICT_ID)) return false;
+
+        trace_chunk_t chunk = {0};
+        chunk.block_max_size = 1 << (8 + 2 * block_size_id);
+        chunk.block_checksums = (flags & LZ4_FLG_BLOCK_CHECKSUM) != 0;
+
+        offset += 4 + 2 + ((flags & LZ4_FLG_CONTENT_SIZE) ? 8 : 0) + 1;
+
+        u32 blocks_per_chunk = TRACE_CHUNK_SIZE / chunk.block_max_size;
+        if (blocks_per_chunk == 0) blocks_per_chunk = 1;
+
+        u64 chunk_start = offset;
+        u32 num_blocks = 0;
+        while (true)
+        {
+            u8 block_header[4];
+            if (!read_exact(chunks->fd, block_header, sizeof(block_header), offset)) return false;
+
+            u32 block_size = read_u32_le(block_header) & ~LZ4_BLOCK_UNCOMPRESSED_BIT;
+            if (block_size == 0) break; // NOTE end mark
+
+            offset += sizeof(block_header) + block_size + (chunk.block_checksums ? 4 : 0);
+            num_blocks++;
+
+            if (num_blocks == blocks_per_chunk)
+            {
+                chunk.offset = chunk_start;
+                chunk.size = offset - chunk_start;
+                trace_chunks_add(chunks, chunk, num_blocks);
+
+                chunk_start = offset;
+                num_blocks = 0;
+            }
+        }
+
+        if (num_blocks > 0)
+        {
+            chunk.offset = chunk_start;
+            chunk.size = offset - chunk_start;
+            trace_chunks_add(chunks, chunk, num_blocks);
+        }
+
+        offset += 4 + ((flags & LZ4_FLG_CONTENT_CHECKSUM) ? 4 : 0);
+    }
+
+    return offset == file_size;
+}
+
+bool trace_chunks_open(arena_t * arena, char * filename, trace_chunks_t * chunks)
+{
+    *chunks = (trace_chunks_t) {0};
+
+    // NOTE e.g. a pipe, which can only be read in order (and should not be opened twice)
+    struct stat file_stat;
+    if (stat(filename, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) return false;
+    u64 file_size = file_stat.st_size;
+
+    chunks->fd = open(filename, O_RDONLY);
+    if (chunks->fd == -1)
+    {
+        printf("ERROR: Unable to open file \"%s\".\n", filename);
+        quit();
+    }
+
+    u8 magic[4] = {0};
+    if (file_size >= sizeof(magic) && !read_exact(chunks->fd, magic, sizeof(magic), 0))
+    {
+        printf("ERROR: Unable to read file \"%s\".\n", filename);
+        quit();
+    }
+
+    if (magic[0] == GZIP_MAGIC_0 && magic[1] == GZIP_MAGIC_1)
+    {
+        close(chunks->fd);
+        return false;
+    }
+
+    u32 magic_u32 = read_u32_le(magic);
+    if (magic_u32 == LZ4_FRAME_MAGIC || (magic_u32 & LZ4_SKIPPABLE_FRAME_MAGIC_MASK) == LZ4_SKIPPABLE_FRAME_MAGIC)
+    {
+        chunks->encoding = TRACE_CHUNKS_ENCODING_LZ4;
+
+        // counting, then filling in the chunks
+        bool success = trace_chunks_scan_lz4(chunks, file_size);
+        if (success)
+        {
+            chunks->chunks = arena_push_array(arena, trace_chunk_t, chunks->num_chunks);
+            chunks->num_chunks = 0;
+            success = trace_chunks_scan_lz4(chunks, file_size);
+            assert(success);
+        }
+
+        if (!success)
+        {
+            fprintf(stderr, "WARNING: \"%s\" has LZ4 frames with linked blocks, so it cannot be split up.\n", filename);
+            close(chunks->fd);
+
+            // NOTE encoding is left as LZ4 for the caller
+            chunks->chunks = NULL;
+            chunks->num_chunks = 0;
+            return false;
+        }
+    }
+    else
+    {
+        chunks->encoding = TRACE_CHUNKS_ENCODING_UNCOMPRESSED;
+
+        u64 num_chunks = (file_size + TRACE_CHUNK_SIZE - 1) / TRACE_CHUNK_SIZE;
+        chunks->chunks = arena_push_array(arena, trace_chunk_t, num_chunks);
+        for (u64 offset = 0; offset < file_size; offset += TRACE_CHUNK_SIZE)
+        {
+            trace_chunk_t chunk = {0};
+            chunk.offset = offset;
+            chunk.size = file_size - offset < TRACE_CHUNK_SIZE ? file_size - offset : TRACE_CHUNK_SIZE;
+            trace_chunks_add(chunks, chunk, 0);
+        }
+        assert(chunks->num_chunks == num_chunks);
+    }
+
+    return true;
+}
+
+void trace_chunks_close(trace_chunks_t * chunks)
+{
+    assert(chunks->fd != -1);
+    close(chunks->fd);
+    chunks->fd = -1;
+}
+
+// NOTE returns the number of bytes decoded, file_buffer is only needed for compressed chunks
+u64 trace_chunk_decode(trace_chunks_t * chunks, trace_chunk_t * chunk, u8 * file_buffer, u8 * decoded_buffer)
+{
+    if (chunks->encoding == TRACE_CHUNKS_ENCODING_UNCOMPRESSED)
+    {
+        if (!read_exact(chunks->fd, decoded_buffer, chunk->size, chunk->offset))
+        {
+            printf("ERROR: Unable to read %lu bytes at offset %lu.\n", chunk->size, chunk->offset);
+            quit();
+        }
+        return chunk->size;
+    }
+
+    assert(chunks->encoding == TRACE_CHUNKS_ENCODING_LZ4);
+    if (!read_exact(chunks->fd, file_buffer, chunk->size, chunk->offset))
+    {
+        printf("ERROR: Unable to read %lu bytes at offset %lu.\n", chunk->size, chunk->offset);
+        quit();
+    }
+
+    u8 * src = file_buffer;
+    u8 * src_end = file_buffer + chunk->size;
+    u64 decoded_size = 0;
+    while (src < src_end)
+    {
+        u32 block_header = read_u32_le(src);
+        u32 block_size = block_header & ~LZ4_BLOCK_UNCOMPRESSED_BIT;
+        src += 4;
+        assert(src + block_size <= src_end);
+
+        if (block_header & LZ4_BLOCK_UNCOMPRESSED_BIT)
+        {
+            assert(block_size <= chunk->block_max_size);
+            memcpy(decoded_buffer + decoded_size, src, block_size);
+            decoded_size += block_size;
+        }
+        else
+        {
+            int result = LZ4_decompress_safe((const char *) src, (char *) decoded_buffer + decoded_size,
+                block_size, chunk->block_max_size);
+            if (result < 0)
+            {
+                printf("ERROR: Failed to decompress LZ4 block at offset %lu.\n", chunk->offset + (src - file_buffer) - 4);
+                quit();
+            }
+            decoded_size += result;
+        }
+
+        // NOTE block checksums are skipped, not verified
+        src += block_size + (chunk->block_checksums ? 4 : 0);
+    }
+
+    return decoded_size;
+}
+
+
+typedef struct trace_chunk_fragments_t trace_chunk_fragments_t;
+struct trace_chunk_fragments_t // NOTE the parts of entries straddling the start and end of a chunk
+{
+    u8 head[sizeof(custom_trace_entry_t)];
+    u8 tail[sizeof(custom_trace_entry_t)];
+    u32 head_size;
+    u32 tail_size;
+};
+
+typedef struct trace_chunks_job_t trace_chunks_job_t;
+struct trace_chunks_job_t
+{
+    trace_chunks_t * chunks;
+    trace_chunk_fragments_t * fragments;
+    trace_chunks_entries_func_t func;
+
+    u64 next_chunk;
+
+    // NOTE decoded sizes are published in chunk order, giving each chunk its offset in the decoded trace
+    pthread_mutex_t lock;
+    pthread_cond_t published_cond;
+    u64 num_published;
+    u64 published_offset;
+};
+
+typedef struct trace_chunks_worker_t trace_chunks_worker_t;
+struct trace_chunks_worker_t
+{
+    trace_chunks_job_t * job;
+    void * data;
+    pthread_t thread;
+};
+
+static void * trace_chunks_worker(void * data)
+{
+    trace_chunks_worker_t * worker = (trace_chunks_worker_t *) data;
+    trace_chunks_job_t * job = worker->job;
+    trace_chunks_t * chunks = job->chunks;
+
+    arena_t * scratch = arena_get_scratch(NULL);
+    arena_temp_t temp = arena_temp_begin(scratch);
+
+    u8 * file_buffer = chunks->encoding == TRACE_CHUNKS_ENCODING_LZ4 ?
+        arena_push_array(scratch, u8, chunks->max_chunk_size) : NULL;
+    u8 * decoded_buffer = arena_push_array(scratch, u8, chunks->max_decoded_size);
+
+    while (true)
+    {
+        // NOTE chunks are claimed in order, so the chunk before this one has always been claimed already
+        u64 chunk_idx = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk_idx >= chunks->num_chunks) break;
+
+        u64 decoded_size = trace_chunk_decode(chunks, &chunks->chunks[chunk_idx], file_buffer, decoded_buffer);
+
+        pthread_mutex_lock(&job->lock);
+        while (job->num_published != chunk_idx) pthread_cond_wait(&job->published_cond, &job->lock);
+        u64 start_offset = job->published_offset;
+        job->published_offset += decoded_size;
+        job->num_published++;
+        pthread_cond_broadcast(&job->published_cond);
+        pthread_mutex_unlock(&job->lock);
+
+        u64 entry_size = sizeof(custom_trace_entry_t);
+        u64 head_size = (entry_size - start_offset % entry_size) % entry_size;
+        if (head_size > decoded_size) head_size = decoded_size;
+        u64 num_entries = (decoded_size - head_size) / entry_size;
+        u64 tail_size = decoded_size - head_size - num_entries * entry_size;
+
+        trace_chunk_fragments_t * fragments = &job->fragments[chunk_idx];
+        memcpy(fragments->head, decoded_buffer, head_size);
+        memcpy(fragments->tail, decoded_buffer + decoded_size - tail_size, tail_size);
+        fragments->head_size = head_size;
+        fragments->tail_size = tail_size;
+
+        if (num_entries > 0) job->func(worker->data, (custom_trace_entry_t *) (decoded_buffer + head_size), num_entries);
+    }
+
+    arena_temp_end(temp);
+    arena_release_scratch();
+
+    return NULL;
+}
+
+// NOTE worker_data has one entry per thread, the entries straddling chunks are passed on with the first one
+void trace_chunks_process(arena_t * arena, trace_chunks_t * chunks, u32 num_threads, trace_chunks_entries_func_t func,
+    void ** worker_data)
+{
+    assert(num_threads > 0);
+
+    trace_chunks_job_t job = {0};
+    job.chunks = chunks;
+    job.fragments = arena_push_array(arena, trace_chunk_fragments_t, chunks->num_chunks);
+    job.func = func;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.published_cond, NULL);
+
+    trace_chunks_worker_t * workers = arena_push_array(arena, trace_chunks_worker_t, num_threads);
+    for (u32 i = 0; i < num_threads; i++)
+    {
+        workers[i].job = &job;
+        workers[i].data = worker_data[i];
+
+        int result = pthread_create(&workers[i].thread, NULL, trace_chunks_worker, &workers[i]);
+        assert(result == 0);
+    }
+
+    for (u32 i = 0; i < num_threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    // NOTE an entry can straddle more than one chunk boundary if chunks are smaller than entries
+    custom_trace_entry_t entry;
+    u64 entry_bytes = 0;
+    for (u64 i = 0; i < chunks->num_chunks; i++)
+    {
+        trace_chunk_fragments_t * fragments = &job.fragments[i];
+
+        assert(entry_bytes + fragments->head_size <= sizeof(entry));
+        memcpy((u8 *) &entry + entry_bytes, fragments->head, fragments->head_size);
+        entry_bytes += fragments->head_size;
+
+        if (entry_bytes == sizeof(entry))
+        {
+            func(worker_data[0], &entry, 1);
+            entry_bytes = 0;
+        }
+
+        if (fragments->tail_size > 0)
+        {
+            assert(entry_bytes == 0);
+            memcpy(&entry, fragments->tail, fragments->tail_size);
+            entry_bytes = fragments->tail_size;
+        }
+    }
+
+    if (entry_bytes != 0)
+    {
+        printf("ERROR: trace ended partway through an entry (%lu trailing bytes).\n", entry_bytes);
+    }
+
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.published_cond);
+}
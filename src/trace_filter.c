@@ -0,0 +1,197 @@
+#include "jdp.h"
+#include "common.h"
+#include "trace.h"
+#include "trace_filter.h"
+
+#include <string.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+ #include <immintrin.h>
+ #define TRACE_FILTER_X86 1
+#endif
+
+static_assert(NUM_CUSTOM_TRACE_TYPES <= 8, "Trace types must fit in the type mask.");
+static_assert(sizeof(custom_trace_entry_t) == 24, "Custom trace entries are expected to be 24 bytes.");
+static_assert(offsetof(custom_trace_entry_t, type) == 0 && offsetof(custom_trace_entry_t, tag) == 1
+    && offsetof(custom_trace_entry_t, size) == 2, "Type, tag and size are expected in the bottom bytes of the first word.");
+static_assert(offsetof(custom_trace_entry_t, vaddr) == 8 && offsetof(custom_trace_entry_t, paddr) == 16,
+    "Addresses are expected in the second and third words.");
+
+trace_filter_t trace_filter_all(void)
+{
+    trace_filter_t filter = {0};
+    filter.type_mask = (1 << NUM_CUSTOM_TRACE_TYPES) - 1;
+    filter.tag_mask = 0x3;
+    filter.paddr_valid_mask = 0x3;
+    filter.paddr_start = 0;
+    filter.paddr_last = UINT64_MAX;
+    filter.vaddr_start = 0;
+    filter.vaddr_last = UINT64_MAX;
+
+    return filter;
+}
+
+bool trace_filter_is_all(trace_filter_t * filter)
+{
+    trace_filter_t all = trace_filter_all();
+
+    return filter->type_mask == all.type_mask
+        && filter->tag_mask == all.tag_mask
+        && filter->paddr_valid_mask == all.paddr_valid_mask
+        && filter->paddr_start == all.paddr_start && filter->paddr_last == all.paddr_last
+        && filter->vaddr_start == all.vaddr_start && filter->vaddr_last == all.vaddr_last;
+}
+
+// NOTE only entries below start need their end computed, so this cannot overflow for any real range
+static inline u32 trace_filter_overlaps(u64 addr, u64 size, u64 start, u64 last)
+{
+    return (addr <= last) & ((addr >= start) | (addr + size > start));
+}
+
+// NOTE bit i is set if entry i (of up to 64) is kept, for entries [start, end)
+static u64 trace_filter_mask_scalar(trace_filter_t * filter, custom_trace_entry_t * entries, u64 start, u64 end)
+{
+    assert(end <= 64);
+
+    u32 type_mask = filter->type_mask;
+    u32 tag_mask = filter->tag_mask;
+    u32 paddr_valid_mask = filter->paddr_valid_mask;
+
+    u64 mask = 0;
+    for (u64 i = start; i < end; i++)
+    {
+        custom_trace_entry_t * entry = &entries[i];
+
+        u32 keep = (entry->type < 8)
+            & (type_mask >> (entry->type & 7))
+            & (tag_mask >> (entry->tag & 1))
+            & (paddr_valid_mask >> check_paddr_valid(entry->paddr))
+            & trace_filter_overlaps(entry->paddr, entry->size, filter->paddr_start, filter->paddr_last)
+            & trace_filter_overlaps(entry->vaddr, entry->size, filter->vaddr_start, filter->vaddr_last);
+
+        mask |= (u64) (keep & 1) << i;
+    }
+
+    return mask;
+}
+
+#if TRACE_FILTER_X86
+// NOTE there are no unsigned 64-bit compares, so addresses have their sign bits flipped and are compared signed
+
+__attribute__((target("avx2")))
+static inline __m256i trace_filter_overlaps_avx2(__m256i addr_flipped, __m256i end_flipped,
+    __m256i start_flipped, __m256i last_flipped)
+{
+    __m256i after_last = _mm256_cmpgt_epi64(addr_flipped, last_flipped);
+    __m256i before_start = _mm256_cmpgt_epi64(start_flipped, addr_flipped);
+    __m256i ends_after_start = _mm256_cmpgt_epi64(end_flipped, start_flipped);
+
+    // NOTE !after_last & (!before_start | ends_after_start)
+    return _mm256_andnot_si256(after_last, _mm256_or_si256(_mm256_xor_si256(before_start, _mm256_set1_epi64x(-1)),
+        ends_after_start));
+}
+
+__attribute__((target("avx2")))
+static u64 trace_filter_mask_avx2(trace_filter_t * filter, custom_trace_entry_t * entries, u64 num_entries)
+{
+    assert(num_entries <= 64);
+
+    // NOTE gathers 4 entries at a time, indices are in words (each entry is 3 words)
+    const __m256i entry_words = _mm256_setr_epi64x(0, 3, 6, 9);
+    const __m256i byte_mask = _mm256_set1_epi64x(0xFF);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i sign_bit = _mm256_set1_epi64x(INT64_MIN);
+
+    // NOTE each of these masks is shifted right by the entry's field (variable shifts of 64 or more give 0)
+    const __m256i type_mask = _mm256_set1_epi64x(filter->type_mask);
+    const __m256i tag_mask = _mm256_set1_epi64x(filter->tag_mask);
+    const __m256i paddr_valid_mask = _mm256_set1_epi64x(filter->paddr_valid_mask);
+
+    const __m256i base_paddr = _mm256_set1_epi64x(BASE_PADDR);
+    const __m256i memory_size_flipped = _mm256_set1_epi64x(MEMORY_SIZE ^ INT64_MIN);
+
+    const __m256i paddr_start_flipped = _mm256_set1_epi64x(filter->paddr_start ^ INT64_MIN);
+    const __m256i paddr_last_flipped = _mm256_set1_epi64x(filter->paddr_last ^ INT64_MIN);
+    const __m256i vaddr_start_flipped = _mm256_set1_epi64x(filter->vaddr_start ^ INT64_MIN);
+    const __m256i vaddr_last_flipped = _mm256_set1_epi64x(filter->vaddr_last ^ INT64_MIN);
+
+    u64 mask = 0;
+    u64 i = 0;
+    for (; i + 4 <= num_entries; i += 4)
+    {
+        const long long * words = (const long long *) &entries[i];
+        __m256i header = _mm256_i64gather_epi64(words, entry_words, 8);
+        __m256i vaddr = _mm256_i64gather_epi64(words + 1, entry_words, 8);
+        __m256i paddr = _mm256_i64gather_epi64(words + 2, entry_words, 8);
+
+        __m256i type = _mm256_and_si256(header, byte_mask);
+        __m256i tag = _mm256_and_si256(_mm256_srli_epi64(header, 8), one);
+        __m256i size = _mm256_and_si256(_mm256_srli_epi64(header, 16), _mm256_set1_epi64x(0xFFFF));
+
+        __m256i paddr_offset_flipped = _mm256_xor_si256(_mm256_sub_epi64(paddr, base_paddr), sign_bit);
+        __m256i paddr_valid = _mm256_and_si256(_mm256_cmpgt_epi64(memory_size_flipped, paddr_offset_flipped), one);
+
+        __m256i keep_bits = _mm256_and_si256(_mm256_srlv_epi64(type_mask, type), _mm256_srlv_epi64(tag_mask, tag));
+        keep_bits = _mm256_and_si256(keep_bits, _mm256_srlv_epi64(paddr_valid_mask, paddr_valid));
+        __m256i keep = _mm256_cmpeq_epi64(_mm256_and_si256(keep_bits, one), one);
+
+        __m256i paddr_flipped = _mm256_xor_si256(paddr, sign_bit);
+        __m256i paddr_end_flipped = _mm256_xor_si256(_mm256_add_epi64(paddr, size), sign_bit);
+        keep = _mm256_and_si256(keep, trace_filter_overlaps_avx2(paddr_flipped, paddr_end_flipped,
+            paddr_start_flipped, paddr_last_flipped));
+
+        __m256i vaddr_flipped = _mm256_xor_si256(vaddr, sign_bit);
+        __m256i vaddr_end_flipped = _mm256_xor_si256(_mm256_add_epi64(vaddr, size), sign_bit);
+        keep = _mm256_and_si256(keep, trace_filter_overlaps_avx2(vaddr_flipped, vaddr_end_flipped,
+            vaddr_start_flipped, vaddr_last_flipped));
+
+        mask |= (u64) _mm256_movemask_pd(_mm256_castsi256_pd(keep)) << i;
+    }
+
+    return mask | trace_filter_mask_scalar(filter, entries, i, num_entries);
+}
+#endif
+
+u64 trace_filter_batch(trace_filter_t * filter, custom_trace_entry_t * entries, u64 num_entries,
+    custom_trace_entry_t * output)
+{
+#if TRACE_FILTER_X86
+    bool use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    u64 num_kept = 0;
+    for (u64 first_idx = 0; first_idx < num_entries; first_idx += 64)
+    {
+        u64 num_group = num_entries - first_idx < 64 ? num_entries - first_idx : 64;
+#if TRACE_FILTER_X86
+        u64 mask = use_avx2 ?
+            trace_filter_mask_avx2(filter, &entries[first_idx], num_group) :
+            trace_filter_mask_scalar(filter, &entries[first_idx], 0, num_group);
+#else
+        u64 mask = trace_filter_mask_scalar(filter, &entries[first_idx], 0, num_group);
+#endif
+
+        u64 full_mask = num_group == 64 ? ~(u64) 0 : ((u64) 1 << num_group) - 1;
+        if (mask == full_mask)
+        {
+            // NOTE may overlap when filtering in place
+            if (&output[num_kept] != &entries[first_idx])
+            {
+                memmove(&output[num_kept], &entries[first_idx], num_group * sizeof(custom_trace_entry_t));
+            }
+            num_kept += num_group;
+        }
+        else
+        {
+            while (mask != 0)
+            {
+                u64 idx = __builtin_ctzll(mask);
+                output[num_kept++] = entries[first_idx + idx];
+                mask &= mask - 1;
+            }
+        }
+    }
+
+    return num_kept;
+}
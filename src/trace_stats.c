@@ -0,0 +1,201 @@
+#include "jdp.h"
+#include "trace.h"
+#include "common.h"
+#include "trace_stats.h"
+
+#include <stdio.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+ #include <immintrin.h>
+ #define TRACE_STATS_X86 1
+#endif
+
+static_assert(sizeof(custom_trace_entry_t) == 24, "Custom trace entries are expected to be 24 bytes.");
+static_assert(offsetof(custom_trace_entry_t, type) == 0 && offsetof(custom_trace_entry_t, tag) == 1,
+    "Type and tag are expected in the bottom bytes of the first word.");
+static_assert(offsetof(custom_trace_entry_t, vaddr) == 8 && offsetof(custom_trace_entry_t, paddr) == 16,
+    "Addresses are expected in the second and third words.");
+
+typedef struct trace_stats_masks_t trace_stats_masks_t;
+struct trace_stats_masks_t // NOTE bit i is set if entry i of the block has the property
+{
+    u64 types[NUM_CUSTOM_TRACE_TYPES];
+    u64 no_paddr;
+    u64 invalid_paddr;
+    u64 paddr_matches_vaddr;
+    u64 tag_set;
+    u64 tag_invalid; // NOTE tag other than 0 or 1
+};
+
+static void trace_stats_masks_build_scalar(trace_stats_masks_t * masks, custom_trace_entry_t * entries, u64 start, u64 end)
+{
+    for (u64 i = start; i < end; i++)
+    {
+        custom_trace_entry_t * entry = &entries[i];
+
+        for (u8 type = 0; type < NUM_CUSTOM_TRACE_TYPES; type++)
+        {
+            masks->types[type] |= (u64) (entry->type == type) << i;
+        }
+
+        masks->no_paddr |= (u64) (entry->paddr == 0) << i;
+        masks->invalid_paddr |= (u64) !check_paddr_valid(entry->paddr) << i;
+        masks->paddr_matches_vaddr |= (u64) (entry->vaddr == entry->paddr) << i;
+        masks->tag_set |= (u64) (entry->tag != 0) << i;
+        masks->tag_invalid |= (u64) (entry->tag > 1) << i;
+    }
+}
+
+#if TRACE_STATS_X86
+__attribute__((target("avx2")))
+static inline u64 movemask_u64(__m256i mask)
+{
+    return (u64) _mm256_movemask_pd(_mm256_castsi256_pd(mask));
+}
+
+__attribute__((target("avx2")))
+static void trace_stats_masks_build_avx2(trace_stats_masks_t * masks, custom_trace_entry_t * entries, u64 num_entries)
+{
+    // NOTE gathers 4 entries at a time, indices are in words (each entry is 3 words)
+    const __m256i entry_words = _mm256_setr_epi64x(0, 3, 6, 9);
+    const __m256i byte_mask = _mm256_set1_epi64x(0xFF);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi64x(1);
+
+    // NOTE there are no unsigned 64-bit compares, so the range check flips the sign bits and compares signed
+    const __m256i sign_bit = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i base_paddr = _mm256_set1_epi64x(BASE_PADDR);
+    const __m256i memory_size_flipped = _mm256_set1_epi64x(MEMORY_SIZE ^ INT64_MIN);
+
+    u64 i = 0;
+    for (; i + 4 <= num_entries; i += 4)
+    {
+        const long long * words = (const long long *) &entries[i];
+        __m256i header = _mm256_i64gather_epi64(words, entry_words, 8);
+        __m256i vaddr = _mm256_i64gather_epi64(words + 1, entry_words, 8);
+        __m256i paddr = _mm256_i64gather_epi64(words + 2, entry_words, 8);
+
+        __m256i type = _mm256_and_si256(header, byte_mask);
+        __m256i tag = _mm256_and_si256(_mm256_srli_epi64(header, 8), byte_mask);
+
+        for (u8 type_idx = 0; type_idx < NUM_CUSTOM_TRACE_TYPES; type_idx++)
+        {
+            __m256i is_type = _mm256_cmpeq_epi64(type, _mm256_set1_epi64x(type_idx));
+            masks->types[type_idx] |= movemask_u64(is_type) << i;
+        }
+
+        __m256i paddr_offset_flipped = _mm256_xor_si256(_mm256_sub_epi64(paddr, base_paddr), sign_bit);
+        __m256i paddr_valid = _mm256_cmpgt_epi64(memory_size_flipped, paddr_offset_flipped);
+
+        masks->no_paddr |= movemask_u64(_mm256_cmpeq_epi64(paddr, zero)) << i;
+        masks->invalid_paddr |= (movemask_u64(paddr_valid) ^ 0xF) << i;
+        masks->paddr_matches_vaddr |= movemask_u64(_mm256_cmpeq_epi64(vaddr, paddr)) << i;
+        masks->tag_set |= (movemask_u64(_mm256_cmpeq_epi64(tag, zero)) ^ 0xF) << i;
+        masks->tag_invalid |= movemask_u64(_mm256_cmpgt_epi64(tag, one)) << i;
+    }
+
+    trace_stats_masks_build_scalar(masks, entries, i, num_entries);
+}
+#endif
+
+static void trace_stats_add_masks(trace_stats_t * stats, trace_stats_masks_t * masks, u64 num_entries)
+{
+    assert(num_entries > 0 && num_entries <= TRACE_STATS_BLOCK_SIZE);
+    u64 entries_mask = num_entries == 64 ? UINT64_MAX : ((u64) 1 << num_entries) - 1;
+
+    u64 known_types = 0;
+    for (i64 type = 0; type < NUM_CUSTOM_TRACE_TYPES; type++) known_types |= masks->types[type];
+    if (known_types != entries_mask) assert(!"Impossible.");
+
+    assert((masks->tag_set & masks->types[CUSTOM_TRACE_TYPE_STORE]) == 0);
+    assert((masks->tag_invalid & (masks->types[CUSTOM_TRACE_TYPE_CLOAD] | masks->types[CUSTOM_TRACE_TYPE_CSTORE])) == 0);
+    assert((masks->paddr_matches_vaddr & masks->no_paddr) == 0);
+
+    stats->num_entries += num_entries;
+    stats->num_entries_no_paddr += __builtin_popcountll(masks->no_paddr);
+    stats->num_entries_invalid_paddr += __builtin_popcountll(masks->invalid_paddr);
+
+    stats->num_entries_paddr_matches_vaddr += __builtin_popcountll(masks->paddr_matches_vaddr);
+    stats->num_entries_invalid_paddr_matches_vaddr += __builtin_popcountll(masks->paddr_matches_vaddr & masks->invalid_paddr);
+
+    for (i64 type = 0; type < NUM_CUSTOM_TRACE_TYPES; type++)
+    {
+        trace_type_stats_t * type_stats = &stats->types[type];
+        type_stats->num_entries += __builtin_popcountll(masks->types[type]);
+        type_stats->num_no_paddr += __builtin_popcountll(masks->types[type] & masks->no_paddr);
+        type_stats->num_invalid_paddr += __builtin_popcountll(masks->types[type] & masks->invalid_paddr);
+    }
+}
+
+void update_trace_stats(trace_stats_t * stats, custom_trace_entry_t * entries, u64 num_entries)
+{
+#if TRACE_STATS_X86
+    bool use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    for (u64 start = 0; start < num_entries; start += TRACE_STATS_BLOCK_SIZE)
+    {
+        u64 block_size = num_entries - start;
+        if (block_size > TRACE_STATS_BLOCK_SIZE) block_size = TRACE_STATS_BLOCK_SIZE;
+
+        trace_stats_masks_t masks = {0};
+#if TRACE_STATS_X86
+        if (use_avx2) trace_stats_masks_build_avx2(&masks, &entries[start], block_size);
+        else trace_stats_masks_build_scalar(&masks, &entries[start], 0, block_size);
+#else
+        trace_stats_masks_build_scalar(&masks, &entries[start], 0, block_size);
+#endif
+
+        trace_stats_add_masks(stats, &masks, block_size);
+    }
+}
+
+void merge_trace_stats(trace_stats_t * stats, trace_stats_t * other)
+{
+    stats->num_entries += other->num_entries;
+    stats->num_entries_no_paddr += other->num_entries_no_paddr;
+    stats->num_entries_invalid_paddr += other->num_entries_invalid_paddr;
+
+    stats->num_entries_paddr_matches_vaddr += other->num_entries_paddr_matches_vaddr;
+    stats->num_entries_invalid_paddr_matches_vaddr += other->num_entries_invalid_paddr_matches_vaddr;
+
+    for (i64 type = 0; type < NUM_CUSTOM_TRACE_TYPES; type++)
+    {
+        stats->types[type].num_entries += other->types[type].num_entries;
+        stats->types[type].num_no_paddr += other->types[type].num_no_paddr;
+        stats->types[type].num_invalid_paddr += other->types[type].num_invalid_paddr;
+    }
+}
+
+static void print_trace_type_stats(char * description, trace_type_stats_t * type_stats)
+{
+    printf(INDENT4 "%s: %lu\n", description, type_stats->num_entries);
+    printf(INDENT4 "%s without paddr: %lu\n", description, type_stats->num_no_paddr);
+    printf(INDENT4 "%s with invalid paddr: %lu\n", description, type_stats->num_invalid_paddr);
+}
+
+void print_trace_stats(trace_stats_t * stats)
+{
+    u64 num_mem_accesses = stats->num_entries - stats->types[CUSTOM_TRACE_TYPE_INSTR].num_entries;
+
+    printf("Statistics:\n");
+    printf(INDENT4 "Total entries: %lu\n", stats->num_entries);
+    printf(INDENT4 "Total entries without paddr: %lu\n", stats->num_entries_no_paddr);
+    printf(INDENT4 "Total entries with invalid paddr: %lu\n", stats->num_entries_invalid_paddr);
+    printf("\n");
+    printf(INDENT4 "Total entries where paddr == vaddr: %ld\n", stats->num_entries_paddr_matches_vaddr);
+    printf(INDENT4 "Total entries where invalid paddr == vaddr: %ld\n", stats->num_entries_invalid_paddr_matches_vaddr);
+    printf("\n");
+    print_trace_type_stats("Instructions", &stats->types[CUSTOM_TRACE_TYPE_INSTR]);
+    printf("\n");
+    printf(INDENT4 "Total memory accesses: %lu\n", num_mem_accesses);
+    printf("\n");
+    print_trace_type_stats("LOADs", &stats->types[CUSTOM_TRACE_TYPE_LOAD]);
+    printf("\n");
+    print_trace_type_stats("STOREs", &stats->types[CUSTOM_TRACE_TYPE_STORE]);
+    printf("\n");
+    print_trace_type_stats("CLOADs", &stats->types[CUSTOM_TRACE_TYPE_CLOAD]);
+    printf("\n");
+    print_trace_type_stats("CSTOREs", &stats->types[CUSTOM_TRACE_TYPE_CSTORE]);
+}
@@ -40,3 +40,61 @@ bool confirm_overwrite_file(char * filename)
 
     return result;
 }
+
+static void args_remove(int * num_args, char ** args, int index)
+{
+    assert(index >= 0 && index < *num_args);
+    for (int i = index; i < *num_args - 1; i++)
+    {
+        args[i] = args[i + 1];
+    }
+    (*num_args)--;
+}
+
+static char * args_match_option(char * arg, char * name)
+{
+    // options are of the form "--name" or "--name=value"
+    if (arg[0] != '-' || arg[1] != '-') return NULL;
+
+    char * arg_ptr = &arg[2];
+    char * name_ptr = name;
+    while (*name_ptr != '\0')
+    {
+        if (*arg_ptr != *name_ptr) return NULL;
+        arg_ptr++;
+        name_ptr++;
+    }
+
+    if (*arg_ptr != '\0' && *arg_ptr != '=') return NULL;
+    return arg_ptr;
+}
+
+bool args_take_flag(int * num_args, char ** args, char * name)
+{
+    for (int i = 0; i < *num_args; i++)
+    {
+        char * rest = args_match_option(args[i], name);
+        if (rest && *rest == '\0')
+        {
+            args_remove(num_args, args, i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+char * args_take_value(int * num_args, char ** args, char * name)
+{
+    for (int i = 0; i < *num_args; i++)
+    {
+        char * rest = args_match_option(args[i], name);
+        if (rest && *rest == '=')
+        {
+            args_remove(num_args, args, i);
+            return rest + 1;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,173 @@
+#define JDP_IMPLEMENTATION
+#include "jdp.h"
+#undef JDP_IMPLEMENTATION
+
+#define HASHMAP_IMPLEMENTATION
+#include "hashmap.h"
+#undef HASHMAP_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/*
+Inserts from several threads at once into the concurrent set and map, half of the threads inserting directly (in
+bulk) and half filling local tables and merging them in, then checks the results against single-threaded tables.
+- Each thread's keys overlap with the next thread's, so the same keys are inserted by more than one thread.
+*/
+
+#define TEST_NUM_THREADS            8
+#define TEST_KEYS_PER_THREAD        200500
+#define TEST_BULK_SIZE              1000
+#define TEST_NUM_COUNTED_KEYS       1000
+
+#define TEST_CHECK(condition)                                                       \
+    do                                                                              \
+    {                                                                               \
+        if (!(condition))                                                           \
+        {                                                                           \
+            printf("FAILED: %s (%s:%d)\n", #condition, __FILE__, __LINE__);         \
+            exit(1);                                                                \
+        }                                                                           \
+    } while (0)
+
+typedef struct test_thread_t test_thread_t;
+struct test_thread_t
+{
+    u32 thread_idx;
+    concurrent_set_u64 set;
+    concurrent_map_u64 map;
+    pthread_t thread;
+};
+
+// NOTE page aligned, like the keys tracking accessed pages
+static u64 test_get_key(u32 thread_idx, u64 i)
+{
+    return (thread_idx * (TEST_KEYS_PER_THREAD / 2) + i) << 12;
+}
+
+static void * test_thread(void * data)
+{
+    test_thread_t * thread = (test_thread_t *) data;
+    bool merge = thread->thread_idx % 2 == 1;
+
+    set_u64 local_set = {0};
+    map_u64 local_map = {0};
+    if (merge)
+    {
+        local_set = set_u64_create();
+        local_map = map_u64_create();
+    }
+
+    u64 keys[TEST_BULK_SIZE];
+    u64 deltas[TEST_BULK_SIZE];
+    u64 num_keys = 0;
+    for (u64 i = 0; i < TEST_KEYS_PER_THREAD; i++)
+    {
+        u64 key = test_get_key(thread->thread_idx, i);
+        u64 counted_key = key % TEST_NUM_COUNTED_KEYS;
+
+        if (merge)
+        {
+            set_u64_insert(local_set, key);
+
+            u64 count = 0;
+            map_u64_get(local_map, counted_key, &count);
+            map_u64_set(local_map, counted_key, count + 1);
+        }
+        else
+        {
+            keys[num_keys] = key;
+            deltas[num_keys] = 1;
+            num_keys++;
+
+            if (num_keys == TEST_BULK_SIZE)
+            {
+                concurrent_set_u64_insert_bulk(thread->set, keys, num_keys);
+                for (u64 j = 0; j < num_keys; j++) keys[j] %= TEST_NUM_COUNTED_KEYS;
+                concurrent_map_u64_add_bulk(thread->map, keys, deltas, num_keys);
+                num_keys = 0;
+            }
+        }
+    }
+
+    if (merge)
+    {
+        concurrent_set_u64_merge(thread->set, local_set);
+        concurrent_map_u64_merge(thread->map, local_map);
+        set_u64_cleanup(&local_set);
+        map_u64_cleanup(&local_map);
+    }
+    else
+    {
+        concurrent_set_u64_insert_bulk(thread->set, keys, num_keys);
+        for (u64 j = 0; j < num_keys; j++) keys[j] %= TEST_NUM_COUNTED_KEYS;
+        concurrent_map_u64_add_bulk(thread->map, keys, deltas, num_keys);
+    }
+
+    return NULL;
+}
+
+int main(void)
+{
+    static_assert(TEST_KEYS_PER_THREAD % TEST_BULK_SIZE != 0, "The last bulk insert should be a partial one.");
+
+    concurrent_set_u64 set = concurrent_set_u64_create();
+    concurrent_map_u64 map = concurrent_map_u64_create();
+
+    test_thread_t threads[TEST_NUM_THREADS];
+    for (u32 i = 0; i < TEST_NUM_THREADS; i++)
+    {
+        threads[i].thread_idx = i;
+        threads[i].set = set;
+        threads[i].map = map;
+
+        int result = pthread_create(&threads[i].thread, NULL, test_thread, &threads[i]);
+        TEST_CHECK(result == 0);
+    }
+
+    for (u32 i = 0; i < TEST_NUM_THREADS; i++) pthread_join(threads[i].thread, NULL);
+
+    set_u64 expected_set = set_u64_create();
+    map_u64 expected_map = map_u64_create();
+    for (u32 thread_idx = 0; thread_idx < TEST_NUM_THREADS; thread_idx++)
+    {
+        for (u64 i = 0; i < TEST_KEYS_PER_THREAD; i++)
+        {
+            u64 key = test_get_key(thread_idx, i);
+            set_u64_insert(expected_set, key);
+
+            u64 count = 0;
+            map_u64_get(expected_map, key % TEST_NUM_COUNTED_KEYS, &count);
+            map_u64_set(expected_map, key % TEST_NUM_COUNTED_KEYS, count + 1);
+        }
+    }
+
+    TEST_CHECK(concurrent_set_u64_size(set) == set_u64_size(expected_set));
+    for (u32 thread_idx = 0; thread_idx < TEST_NUM_THREADS; thread_idx++)
+    {
+        for (u64 i = 0; i < TEST_KEYS_PER_THREAD; i++)
+        {
+            TEST_CHECK(concurrent_set_u64_contains(set, test_get_key(thread_idx, i)));
+        }
+    }
+    TEST_CHECK(!concurrent_set_u64_contains(set, test_get_key(TEST_NUM_THREADS, TEST_KEYS_PER_THREAD)));
+
+    TEST_CHECK(concurrent_map_u64_size(map) == expected_map.ptr->count);
+    for (u64 key = 0; key < TEST_NUM_COUNTED_KEYS; key++)
+    {
+        u64 count = 0;
+        u64 expected_count = 0;
+        TEST_CHECK(concurrent_map_u64_get(map, key, &count) == map_u64_get(expected_map, key, &expected_count));
+        TEST_CHECK(count == expected_count);
+    }
+
+    set_u64_cleanup(&expected_set);
+    map_u64_cleanup(&expected_map);
+    concurrent_set_u64_cleanup(&set);
+    concurrent_map_u64_cleanup(&map);
+
+    printf("Passed (%u threads, %lu distinct keys).\n", TEST_NUM_THREADS, (u64) TEST_KEYS_PER_THREAD * (TEST_NUM_THREADS + 1) / 2);
+
+    return 0;
+}